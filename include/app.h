@@ -5,16 +5,46 @@
 #include <stddef.h>
 
 #include "config.h"
+#include "event.h"
+#include "log.h"
 #include "model.h"
 #include "rng.h"
 #include "term.h"
 
+enum app_mode {
+  APP_MODE_RUN,
+  APP_MODE_CHECK,
+  APP_MODE_COMPILE,
+  APP_MODE_TAIL,
+  APP_MODE_STATS,
+  APP_MODE_RANGE,
+  /* Keys from --script instead of a terminal. */
+  APP_MODE_SCRIPT,
+};
+
 struct app {
   struct Session session;
   struct TermState term;
+  struct EventLoop events;
   struct Rng rng;
-  size_t group_order[MAX_GROUPS];
-  size_t item_order[MAX_ITEMS_PER_GROUP];
+  struct Limits limits;
+  size_t threads;
+  int mode;
+  int use_cache;
+  struct LogConfig log;
+  /* Window for `cram range`, in milliseconds since the epoch. */
+  u64 range_from;
+  u64 range_to;
+  /* Key script for --script, and the virtual time each key takes. */
+  const char* script;
+  size_t tick_ms;
+  /* --metrics, and the socket from --metrics-socket (NULL: default). */
+  int metrics;
+  const char* metrics_path;
+  /* Image path for `cram compile -o`. */
+  const char* output;
+  /* How the tables were obtained: "parse", "cache" or "image". */
+  const char* source;
 };
 
 int app_main(struct app* app, int argc, char** argv);
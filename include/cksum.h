@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_CKSUM_H
+#define CRAM_CKSUM_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+/* POSIX cksum(1) CRC: polynomial 0x04C11DB7, length appended, inverted.
+ * cksum_init() builds the tables and picks the kernel (PCLMULQDQ where CPUID
+ * reports it, slicing-by-8 otherwise); buffers of CKSUM_PARALLEL_MIN_BYTES
+ * or more per thread are split across up to threads threads. The value never
+ * depends on the kernel or the thread count.
+ */
+int cksum_init(size_t threads);
+const char* cksum_kernel_name(void);
+int cksum_bytes(u32* out, const unsigned char* buf, size_t len);
+
+#endif
@@ -3,19 +3,85 @@
 #define CRAM_CONFIG_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define MAX_GROUPS 65536U
 #define MAX_ITEMS_TOTAL 1048576U
 #define MAX_ITEMS_PER_GROUP 65536U
+#define MAX_GROUPS_CAP 16777216U
+#define MAX_ITEMS_TOTAL_CAP 16777216U
+#define MAX_ITEMS_PER_GROUP_CAP 16777216U
 #define MAX_LINE_LEN 65536U
-#define MAX_FILE_BYTES (16U * 1024U * 1024U)
+#define MAX_DECK_BYTES (64ULL * 1024ULL * 1024ULL * 1024ULL)
+/* Deck, its break table (at most 4 bytes per deck byte) and the rest. */
+#define MAX_IMAGE_BYTES (5ULL * MAX_DECK_BYTES + 1024ULL * 1024ULL * 1024ULL)
+/* Decks read from a pipe or stdin are spooled to a file of at most this many
+ * MiB; --max-spool-mib changes it up to the cap.
+ */
+#define SPOOL_MAX_MIB 4096U
+#define SPOOL_MAX_MIB_CAP 65536U
+/* The deck cache keeps its entries under this many bytes in total, and
+ * drops any not used for this long.
+ */
+#define IMAGE_CACHE_MAX_BYTES (1024ULL * 1024ULL * 1024ULL)
+#define IMAGE_CACHE_MAX_AGE_SECS (30ULL * 24ULL * 3600ULL)
+/* Least recently used entries a store can remove; the scan keeps this many
+ * of the oldest in a fixed table.
+ */
+#define IMAGE_CACHE_EVICT_ENTRIES 256U
+#define MAX_DIR_ENTRIES (1ULL << 32)
+#define MAX_PATH_LEN 4096U
 #define MAX_PROMPTS_PER_RUN 1048576U
 #define MAX_WAIT_LOOPS 1048576U
+#define MAX_SCRIPT_READS (1ULL << 32)
 #define MAX_GROUP_SECONDS 86400U
 #define MAX_GROUP_MILLISECONDS ((unsigned long long)MAX_GROUP_SECONDS * 1000ULL)
 #define RNG_RETRY_LIMIT 64U
 #define MAX_WRITE_LOOPS 65536U
+#define LOAD_USE_MMAP 1
+#define LOAD_WINDOW_BYTES (64U * 1024U)
+#define MAX_ARGS 64U
+#define MAX_PARSE_THREADS 64U
+#define PARSE_CHUNK_MIN_BYTES (256U * 1024U)
+#define CKSUM_PARALLEL_MIN_BYTES (4U * 1024U * 1024U)
+#define LOG_RING_EVENTS 4096U
+#define LOG_BATCH_EVENTS 256U
+#define LOG_IDLE_FLUSH_MS 1000U
+/* How long an event waits for room in a full async ring before it is
+ * dropped.
+ */
+#define LOG_FULL_WAIT_MS 20U
+#define LOG_FLUSH_EVERY_CAP 1048576U
+#define MAX_LOG_WAKEUPS (1ULL << 40)
+/* Log call sites above this level (see enum log_level) are compiled out;
+ * build with `make LOG_LEVEL_MAX=N` to lower it.
+ */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX 4
+#endif
+#define LOG_SHARED_SLOTS 4096U
+#define LOG_TAIL_BACKLOG 10U
+#define LOG_TAIL_POLL_MS 50U
+#define MAX_TAIL_POLLS (1ULL << 40)
+#define LOGDUMP_WINDOW_RECORDS 4096U
+#define MAX_MERGE_SHARDS 1024U
+#define MAX_MERGE_STEPS (1ULL << 40)
+#define MAX_LOGDUMP_WINDOWS (1ULL << 32)
+#define STATS_MAX_SIDS 64U
+#define STATS_MAX_MARKS 65536U
+#define STATS_CHUNK_MIN_BYTES (4U * 1024U * 1024U)
+#define MAX_STATS_LINES (1ULL << 40)
+#define LOG_INDEX_STRIDE 65536U
+#define LOG_ROTATE_KIB_CAP (16U * 1024U * 1024U)
+#define LOG_ROTATE_SECS_CAP (366U * 86400U)
+#define MAX_LOG_SEGMENTS 65536U
+#define MAX_RANGE_EVENTS (1ULL << 40)
+#define MAX_FRAME_ROWS 256U
+#define MAX_EVENT_FDS 8U
+/* Largest key code: bytes, then keys decoded from escape sequences. */
+#define MAX_KEY_CODE 0x1FFU
 
+typedef unsigned short u16;
 typedef unsigned int u32;
 typedef unsigned long long u64;
 
@@ -26,10 +92,33 @@ enum {
   static_assert_max_items_per_group = 1 / ((MAX_ITEMS_PER_GROUP > 0) ? 1 : 0),
   static_assert_items_per_group_le_total =
       1 / ((MAX_ITEMS_PER_GROUP <= MAX_ITEMS_TOTAL) ? 1 : 0),
+  static_assert_max_groups_cap = 1 / ((MAX_GROUPS <= MAX_GROUPS_CAP) ? 1 : 0),
+  static_assert_max_items_total_cap =
+      1 / ((MAX_ITEMS_TOTAL <= MAX_ITEMS_TOTAL_CAP) ? 1 : 0),
+  static_assert_max_items_per_group_cap =
+      1 / ((MAX_ITEMS_PER_GROUP <= MAX_ITEMS_PER_GROUP_CAP) ? 1 : 0),
   static_assert_max_line_len = 1 / ((MAX_LINE_LEN > 0) ? 1 : 0),
-  static_assert_max_file_bytes = 1 / ((MAX_FILE_BYTES > 0) ? 1 : 0),
+  /* Offsets into a line, and columns, fit the u16 of struct Utf8Break. */
+  static_assert_max_line_len_u16 = 1 / ((MAX_LINE_LEN <= 65536U) ? 1 : 0),
+  static_assert_max_deck_bytes =
+      1 / ((MAX_DECK_BYTES > 0 && MAX_DECK_BYTES <= SIZE_MAX / 2U) ? 1 : 0),
+  static_assert_max_image_bytes =
+      1 / ((MAX_IMAGE_BYTES > MAX_DECK_BYTES) ? 1 : 0),
+  static_assert_spool_max_mib = 1 / ((SPOOL_MAX_MIB > 0) ? 1 : 0),
+  static_assert_spool_max_mib_cap =
+      1 / ((SPOOL_MAX_MIB <= SPOOL_MAX_MIB_CAP) ? 1 : 0),
+  static_assert_spool_max_mib_cap_deck =
+      1 / ((SPOOL_MAX_MIB_CAP * 1024ULL * 1024ULL <= MAX_DECK_BYTES) ? 1 : 0),
+  static_assert_image_cache_max_bytes =
+      1 / ((IMAGE_CACHE_MAX_BYTES > 0) ? 1 : 0),
+  static_assert_image_cache_max_age_secs =
+      1 / ((IMAGE_CACHE_MAX_AGE_SECS > 0) ? 1 : 0),
+  static_assert_image_cache_evict_entries =
+      1 / ((IMAGE_CACHE_EVICT_ENTRIES > 0) ? 1 : 0),
+  static_assert_max_path_len = 1 / ((MAX_PATH_LEN >= 256U) ? 1 : 0),
   static_assert_max_prompts_per_run = 1 / ((MAX_PROMPTS_PER_RUN > 0) ? 1 : 0),
   static_assert_max_wait_loops = 1 / ((MAX_WAIT_LOOPS > 0) ? 1 : 0),
+  static_assert_max_script_reads = 1 / ((MAX_SCRIPT_READS > 0) ? 1 : 0),
   static_assert_max_group_seconds = 1 / ((MAX_GROUP_SECONDS > 0) ? 1 : 0),
   static_assert_max_group_ms = 1 /
       (((MAX_GROUP_MILLISECONDS / 1000ULL) ==
@@ -38,6 +127,44 @@ enum {
               0),
   static_assert_rng_retry_limit = 1 / ((RNG_RETRY_LIMIT > 0) ? 1 : 0),
   static_assert_max_write_loops = 1 / ((MAX_WRITE_LOOPS > 0) ? 1 : 0),
+  static_assert_load_window_bytes = 1 / ((LOAD_WINDOW_BYTES > 0) ? 1 : 0),
+  static_assert_max_args = 1 / ((MAX_ARGS > 1) ? 1 : 0),
+  static_assert_max_parse_threads = 1 / ((MAX_PARSE_THREADS > 0) ? 1 : 0),
+  static_assert_parse_chunk_min_bytes =
+      1 / ((PARSE_CHUNK_MIN_BYTES > 0) ? 1 : 0),
+  static_assert_cksum_parallel_min_bytes =
+      1 / ((CKSUM_PARALLEL_MIN_BYTES >= 64U) ? 1 : 0),
+  static_assert_log_ring_events =
+      1 / (((LOG_RING_EVENTS & (LOG_RING_EVENTS - 1U)) == 0) ? 1 : 0),
+  static_assert_log_batch_events = 1 /
+      ((LOG_BATCH_EVENTS > 0 && LOG_BATCH_EVENTS <= LOG_RING_EVENTS) ? 1 : 0),
+  static_assert_log_idle_flush_ms = 1 / ((LOG_IDLE_FLUSH_MS > 0) ? 1 : 0),
+  static_assert_log_full_wait_ms =
+      1 / ((LOG_FULL_WAIT_MS > 0 && LOG_FULL_WAIT_MS < 1000U) ? 1 : 0),
+  static_assert_log_flush_every_cap = 1 / ((LOG_FLUSH_EVERY_CAP > 0) ? 1 : 0),
+  static_assert_log_level_max =
+      1 / ((LOG_LEVEL_MAX >= 0 && LOG_LEVEL_MAX <= 4) ? 1 : 0),
+  static_assert_log_shared_slots =
+      1 / (((LOG_SHARED_SLOTS & (LOG_SHARED_SLOTS - 1U)) == 0) ? 1 : 0),
+  static_assert_log_tail_backlog =
+      1 / ((LOG_TAIL_BACKLOG <= LOG_SHARED_SLOTS) ? 1 : 0),
+  static_assert_log_tail_poll_ms = 1 / ((LOG_TAIL_POLL_MS > 0) ? 1 : 0),
+  static_assert_logdump_window_records =
+      1 / ((LOGDUMP_WINDOW_RECORDS > 0) ? 1 : 0),
+  static_assert_max_merge_shards = 1 / ((MAX_MERGE_SHARDS > 0) ? 1 : 0),
+  static_assert_stats_max_sids = 1 / ((STATS_MAX_SIDS > 0) ? 1 : 0),
+  static_assert_stats_max_marks = 1 / ((STATS_MAX_MARKS > 0) ? 1 : 0),
+  static_assert_stats_chunk_min_bytes =
+      1 / ((STATS_CHUNK_MIN_BYTES > 0) ? 1 : 0),
+  static_assert_log_index_stride = 1 / ((LOG_INDEX_STRIDE > 0) ? 1 : 0),
+  static_assert_log_rotate_kib_cap = 1 / ((LOG_ROTATE_KIB_CAP > 0) ? 1 : 0),
+  static_assert_log_rotate_secs_cap = 1 / ((LOG_ROTATE_SECS_CAP > 0) ? 1 : 0),
+  static_assert_max_log_segments = 1 / ((MAX_LOG_SEGMENTS > 0) ? 1 : 0),
+  static_assert_max_event_fds = 1 / ((MAX_EVENT_FDS > 0) ? 1 : 0),
+  static_assert_max_key_code = 1 / ((MAX_KEY_CODE > 255U) ? 1 : 0),
+  /* A frame takes two iovecs a row; Linux writev() takes up to 1024. */
+  static_assert_max_frame_rows =
+      1 / ((MAX_FRAME_ROWS > 0 && MAX_FRAME_ROWS <= 500U) ? 1 : 0),
 };
 
 static inline int assert_ok(int cond) {
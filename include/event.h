@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_EVENT_H
+#define CRAM_EVENT_H
+
+#include <signal.h>
+#include <stddef.h>
+
+#include "config.h"
+
+/* The runner's event core: one epoll set holding the key input, a timerfd
+ * for the group deadline and a signalfd for SIGWINCH, SIGTERM and SIGHUP,
+ * plus up to MAX_EVENT_FDS fds the caller adds, such as a control socket.
+ * Nothing wakes the process but an event, and a wait never needs a clock
+ * read or a timeout of its own. The signals stay blocked in the calling
+ * thread while the loop is open; threads started earlier must block them
+ * too (see log.c).
+ */
+enum event_kind {
+  /* Woken without anything to report, e.g. a timer re-armed meanwhile. */
+  EVENT_NONE = 0,
+  EVENT_INPUT = 1,
+  /* The deadline passed; it stays disarmed until set again. */
+  EVENT_DEADLINE = 2,
+  EVENT_RESIZE = 3,
+  /* SIGTERM or SIGHUP. */
+  EVENT_TERMINATE = 4,
+  /* One of the fds from event_add_fd() is readable. */
+  EVENT_FD = 5,
+};
+
+struct EventLoop {
+  int epoll_fd;
+  int timer_fd;
+  int signal_fd;
+  int input_fd;
+  /* Signal mask before event_open(). */
+  sigset_t saved_mask;
+  int fds[MAX_EVENT_FDS];
+  size_t fd_count;
+  int active;
+};
+
+struct Event {
+  int kind;
+  /* The readable fd, for EVENT_INPUT and EVENT_FD. */
+  int fd;
+};
+
+int event_open(
+    struct EventLoop* loop, int input_fd, char* err_buf, size_t err_len);
+/* Signals that arrived since the last wait are dropped. */
+int event_close(struct EventLoop* loop);
+/* Fires EVENT_DEADLINE once CLOCK_MONOTONIC reaches deadline_ms; 0 disarms
+ * the timer.
+ */
+int event_set_deadline(struct EventLoop* loop, u64 deadline_ms);
+int event_add_fd(struct EventLoop* loop, int fd);
+int event_remove_fd(struct EventLoop* loop, int fd);
+/* Blocks until the next event. Ready sources take turns, so a busy input
+ * cannot starve the deadline or a signal.
+ */
+int event_wait(struct EventLoop* loop, struct Event* out);
+
+#endif
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_HIST_H
+#define CRAM_HIST_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+/* Log-linear histogram of non-negative integers: values below 16 are
+ * exact and every power of two above that is split into 16 buckets, so a
+ * quantile is reported within 1/16 of the true value. Fixed size, no
+ * allocation; histograms of the same quantity can be merged.
+ */
+#define HIST_SUB_BUCKETS 16U
+#define HIST_BUCKETS (HIST_SUB_BUCKETS + 60U * HIST_SUB_BUCKETS)
+
+struct Hist {
+  u64 count;
+  u64 sum;
+  u64 min;
+  u64 max;
+  u64 buckets[HIST_BUCKETS];
+};
+
+int hist_reset(struct Hist* hist);
+int hist_add(struct Hist* hist, u64 value);
+int hist_merge(struct Hist* into, const struct Hist* from);
+/* Smallest value in the bucket holding the q-th of q_den ranked values,
+ * e.g. (99, 100) for p99; 0 for an empty histogram.
+ */
+u64 hist_quantile(const struct Hist* hist, u64 q, u64 q_den);
+/* Number of values in [low, high). */
+u64 hist_count_range(const struct Hist* hist, u64 low, u64 high);
+/* The bucket value falls in, and the smallest value bucket holds, for
+ * callers that keep the counts themselves (see metrics.c).
+ */
+size_t hist_bucket(u64 value);
+u64 hist_bucket_low(size_t bucket);
+
+#endif
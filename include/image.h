@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_IMAGE_H
+#define CRAM_IMAGE_H
+
+#include <stddef.h>
+
+#include "config.h"
+#include "model.h"
+
+/* Compiled deck image (.cramb), host byte order:
+ *
+ *   header | Group table | Item table | break table | string pool
+ *
+ * `cram compile` writes images that carry the pool (the deck text itself),
+ * so loading one is a single read-only mmap with no parsing. Cache images
+ * leave the pool out and are tied to their deck by its cksum and length, and
+ * by a 64-bit digest of its text checked on every hit, so two decks whose
+ * 32-bit cksums collide cannot share tables.
+ * Every image is rejected unless its version, checksums and tables check out.
+ */
+#define IMAGE_VERSION 4U
+
+/* 1 if path is a regular file that starts with the image magic. */
+int image_probe(const char* path);
+int image_load_file(const char* path,
+    const struct Limits* limits,
+    struct Session* session,
+    char* err_buf,
+    size_t err_len);
+int image_write(const struct Session* session,
+    const char* path,
+    int with_pool,
+    char* err_buf,
+    size_t err_len);
+
+/* Looks up the cached tables for the deck already loaded into session.
+ * Returns 0 when they were adopted, 1 on a miss with the cache file name
+ * in path, -1 when there is no usable cache directory. A hit refreshes the
+ * entry's mtime, which eviction goes by.
+ */
+int image_cache_lookup(struct Session* session, char* path, size_t path_len);
+/* Stores the tables at path from image_cache_lookup(), then evicts entries
+ * unused for IMAGE_CACHE_MAX_AGE_SECS and the least recently used ones
+ * until the cache fits in IMAGE_CACHE_MAX_BYTES.
+ */
+int image_cache_store(const struct Session* session, const char* path);
+
+#endif
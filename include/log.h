@@ -4,18 +4,102 @@
 
 #include <stddef.h>
 
+#include "logfmt.h"
+
 struct Session;
 
-int log_open(const struct Session* session);
+/* Each level includes the ones before it. */
+enum log_level {
+  LOG_LEVEL_ERROR = 0,
+  /* start, exit and the deck that was loaded. */
+  LOG_LEVEL_SESSION = 1,
+  /* Group switches, expiries and reshuffles. */
+  LOG_LEVEL_GROUP = 2,
+  LOG_LEVEL_PROMPT = 3,
+  /* Every key read: a byte, or a code from 256 up for one decoded from an
+   * escape sequence (see enum term_key).
+   */
+  LOG_LEVEL_KEY = 4,
+};
+
+/* A constant expression, so `if (LOG_ENABLED(...))` around a call site
+ * removes it from builds with a lower LOG_LEVEL_MAX.
+ */
+#define LOG_ENABLED(level) ((level) <= LOG_LEVEL_MAX)
+
+enum log_format {
+  /* cram.log, one line per event. */
+  LOG_FORMAT_TEXT,
+  /* cram.logb, fixed-width records; see logfmt.h. */
+  LOG_FORMAT_BINARY,
+};
+
+enum log_flush {
+  /* Sync once, on close; async mode still writes at least every
+   * LOG_IDLE_FLUSH_MS.
+   */
+  LOG_FLUSH_EXIT,
+  /* Write and fdatasync() after every `every` events. */
+  LOG_FLUSH_EVENTS,
+  /* Write and fdatasync() at most every `every` milliseconds. */
+  LOG_FLUSH_MS,
+};
+
+enum log_rotate {
+  LOG_ROTATE_NONE,
+  /* Start a new segment once the active one holds `rotate_every` KiB. */
+  LOG_ROTATE_KIB,
+  /* Start a new segment once the active one is `rotate_every` s old. */
+  LOG_ROTATE_SECS,
+};
+
+/* async hands events to a writer thread through a lock-free ring; the
+ * thread formats them and writes them in batches with writev(). An event
+ * that finds the ring full waits up to LOG_FULL_WAIT_MS for the writer and
+ * is then dropped, and the exit record counts the drops.
+ */
+struct LogConfig {
+  int async;
+  int format;
+  /* Events above this level are skipped; at most LOG_LEVEL_MAX. */
+  int level;
+  /* Write cram.<pid>.log(b), with the session ID on every line, instead of
+   * sharing cram.log with other instances.
+   */
+  int shard;
+  int flush;
+  size_t every;
+  /* Also publish events to this shared ring file for `cram tail`, or NULL.
+   * Implies async, so the writer thread persists what the UI publishes.
+   */
+  const char* ring;
+  /* Rename the log to numbered segments and keep a time index for each;
+   * see logseg.h. Checked after each write, so a segment can run over by
+   * one batch of events.
+   */
+  int rotate;
+  size_t rotate_every;
+  /* A full async ring waits for the writer however long it takes instead
+   * of dropping events; for --script runs, which have no redraw to keep
+   * on time.
+   */
+  int lossless;
+};
+
+int log_config_default(struct LogConfig* config);
+int log_open(const struct Session* session, const struct LogConfig* config);
 int log_close(const struct Session* session);
+/* Drains and closes without an exit record, for fatal error paths. */
+int log_abort(void);
 
 int log_input(const struct Session* session, const char* path);
 
-int log_simple(const char* tag, const char* msg);
+/* type is LOG_TYPE_START, _EXIT, _SHUFFLE or _ERROR. */
+int log_simple(int type);
 int log_key(int key);
 int log_prompt(
     const struct Session* session, size_t group_index, size_t item_index);
-int log_group(const char* tag, size_t group_index);
-int log_shuffle(const char* tag, size_t group_index);
+/* type is LOG_TYPE_GROUP, _EXPIRED or _ITEMS. */
+int log_group(int type, size_t group_index);
 
 #endif
@@ -0,0 +1,192 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_LOGFMT_H
+#define CRAM_LOGFMT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "config.h"
+
+/* Binary event log (cram.logb), host byte order:
+ *
+ *   header | record | record | ...
+ *
+ * Every record is LOG_RECORD_BYTES. A LOG_TYPE_FILE record is followed by
+ * `extra` records holding its path, NUL padded. cram-logdump turns the file
+ * back into the lines cram.log would have held.
+ */
+#define LOG_BINARY_VERSION 1U
+#define LOG_HEADER_BYTES 24U
+#define LOG_RECORD_BYTES 48U
+/* The log is one process's shard; its lines carry the session ID. */
+#define LOG_FLAG_SHARD 1U
+/* Longest path a file event keeps, including the NUL. */
+#define LOG_PATH_BYTES 192U
+
+enum log_type {
+  LOG_TYPE_START = 1,
+  LOG_TYPE_EXIT = 2,
+  LOG_TYPE_FILE = 3,
+  LOG_TYPE_PROMPT = 4,
+  LOG_TYPE_KEY = 5,
+  LOG_TYPE_GROUP = 6,
+  LOG_TYPE_EXPIRED = 7,
+  LOG_TYPE_ITEMS = 8,
+  LOG_TYPE_SHUFFLE = 9,
+  LOG_TYPE_ERROR = 10,
+  /* First record of a rotated log segment; see logseg.h. */
+  LOG_TYPE_SEGMENT = 11,
+};
+
+struct LogHeader {
+  char magic[8];
+  u32 version;
+  u32 record_bytes;
+  u32 byte_order;
+  u32 flags;
+};
+
+/* Fields a type does not use are zero. value is the key for LOG_TYPE_KEY,
+ * the deck length for LOG_TYPE_FILE, whose cksum is in ick, the session
+ * ID for LOG_TYPE_START and LOG_TYPE_SEGMENT, and the events dropped from
+ * a full async ring for LOG_TYPE_EXIT.
+ */
+struct LogRecord {
+  u64 time_ms;
+  u64 value;
+  u32 type;
+  u32 extra;
+  u32 group;
+  u32 item;
+  u32 gck;
+  u32 glen;
+  u32 ick;
+  u32 ilen;
+};
+
+enum {
+  static_assert_log_header_bytes =
+      1 / ((sizeof(struct LogHeader) == LOG_HEADER_BYTES) ? 1 : 0),
+  static_assert_log_record_bytes =
+      1 / ((sizeof(struct LogRecord) == LOG_RECORD_BYTES) ? 1 : 0),
+  static_assert_log_path_bytes =
+      1 / ((LOG_PATH_BYTES % LOG_RECORD_BYTES == 0) ? 1 : 0),
+};
+
+/* Shared ring log (--log-ring), host byte order:
+ *
+ *   LogRingHeader | LOG_SHARED_SLOTS x LogRingSlot
+ *
+ * The logging process overwrites the oldest slot and readers such as
+ * `cram tail` follow along without ever blocking it. Event n lives in slot
+ * n % LOG_SHARED_SLOTS, whose seq is 2n + 1 while it is being written and
+ * 2n + 2 once it is complete; head is the number of events published.
+ */
+#define LOG_RING_VERSION 1U
+#define LOG_RING_HEADER_BYTES 256U
+#define LOG_RING_SLOT_BYTES 64U
+
+struct LogRingHeader {
+  char magic[8];
+  u32 version;
+  u32 slot_count;
+  u32 slot_bytes;
+  u32 byte_order;
+  u64 pid;
+  u64 sid;
+  atomic_ullong head;
+  /* Set once the logging process has closed its log. */
+  atomic_uint closed;
+  u32 reserved;
+  /* The deck path of the file event; records cannot hold it. */
+  char path[LOG_PATH_BYTES];
+  u64 reserved2;
+};
+
+/* A reader may copy a slot while the writer refills it, so the record is
+ * stored as relaxed atomic words in LogRecord layout; seq tells the reader
+ * whether its copy is whole.
+ */
+#define LOG_RING_RECORD_WORDS (LOG_RECORD_BYTES / 8U)
+
+struct LogRingSlot {
+  atomic_ullong seq;
+  atomic_ullong rec[LOG_RING_RECORD_WORDS];
+  u64 reserved;
+};
+
+enum {
+  static_assert_log_ring_header_bytes = 1 /
+      ((sizeof(struct LogRingHeader) == LOG_RING_HEADER_BYTES) ? 1 : 0),
+  static_assert_log_ring_slot_bytes =
+      1 / ((sizeof(struct LogRingSlot) == LOG_RING_SLOT_BYTES) ? 1 : 0),
+  static_assert_log_ring_record_words =
+      1 / ((LOG_RING_RECORD_WORDS * 8U == LOG_RECORD_BYTES) ? 1 : 0),
+};
+
+/* Segment index (<segment>.idx, kept with --log-rotate), host byte order:
+ *
+ *   LogIndexHeader | LogIndexEntry | LogIndexEntry | ...
+ *
+ * An entry maps the time of an event to its byte offset in the segment.
+ * Every session start gets one, and other events one at least every
+ * LOG_INDEX_STRIDE bytes, so a reader seeks to the last entry before the
+ * time it wants and scans less than a stride of events it does not.
+ */
+#define LOG_INDEX_VERSION 1U
+#define LOG_INDEX_HEADER_BYTES 24U
+#define LOG_INDEX_ENTRY_BYTES 24U
+
+enum log_index_kind {
+  LOG_INDEX_MARK = 0,
+  LOG_INDEX_START = 1,
+};
+
+struct LogIndexHeader {
+  char magic[8];
+  u32 version;
+  u32 entry_bytes;
+  u32 byte_order;
+  u32 reserved;
+};
+
+struct LogIndexEntry {
+  u64 time_ms;
+  u64 offset;
+  u32 kind;
+  u32 reserved;
+};
+
+enum {
+  static_assert_log_index_header_bytes = 1 /
+      ((sizeof(struct LogIndexHeader) == LOG_INDEX_HEADER_BYTES) ? 1 : 0),
+  static_assert_log_index_entry_bytes =
+      1 / ((sizeof(struct LogIndexEntry) == LOG_INDEX_ENTRY_BYTES) ? 1 : 0),
+};
+
+/* The tag printed for type, or NULL if type is unknown. */
+const char* logfmt_tag(u32 type);
+/* 1 for types that carry no fields: start, exit, shuffle, error and
+ * segment.
+ */
+int logfmt_is_simple(u32 type);
+
+int logfmt_header_init(struct LogHeader* header, u32 flags);
+int logfmt_header_check(const struct LogHeader* header);
+int logfmt_ring_init(struct LogRingHeader* header, u64 pid, u64 sid);
+int logfmt_ring_check(const struct LogRingHeader* header);
+int logfmt_index_init(struct LogIndexHeader* header);
+int logfmt_index_check(const struct LogIndexHeader* header);
+
+/* Formats rec as one cram.log line, "<sec>.<ms> [tag] message\n", or as a
+ * shard line "<sec>.<ms> <sid> [tag] message\n" when sid is not zero. path
+ * is the already sanitized path of a file event, or NULL. Returns the
+ * length, or 0 if rec is malformed or the line does not fit.
+ */
+size_t logfmt_text(const struct LogRecord* rec,
+    const char* path,
+    u64 sid,
+    char* line,
+    size_t len);
+
+#endif
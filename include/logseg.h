@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_LOGSEG_H
+#define CRAM_LOGSEG_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+/* Rotated logs (--log-rotate). The active segment keeps the log's own name
+ * (cram.log, cram.<pid>.logb, ...); a full one is renamed to <name>.<n>,
+ * numbered upwards from 1, so a higher number is newer. Each segment has a
+ * sidecar time index, <segment>.idx (see logfmt.h).
+ */
+
+/* "<base>.<number><suffix>", or "<base><suffix>" for number 0. */
+int logseg_name(
+    const char* base, u32 number, const char* suffix, char* out, size_t len);
+/* The highest closed segment number of base, 0 if there is none, or -1. */
+long logseg_last(const char* base);
+
+/* `cram range`: writes the events of base and its closed segments with
+ * from_ms <= time < to_ms to stdout, oldest first. Each segment's index
+ * gives the place to start reading, and segments wholly outside the window
+ * are not read. Text logs come out as lines; binary logs as a header and
+ * records, for cram-logdump.
+ */
+int logseg_range(const char* base,
+    u64 from_ms,
+    u64 to_ms,
+    char* err_buf,
+    size_t err_len);
+
+#endif
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_METRICS_H
+#define CRAM_METRICS_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+/* Live counters and latency histograms for --metrics, served in the
+ * Prometheus text format to whoever connects to a Unix socket. Recording
+ * is a relaxed atomic add into fixed tables, safe from any thread and a
+ * single branch while no socket is open. A response reads each value
+ * whole, not the whole set at one instant. The socket is answered from
+ * the runner's event loop, one response per connection.
+ */
+enum metric_counter {
+  /* Prompts shown, the first one included. */
+  METRIC_PROMPTS,
+  /* Group and item orders shuffled. */
+  METRIC_SHUFFLES,
+  /* Groups whose time ran out. */
+  METRIC_EXPIRIES,
+  METRIC_KEYS,
+  METRIC_COUNTERS,
+};
+
+/* Kept in nanoseconds in the log-linear buckets of hist.h. */
+enum metric_hist {
+  /* From waking up to a key batch to the end of the frame it drew. */
+  METRIC_KEY_TO_DRAW,
+  /* One write of log lines, with the sync it triggered, if any. */
+  METRIC_LOG_WRITE,
+  /* One rng_shuffle_groups() or rng_shuffle_items() call. */
+  METRIC_SHUFFLE,
+  METRIC_HISTS,
+};
+
+/* Listens on path, or on $XDG_RUNTIME_DIR/cram.<pid>.sock (/tmp without
+ * it) when path is NULL, and returns the socket for the event loop.
+ */
+int metrics_open(
+    const char* path, int* out_fd, char* err_buf, size_t err_len);
+/* Stops recording and removes the socket. */
+int metrics_close(void);
+int metrics_count(int counter);
+/* A start time for metrics_observe(); 0 while closed, so nothing is
+ * timed.
+ */
+u64 metrics_start(void);
+/* Records the time since start, unless start is 0. */
+int metrics_observe(int hist, u64 start);
+/* Answers the connections waiting on the socket. A client that goes away
+ * or reads too slowly loses its response; only a failing socket is an
+ * error.
+ */
+int metrics_serve(void);
+
+#endif
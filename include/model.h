@@ -5,29 +5,93 @@
 #include <stddef.h>
 
 #include "config.h"
+#include "utf8.h"
 
+/* Offsets into Session::text are 64-bit so decks may exceed 4 GiB. The
+ * cksum_bytes() of each item and group name is taken once by the parser,
+ * so logging a prompt does not rescan its text. So is the layout of the
+ * item: its display width and its units, Session::breaks[first_break] on
+ * (see utf8.h), so drawing it does not decode the text either.
+ */
 struct Item {
-  u32 offset;
+  u64 offset;
+  u64 first_break;
   u32 length;
+  u32 cksum;
+  /* 0 for text the renderer lays out byte by byte. */
+  u32 breaks;
+  u32 width;
 };
 
 struct Group {
-  u32 name_offset;
+  u64 name_offset;
   u32 name_length;
   u32 seconds;
   u32 item_start;
   u32 item_count;
+  u32 name_cksum;
+  u32 reserved;
+};
+
+/* Runtime limits; defaults come from config.h, ceilings are the *_CAP
+ * values there.
+ */
+struct Limits {
+  size_t max_groups;
+  size_t max_items_total;
+  size_t max_items_per_group;
+  /* Largest pipe or stdin deck spooled to disk, in MiB. */
+  size_t max_spool_mib;
+};
+
+/* Exact table sizes for one deck, taken by the counting pass. tables is 0
+ * when the Group, Item and break tables come from a compiled image and only
+ * the shuffle order arrays need space.
+ */
+struct SessionSizes {
+  size_t groups;
+  size_t items;
+  size_t group_items;
+  size_t breaks;
+  int tables;
 };
 
 struct Session {
-  char buffer[MAX_FILE_BYTES + 1];
+  /* Deck bytes: a private read-only mapping of the deck file, its spool
+   * file or its compiled image.
+   */
+  const char* text;
   size_t buffer_len;
-  struct Group groups[MAX_GROUPS];
+  void* map_base;
+  size_t map_len;
+  /* cksum_bytes() of text, once something has computed it. */
+  u32 cksum;
+  int have_cksum;
+  /* Cached compiled tables for text, mapped read-only (see image.h). */
+  void* image_base;
+  size_t image_len;
+  struct Limits limits;
+  /* Everything below lives in one arena sized by session_reserve(), except
+   * the tables when they point into a compiled image.
+   */
+  void* arena;
+  struct Group* groups;
+  size_t group_cap;
   size_t group_count;
-  struct Item items[MAX_ITEMS_TOTAL];
+  struct Item* items;
+  size_t item_cap;
   size_t item_count;
+  struct Utf8Break* breaks;
+  size_t break_cap;
+  size_t break_count;
+  size_t* group_order;
+  size_t* item_order;
 };
 
-int session_init(struct Session* session);
+int limits_default(struct Limits* limits);
+int session_init(struct Session* session, const struct Limits* limits);
+int session_reserve(
+    struct Session* session, const struct SessionSizes* sizes);
+int session_release(struct Session* session);
 
 #endif
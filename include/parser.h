@@ -4,7 +4,14 @@
 
 #include "model.h"
 
-int parse_session_file(
-    const char* path, struct Session* session, char* err_buf, size_t err_len);
+/* Loads the deck bytes into session->text without parsing them. */
+int parse_load_file(const char* path,
+    const struct Limits* limits,
+    struct Session* session,
+    char* err_buf,
+    size_t err_len);
+/* Builds the Group and Item tables from session->text. */
+int parse_session_buffer(
+    struct Session* session, size_t threads, char* err_buf, size_t err_len);
 
 #endif
@@ -4,14 +4,46 @@
 
 #include <stddef.h>
 
+#include "config.h"
+
 struct Session;
+struct EventLoop;
 struct Rng;
 struct TermState;
 
+/* A headless run: keys come from a file instead of a terminal and frames
+ * go to out_fd, normally /dev/null. Time is virtual: each key moves the
+ * clock on by tick_ms before it is handled, so groups expire after
+ * seconds * 1000 / tick_ms keys; with tick_ms at 0 they never do.
+ */
+struct RunnerScript {
+  int fd;
+  int out_fd;
+  u64 tick_ms;
+};
+
+struct RunnerStats {
+  u64 keys;
+  /* Prompts shown, the first one included. */
+  u64 prompts;
+  /* Group and item orders shuffled. */
+  u64 shuffles;
+  /* Bytes of frames written. */
+  u64 bytes;
+};
+
 int runner_run(const struct TermState* term,
+    struct EventLoop* events,
     struct Session* session,
     struct Rng* rng,
     size_t* group_order,
     size_t* item_order);
+/* Runs until the script ends or holds Ctrl+C. */
+int runner_script(struct Session* session,
+    struct Rng* rng,
+    size_t* group_order,
+    size_t* item_order,
+    const struct RunnerScript* script,
+    struct RunnerStats* out);
 
 #endif
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_SCAN_H
+#define CRAM_SCAN_H
+
+#include <stddef.h>
+
+/* Byte scanners used by the parser and `cram stats`. scan_init() picks the
+ * widest kernel the CPU supports (AVX2, SSE2 or portable C); results never
+ * depend on it.
+ * Whitespace is what isspace() accepts in the C locale.
+ */
+int scan_init(void);
+const char* scan_kernel_name(void);
+size_t scan_find_byte(const char* buf, size_t len, char ch);
+size_t scan_span_space(const char* buf, size_t len);
+size_t scan_rspan_space(const char* buf, size_t len, size_t start);
+/* Splits the line at the start of buf: stores the offsets of up to max
+ * `sep` bytes that come before the first '\n' in cuts and their number in
+ * *count. Returns the line length (the offset of that '\n', or len).
+ */
+size_t scan_split_line(const char* buf,
+    size_t len,
+    char sep,
+    size_t* cuts,
+    size_t max,
+    size_t* count);
+/* The offset of the first byte of the first invalid UTF-8 sequence in buf,
+ * or len if there is none. Overlong forms, surrogates, code points above
+ * U+10FFFF, stray continuation bytes and sequences cut short by the end of
+ * buf are all invalid.
+ */
+size_t scan_find_bad_utf8(const char* buf, size_t len);
+
+#endif
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_STATS_H
+#define CRAM_STATS_H
+
+#include <stddef.h>
+
+/* `cram stats <log>`: maps a text log (cram.log, a shard, or merged or
+ * concatenated shards) and prints event counts, prompts per group and item,
+ * session durations and the distribution of times between keys. The file
+ * is split at newlines across up to `threads` threads. Sessions and key
+ * gaps are tracked per session ID, so interleaved shards are handled; plain
+ * cram.log lines carry none and are taken as one session at a time.
+ */
+int stats_run(const char* path, size_t threads, char* err_buf, size_t err_len);
+
+#endif
@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_TAIL_H
+#define CRAM_TAIL_H
+
+#include <stddef.h>
+
+/* `cram tail <ring>`: prints the last few events of a shared ring log (see
+ * logfmt.h) and then follows it until the logging process closes its log
+ * or exits. Events overwritten before they could be read are reported as
+ * skipped rather than printed.
+ */
+int tail_run(const char* path, char* err_buf, size_t err_len);
+
+#endif
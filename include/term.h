@@ -5,16 +5,108 @@
 #include <stddef.h>
 #include <termios.h>
 
+#include "utf8.h"
+
+#define TERM_STATUS_BYTES 64U
+/* Most bytes one read takes, and most keys queued at once. */
+#define TERM_INPUT_BYTES 256U
+
 struct TermState {
   struct termios original;
   int active;
 };
 
+/* Prompt frames, each sent with one writev() and the text taken straight
+ * from the caller's buffer. The first frame clears the screen; later ones
+ * return the cursor home, paint over the previous frame and erase what it
+ * left to the right and below, unless the text holds control bytes that
+ * could skip cells, which costs a full clear again.
+ *
+ * Only what fits the window is sent: text that needs more rows than the
+ * window has is shown a page at a time, with a status line, and
+ * term_frame_scroll() moves between pages.
+ *
+ * Text that comes with its units (see utf8.h) is word-wrapped from them,
+ * one iovec per row, without being decoded; other text is left to the
+ * terminal's own wrapping. Pages use at most MAX_FRAME_ROWS rows.
+ */
+struct TermFrame {
+  /* Where frames go: the terminal, or /dev/null for a scripted run. */
+  int fd;
+  /* Bytes written to fd so far. */
+  u64 bytes_out;
+  const char* text;
+  size_t len;
+  const struct Utf8Break* breaks;
+  size_t units;
+  size_t width;
+  /* The bytes on screen are text[top, bottom). */
+  size_t top;
+  size_t bottom;
+  /* Window size from TIOCGWINSZ on fd, 24x80 when fd is no terminal;
+   * refreshed by term_frame_redraw().
+   */
+  size_t rows;
+  size_t cols;
+  /* A frame is on screen for the next one to paint over. */
+  int drawn;
+  char status[TERM_STATUS_BYTES];
+};
+
+/* Keys decoded from escape sequences; other keys are their byte. */
+enum term_key {
+  TERM_KEY_UP = 0x100,
+  TERM_KEY_DOWN = 0x101,
+  TERM_KEY_RIGHT = 0x102,
+  TERM_KEY_LEFT = 0x103,
+  TERM_KEY_HOME = 0x104,
+  TERM_KEY_END = 0x105,
+  TERM_KEY_PAGE_UP = 0x106,
+  TERM_KEY_PAGE_DOWN = 0x107,
+  /* A complete sequence with no meaning here, such as a function key. */
+  TERM_KEY_OTHER = 0x108,
+};
+
+/* Keys waiting to be handled. Each read takes all the input available, up
+ * to what the queue has room for, and decodes it at once, so a paste or a
+ * burst of key repeats costs one read() rather than one per byte.
+ */
+struct TermInput {
+  unsigned char bytes[TERM_INPUT_BYTES];
+  /* bytes[0, pending) start an escape sequence still arriving. */
+  size_t pending;
+  int keys[TERM_INPUT_BYTES];
+  size_t head;
+  size_t count;
+};
+
+int term_attach_tty(char* err_buf, size_t err_len);
 int term_enter_raw(struct TermState* state, char* err_buf, size_t err_len);
 int term_restore(struct TermState* state);
 int term_clear_screen(void);
+int term_frame_init(struct TermFrame* frame, int fd);
+/* Shows the first page of text, which must outlive the frame, as must its
+ * units from utf8_breaks(); units is 0 for text that has none.
+ */
+int term_frame_draw(struct TermFrame* frame,
+    const char* text,
+    size_t len,
+    const struct Utf8Break* breaks,
+    size_t units,
+    size_t width);
+/* Moves one page forward (pages > 0) or back; a no-op at either end. */
+int term_frame_scroll(struct TermFrame* frame, int pages);
+/* Reads the window size again and repaints the current page in full. */
+int term_frame_redraw(struct TermFrame* frame);
 int term_hide_cursor(void);
 int term_show_cursor(void);
-int term_read_key_timeout(int timeout_ms, int* out_key);
+int term_input_init(struct TermInput* input);
+/* Reads the input available on fd without waiting and queues its keys.
+ * Returns the number of bytes read: 0 when there was nothing to read, or
+ * at the end of a file.
+ */
+int term_input_read(struct TermInput* input, int fd);
+/* Takes the oldest queued key: 1 with *out_key set, 0 when none is left. */
+int term_input_next(struct TermInput* input, int* out_key);
 
 #endif
@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_UTF8_H
+#define CRAM_UTF8_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+/* Display layout of deck text, worked out once by the parser so the
+ * renderer can wrap an item for any window width without decoding it.
+ *
+ * A line of text is cut into units: a run of spaces, a run of other narrow
+ * characters (a word), or one wide character such as an ideograph or an
+ * emoji. A row may end before any unit, and a word wider than the whole
+ * window is cut at a character. Zero-width characters (combining marks,
+ * variation selectors, ZWJ) stay with the character before them, and a
+ * character joined by ZWJ stays with the unit before it. Widths are those
+ * terminals advance the cursor by, as wcwidth() gives them: 2 for East
+ * Asian wide and fullwidth characters and emoji, 0 for the zero-width ones.
+ */
+struct Utf8Break {
+  /* Where the unit starts, from the start of the line. */
+  u16 offset;
+  /* Display columns before offset. */
+  u16 column;
+};
+
+/* Stores the units of text in out, unless out is NULL, and the display
+ * width of text in *width. Returns the number of units, or 0 when text
+ * holds control bytes or is not valid UTF-8, which the renderer then lays
+ * out byte by byte. len is at most MAX_LINE_LEN and cap, when out is set,
+ * at least the count a NULL out returns.
+ */
+size_t utf8_breaks(const char* text,
+    size_t len,
+    struct Utf8Break* out,
+    size_t cap,
+    u32* width);
+/* The length of the longest prefix of text at most cols wide that does
+ * not split a character from the zero-width ones after it; *width gets
+ * its display width. text is one unit of utf8_breaks().
+ */
+size_t utf8_cut(const char* text, size_t len, size_t cols, size_t* width);
+
+#endif
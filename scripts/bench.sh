@@ -0,0 +1,19 @@
+#!/bin/sh
+# SPDX-License-Identifier: MIT
+#
+# Runs cram-bench over the decks from gen_deck.sh and prints its JSON.
+#
+# Usage: scripts/bench.sh > bench.json
+set -eu
+
+BIN=${BIN:-bin/cram-bench}
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/cram-bench-decks.XXXXXX")
+
+trap 'rm -rf "$DIR"' EXIT INT TERM
+
+[ -x "$BIN" ] || { echo "missing $BIN (run make bin/cram-bench)" >&2; exit 1; }
+
+for shape in groups items long crlf; do
+  "$(dirname "$0")/gen_deck.sh" "$shape" "$DIR/$shape"
+done
+"$BIN" "$DIR/groups" "$DIR/items" "$DIR/long" "$DIR/crlf"
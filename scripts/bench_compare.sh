@@ -0,0 +1,60 @@
+#!/bin/sh
+# SPDX-License-Identifier: MIT
+#
+# Compares two cram-bench results by ns_per_op and fails when a case got
+# slower than the baseline by more than tolerance percent (default 10).
+# Cases found in only one file are listed but do not fail the check.
+#
+# Usage: scripts/bench_compare.sh <baseline.json> <current.json> [tolerance]
+set -eu
+
+[ $# -ge 2 ] || {
+  echo "usage: $0 <baseline.json> <current.json> [tolerance]" >&2
+  exit 1
+}
+BASE=$1
+CUR=$2
+TOL=${3:-10}
+
+[ -r "$BASE" ] || { echo "no baseline $BASE (run make bench-baseline)" >&2; exit 1; }
+
+# cram-bench writes one result per line, so each line is read on its own.
+awk -v tol="$TOL" '
+  function field(line, key,    rest) {
+    rest = substr(line, index(line, "\"" key "\": ") + length(key) + 4);
+    sub(/^"/, "", rest);
+    sub(/["},].*$/, "", rest);
+    return rest;
+  }
+  !/"name"/ { next; }
+  FNR == NR { base[field($0, "name")] = field($0, "ns_per_op"); next; }
+  {
+    name = field($0, "name");
+    cur = field($0, "ns_per_op") + 0;
+    seen[name] = 1;
+    if (!(name in base)) {
+      printf "%-32s %14s %14.3f %9s\n", name, "-", cur, "new";
+      next;
+    }
+    old = base[name] + 0;
+    change = (old > 0) ? (cur - old) * 100 / old : 0;
+    flag = (change > tol) ? "  REGRESSION" : "";
+    if (flag != "")
+      failed++;
+    printf "%-32s %14.3f %14.3f %+8.1f%%%s\n", name, old, cur, change, flag;
+  }
+  END {
+    for (name in base) {
+      if (!(name in seen))
+        printf "%-32s %14.3f %14s %9s\n", name, base[name], "-", "gone";
+    }
+    if (failed) {
+      printf "%d case(s) slower than the baseline by more than %s%%\n",
+          failed, tol;
+      exit 1;
+    }
+  }
+  BEGIN {
+    printf "%-32s %14s %14s %9s\n", "case", "base ns/op", "ns/op", "change";
+  }
+' "$BASE" "$CUR"
@@ -0,0 +1,58 @@
+#!/bin/sh
+# SPDX-License-Identifier: MIT
+#
+# Parser scaling benchmark: builds a deck close to MAX_FILE_BYTES and times
+# `cram --check` with 1, 2, 4, ... threads (best of RUNS runs each).
+#
+# Usage: scripts/bench_parse.sh [max-threads] [runs]
+set -eu
+
+BIN=${BIN:-bin/cram}
+MAX_THREADS=${1:-$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)}
+RUNS=${2:-5}
+DECK=${DECK:-${TMPDIR:-/tmp}/cram-bench-parse.$$}
+
+trap 'rm -f "$DECK"' EXIT INT TERM
+
+[ -x "$BIN" ] || { echo "missing $BIN (run make)" >&2; exit 1; }
+
+# ~15 MiB: 17000 groups of 1..32 prompts with CRLF on every 7th group.
+awk 'BEGIN {
+  srand(1);
+  for (g = 0; g < 17000; g++) {
+    eol = (g % 7 == 0) ? "\r" : "";
+    printf "[Group %d | %d]%s\n", g, 1 + int(rand() * 600), eol;
+    n = 1 + int(rand() * 32);
+    for (i = 0; i < n; i++) {
+      printf "  Prompt %d of group %d: %s  %s\n", i, g,
+          substr("the quick brown fox jumps over the lazy dog ", 1,
+              int(rand() * 44)), eol;
+    }
+  }
+}' > "$DECK"
+
+best_us() {
+  best=
+  i=0
+  while [ "$i" -lt "$RUNS" ]; do
+    us=$("$BIN" --check --no-cache --threads "$1" "$DECK" |
+      sed 's/.*parse_us=//')
+    if [ -z "$best" ] || [ "$us" -lt "$best" ]; then
+      best=$us
+    fi
+    i=$((i + 1))
+  done
+  echo "$best"
+}
+
+printf 'deck: %s bytes\n' "$(wc -c < "$DECK" | tr -d ' ')"
+base=$(best_us 1)
+printf '%8s %12s %8s\n' threads parse_us speedup
+printf '%8d %12d %8s\n' 1 "$base" 1.00
+t=2
+while [ "$t" -le "$MAX_THREADS" ]; do
+  us=$(best_us "$t")
+  printf '%8d %12d %8s\n' "$t" "$us" \
+      "$(awk -v a="$base" -v b="$us" 'BEGIN { printf "%.2f", a / b }')"
+  t=$((t * 2))
+done
@@ -0,0 +1,71 @@
+#!/bin/sh
+# SPDX-License-Identifier: MIT
+#
+# Synthetic decks at the edges of the limits in include/config.h, for
+# `make bench` and for trying parser changes by hand:
+#
+#   groups  MAX_GROUPS groups of one prompt each
+#   items   one group of MAX_ITEMS_PER_GROUP prompts
+#   long    64 prompts of exactly MAX_LINE_LEN bytes
+#   crlf    1024 groups of 64 prompts, CRLF line ends, comments and blank
+#           lines throughout
+#
+# Usage: scripts/gen_deck.sh <shape> [out]   (stdout without out)
+set -eu
+
+CONFIG=${CONFIG:-$(dirname "$0")/../include/config.h}
+
+limit() {
+  awk -v name="$1" '$1 == "#define" && $2 == name {
+    sub(/U+$/, "", $3);
+    print $3;
+  }' "$CONFIG"
+}
+
+[ $# -ge 1 ] || { echo "usage: $0 groups|items|long|crlf [out]" >&2; exit 1; }
+SHAPE=$1
+if [ $# -ge 2 ]; then
+  exec > "$2"
+fi
+
+case "$SHAPE" in
+groups)
+  awk -v n="$(limit MAX_GROUPS)" 'BEGIN {
+    for (g = 0; g < n; g++)
+      printf "[Group %d | 60]\nPrompt of group %d\n", g, g;
+  }'
+  ;;
+items)
+  awk -v n="$(limit MAX_ITEMS_PER_GROUP)" 'BEGIN {
+    print "[Everything | 600]";
+    for (i = 0; i < n; i++)
+      printf "Prompt %d: the quick brown fox jumps over the lazy dog\n", i;
+  }'
+  ;;
+long)
+  awk -v len="$(limit MAX_LINE_LEN)" 'BEGIN {
+    line = "";
+    for (i = 0; i + 5 <= len; i += 5)
+      line = line "word ";
+    for (; i < len; i++)
+      line = line "x";
+    print "[Long | 60]";
+    for (i = 0; i < 64; i++)
+      print line;
+  }'
+  ;;
+crlf)
+  awk 'BEGIN {
+    for (g = 0; g < 1024; g++) {
+      printf "# group %d\r\n\r\n[Group %d | 60]\r\n", g, g;
+      for (i = 0; i < 64; i++)
+        printf "Prompt %d of group %d, with CRLF\r\n", i, g;
+      printf "\r\n";
+    }
+  }'
+  ;;
+*)
+  echo "unknown shape: $SHAPE" >&2
+  exit 1
+  ;;
+esac
@@ -1,22 +1,97 @@
 // SPDX-License-Identifier: MIT
 #include "app.h"
+#include "cksum.h"
+#include "image.h"
 #include "log.h"
+#include "logseg.h"
+#include "metrics.h"
 #include "parser.h"
 #include "runner.h"
+#include "scan.h"
+#include "stats.h"
+#include "tail.h"
 #include "term.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Indexed by enum log_level. */
+static const char* const g_log_levels[] = {
+    "error", "session", "group", "prompt", "key"};
 
 static int print_usage(const char* prog) {
   if (!prog)
     return -1;
 
-  int rc = fprintf(stdout, "Usage: %s <session-file>\n", prog);
+  int rc = fprintf(stdout, "Usage: %s [options] <session-file | ->\n", prog);
 
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout,
+      "       %s compile [options] <session-file> -o <image>\n",
+      prog);
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout, "       %s tail <ring-file>\n", prog);
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout, "       %s stats [--threads N] <text-log>\n", prog);
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout,
+      "       %s range [--from SEC] [--to SEC] <log>\n",
+      prog);
   if (rc < 0)
     return -1;
   rc = fprintf(stdout, "       %s -h\n\n", prog);
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout,
+      "Options:\n"
+      "  --max-groups N           groups per deck (default %u, max %u)\n"
+      "  --max-items N            items per deck (default %u, max %u)\n"
+      "  --max-items-per-group N  items per group (default %u, max %u)\n"
+      "  --max-spool-mib N        MiB of a piped deck spooled to disk\n"
+      "                           (default %u, max %u)\n"
+      "  --threads N              parser threads, 0 = one per CPU (max %u)\n"
+      "  --check                  parse only and print deck statistics\n"
+      "  --script FILE            take keys from FILE (or -) without a "
+      "terminal\n"
+      "                           and print prompts per second\n"
+      "  --tick-ms N              virtual ms each scripted key takes "
+      "(default 0)\n"
+      "  --no-cache               do not read or write the compiled-deck "
+      "cache\n"
+      "  --log-async              write the log from a background thread\n"
+      "  --log-format FORMAT      text (cram.log) or binary (cram.logb)\n"
+      "  --log-shard              log to cram.<pid>.log, tagged with a "
+      "session ID\n"
+      "  --log-ring FILE          also publish events to FILE for "
+      "`cram tail`\n"
+      "  --log-flush POLICY       exit, events:N or ms:N (default exit)\n"
+      "  --log-rotate POLICY      new indexed segment every kib:N or "
+      "secs:N\n"
+      "  --log-level LEVEL        error, session, group, prompt or key\n"
+      "                           (default and most detailed: %s)\n"
+      "  --metrics                serve Prometheus metrics on "
+      "$XDG_RUNTIME_DIR/\n"
+      "                           cram.<pid>.sock\n"
+      "  --metrics-socket PATH    serve them on PATH instead\n\n",
+      MAX_GROUPS,
+      MAX_GROUPS_CAP,
+      MAX_ITEMS_TOTAL,
+      MAX_ITEMS_TOTAL_CAP,
+      MAX_ITEMS_PER_GROUP,
+      MAX_ITEMS_PER_GROUP_CAP,
+      SPOOL_MAX_MIB,
+      SPOOL_MAX_MIB_CAP,
+      MAX_PARSE_THREADS,
+      g_log_levels[LOG_LEVEL_MAX]);
   if (rc < 0)
     return -1;
   rc = fprintf(stdout, "Keys: Enter/Space/alnum = next, Ctrl+C = quit\n");
@@ -25,6 +100,41 @@ static int print_usage(const char* prog) {
   return 0;
 }
 
+/* Loads a text deck, taking its tables from the compiled-deck cache when an
+ * image for the same bytes is there and refreshing the cache otherwise.
+ */
+static int load_text_deck(
+    struct app* app, const char* path, char* err_buf, size_t err_len) {
+  int rc = parse_load_file(
+      path, &app->limits, &app->session, err_buf, err_len);
+
+  if (rc != 0)
+    return -1;
+
+  char cache_path[MAX_PATH_LEN];
+  int cache_rc = -1;
+
+  if (app->use_cache) {
+    cache_rc =
+        image_cache_lookup(&app->session, cache_path, sizeof(cache_path));
+    if (cache_rc == 0) {
+      app->source = "cache";
+      return 0;
+    }
+  }
+  rc = parse_session_buffer(&app->session, app->threads, err_buf, err_len);
+  if (rc != 0)
+    return -1;
+  if (cache_rc == 1) {
+    int store_rc = image_cache_store(&app->session, cache_path);
+
+    /* A cache that cannot be written only costs the next launch a parse. */
+    if (store_rc != 0)
+      return 0;
+  }
+  return 0;
+}
+
 static int setup_session(struct app* app, const char* path) {
   if (!validate_ptr(app))
     return -1;
@@ -34,14 +144,504 @@ static int setup_session(struct app* app, const char* path) {
     return -1;
 
   char err_buf[256];
-  int rc = parse_session_file(path, &app->session, err_buf, sizeof(err_buf));
+  int rc = 0;
+
+  app->source = "parse";
+  if (strcmp(path, "-") != 0 && image_probe(path)) {
+    app->source = "image";
+    rc = image_load_file(
+        path, &app->limits, &app->session, err_buf, sizeof(err_buf));
+  } else {
+    rc = load_text_deck(app, path, err_buf, sizeof(err_buf));
+  }
+  if (rc != 0) {
+    rc = fprintf(stderr, "Error: %s\n", err_buf);
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
+  return 0;
+}
+
+static int parse_count_value(
+    const char* text, size_t min, size_t cap, size_t* out) {
+  if (!validate_ptr(text))
+    return -1;
+  if (!validate_ptr(out))
+    return -1;
+  if (text[0] == '\0')
+    return -1;
+
+  size_t value = 0;
+  size_t len = 0;
+
+  for (size_t i = 0; i < 16; i++) {
+    char ch = text[i];
+
+    if (ch == '\0')
+      break;
+    if (ch < '0' || ch > '9')
+      return -1;
+    value = value * 10U + (size_t)(ch - '0');
+    if (value > cap)
+      return -1;
+    len++;
+  }
+  /* Whatever follows 16 digits is not part of a count. */
+  if (text[len] != '\0')
+    return -1;
+  if (value < min)
+    return -1;
+  *out = value;
+  return 0;
+}
+
+/* --log-flush: "exit", "events:N" or "ms:N". */
+static int parse_log_flush(const char* text, struct LogConfig* config) {
+  if (!validate_ptr(text))
+    return -1;
+  if (!validate_ptr(config))
+    return -1;
+
+  const char* count = NULL;
+
+  if (strcmp(text, "exit") == 0) {
+    config->flush = LOG_FLUSH_EXIT;
+    config->every = 0;
+    return 0;
+  }
+  if (strncmp(text, "events:", 7) == 0) {
+    config->flush = LOG_FLUSH_EVENTS;
+    count = text + 7;
+  } else if (strncmp(text, "ms:", 3) == 0) {
+    config->flush = LOG_FLUSH_MS;
+    count = text + 3;
+  } else {
+    return -1;
+  }
+  return parse_count_value(count, 1, LOG_FLUSH_EVERY_CAP, &config->every);
+}
+
+/* --log-rotate: "kib:N" or "secs:N". */
+static int parse_log_rotate(const char* text, struct LogConfig* config) {
+  if (!validate_ptr(text))
+    return -1;
+  if (!validate_ptr(config))
+    return -1;
+
+  if (strncmp(text, "kib:", 4) == 0) {
+    config->rotate = LOG_ROTATE_KIB;
+    return parse_count_value(
+        text + 4, 1, LOG_ROTATE_KIB_CAP, &config->rotate_every);
+  }
+  if (strncmp(text, "secs:", 5) == 0) {
+    config->rotate = LOG_ROTATE_SECS;
+    return parse_count_value(
+        text + 5, 1, LOG_ROTATE_SECS_CAP, &config->rotate_every);
+  }
+  return -1;
+}
+
+/* `cram range` bounds: "<sec>" or "<sec>.<ms>", as in the log. */
+static int parse_time_value(const char* text, u64* ms) {
+  if (!validate_ptr(text))
+    return -1;
+  if (!validate_ptr(ms))
+    return -1;
+
+  u64 sec = 0;
+  size_t i = 0;
+
+  for (; i < 12; i++) {
+    if (text[i] < '0' || text[i] > '9')
+      break;
+    sec = sec * 10U + (u64)(text[i] - '0');
+  }
+  if (i == 0)
+    return -1;
+  *ms = sec * 1000U;
+  if (text[i] == '\0')
+    return 0;
+  if (text[i] != '.')
+    return -1;
+
+  u64 frac = 0;
+
+  for (size_t j = 1; j <= 3; j++) {
+    if (text[i + j] < '0' || text[i + j] > '9')
+      return -1;
+    frac = frac * 10U + (u64)(text[i + j] - '0');
+  }
+  if (text[i + 4] != '\0')
+    return -1;
+  *ms += frac;
+  return 0;
+}
+
+/* --log-level: a level no higher than the build's LOG_LEVEL_MAX. */
+static int parse_log_level(const char* text, int* level) {
+  if (!validate_ptr(text))
+    return -1;
+  if (!validate_ptr(level))
+    return -1;
+
+  for (int i = 0; i <= LOG_LEVEL_MAX; i++) {
+    if (strcmp(text, g_log_levels[i]) == 0) {
+      *level = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* Returns 0 with *path set, 1 for help, -1 on a usage error. */
+static int parse_args(
+    struct app* app, int argc, char** argv, const char** path) {
+  if (!validate_ptr(app))
+    return -1;
+  if (!validate_ptr(argv))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+
+  int rc = limits_default(&app->limits);
+
+  if (rc != 0)
+    return -1;
+  rc = log_config_default(&app->log);
+  if (rc != 0)
+    return -1;
+  app->threads = 1;
+  app->mode = APP_MODE_RUN;
+  app->use_cache = 1;
+  app->output = NULL;
+  app->script = NULL;
+  app->tick_ms = 0;
+  app->metrics = 0;
+  app->metrics_path = NULL;
+  app->range_from = 0;
+  app->range_to = UINT64_MAX;
+  *path = NULL;
+
+  size_t first = 1;
+
+  if (argc > 1 && strcmp(argv[1], "compile") == 0) {
+    app->mode = APP_MODE_COMPILE;
+    first = 2;
+  } else if (argc > 1 && strcmp(argv[1], "tail") == 0) {
+    app->mode = APP_MODE_TAIL;
+    first = 2;
+  } else if (argc > 1 && strcmp(argv[1], "stats") == 0) {
+    /* Scanning a log uses every CPU unless told otherwise. */
+    app->mode = APP_MODE_STATS;
+    app->threads = 0;
+    first = 2;
+  } else if (argc > 1 && strcmp(argv[1], "range") == 0) {
+    app->mode = APP_MODE_RANGE;
+    first = 2;
+  }
+  for (size_t i = first; i < MAX_ARGS; i++) {
+    if (i >= (size_t)argc)
+      break;
+    const char* arg = argv[i];
+    const char* value = (i + 1 < (size_t)argc) ? argv[i + 1] : NULL;
+    size_t* count = NULL;
+    size_t min = 1;
+    size_t cap = 0;
+
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
+      return 1;
+    if (app->mode == APP_MODE_TAIL && arg[0] == '-' && arg[1] != '\0')
+      return -1;
+    if (app->mode == APP_MODE_STATS && arg[0] == '-' && arg[1] != '\0' &&
+        strcmp(arg, "--threads") != 0)
+      return -1;
+    if (app->mode == APP_MODE_RANGE && arg[0] == '-' && arg[1] != '\0') {
+      u64* bound = NULL;
+
+      if (strcmp(arg, "--from") == 0)
+        bound = &app->range_from;
+      else if (strcmp(arg, "--to") == 0)
+        bound = &app->range_to;
+      if (!bound || !value || parse_time_value(value, bound) != 0)
+        return -1;
+      i++;
+      continue;
+    }
+    if (strcmp(arg, "--check") == 0 && app->mode != APP_MODE_COMPILE) {
+      app->mode = APP_MODE_CHECK;
+      continue;
+    }
+    if (strcmp(arg, "--script") == 0 && app->mode == APP_MODE_RUN) {
+      if (!value || value[0] == '\0')
+        return -1;
+      app->mode = APP_MODE_SCRIPT;
+      app->script = value;
+      i++;
+      continue;
+    }
+    if (strcmp(arg, "--metrics") == 0) {
+      app->metrics = 1;
+      continue;
+    }
+    if (strcmp(arg, "--metrics-socket") == 0) {
+      if (!value || value[0] == '\0')
+        return -1;
+      app->metrics = 1;
+      app->metrics_path = value;
+      i++;
+      continue;
+    }
+    if (strcmp(arg, "--no-cache") == 0) {
+      app->use_cache = 0;
+      continue;
+    }
+    if (strcmp(arg, "--log-async") == 0) {
+      app->log.async = 1;
+      continue;
+    }
+    if (strcmp(arg, "--log-ring") == 0) {
+      if (!value || value[0] == '\0')
+        return -1;
+      app->log.ring = value;
+      i++;
+      continue;
+    }
+    if (strcmp(arg, "--log-shard") == 0) {
+      app->log.shard = 1;
+      continue;
+    }
+    if (strcmp(arg, "--log-format") == 0) {
+      if (!value)
+        return -1;
+      if (strcmp(value, "text") == 0)
+        app->log.format = LOG_FORMAT_TEXT;
+      else if (strcmp(value, "binary") == 0)
+        app->log.format = LOG_FORMAT_BINARY;
+      else
+        return -1;
+      i++;
+      continue;
+    }
+    if (strcmp(arg, "--log-level") == 0) {
+      if (!value || parse_log_level(value, &app->log.level) != 0)
+        return -1;
+      i++;
+      continue;
+    }
+    if (strcmp(arg, "--log-flush") == 0) {
+      if (!value || parse_log_flush(value, &app->log) != 0)
+        return -1;
+      i++;
+      continue;
+    }
+    if (strcmp(arg, "--log-rotate") == 0) {
+      if (!value || parse_log_rotate(value, &app->log) != 0)
+        return -1;
+      i++;
+      continue;
+    }
+    if (strcmp(arg, "-o") == 0 && app->mode == APP_MODE_COMPILE) {
+      if (!value || app->output)
+        return -1;
+      app->output = value;
+      i++;
+      continue;
+    }
+    if (strcmp(arg, "--max-groups") == 0) {
+      count = &app->limits.max_groups;
+      cap = MAX_GROUPS_CAP;
+    } else if (strcmp(arg, "--max-items") == 0) {
+      count = &app->limits.max_items_total;
+      cap = MAX_ITEMS_TOTAL_CAP;
+    } else if (strcmp(arg, "--max-items-per-group") == 0) {
+      count = &app->limits.max_items_per_group;
+      cap = MAX_ITEMS_PER_GROUP_CAP;
+    } else if (strcmp(arg, "--max-spool-mib") == 0) {
+      count = &app->limits.max_spool_mib;
+      cap = SPOOL_MAX_MIB_CAP;
+    } else if (strcmp(arg, "--threads") == 0) {
+      count = &app->threads;
+      min = 0;
+      cap = MAX_PARSE_THREADS;
+    } else if (strcmp(arg, "--tick-ms") == 0) {
+      count = &app->tick_ms;
+      min = 0;
+      cap = MAX_GROUP_MILLISECONDS;
+    }
+    if (count) {
+      if (!value || parse_count_value(value, min, cap, count) != 0)
+        return -1;
+      i++;
+      continue;
+    }
+    if ((arg[0] == '-' && arg[1] != '\0') || *path)
+      return -1;
+    *path = arg;
+  }
+  if (!*path || (size_t)argc > MAX_ARGS)
+    return -1;
+  if (app->mode == APP_MODE_COMPILE && !app->output)
+    return -1;
+  /* Both cannot come from stdin. */
+  if (app->mode == APP_MODE_SCRIPT && strcmp(app->script, "-") == 0 &&
+      strcmp(*path, "-") == 0)
+    return -1;
+  if (app->threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    app->threads = 1;
+    if (cpus > 1)
+      app->threads = (size_t)cpus;
+    if (app->threads > MAX_PARSE_THREADS)
+      app->threads = MAX_PARSE_THREADS;
+  }
+  return 0;
+}
+
+static u64 elapsed_us(const struct timespec* start) {
+  struct timespec now;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+    return 0;
+
+  long long sec = (long long)(now.tv_sec - start->tv_sec);
+  long long nsec = (long long)(now.tv_nsec - start->tv_nsec);
+
+  return (u64)(sec * 1000000LL + nsec / 1000LL);
+}
+
+/* --check: parse only and report, so large decks can be validated and
+ * parser changes timed without a terminal.
+ */
+static int check_file(struct app* app, const char* path) {
+  if (!validate_ptr(app))
+    return -1;
+
+  struct timespec start;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &start) != 0)
+    return -1;
+
+  int rc = setup_session(app, path);
+  u64 parse_us = elapsed_us(&start);
+
+  if (rc == 0) {
+    const struct Session* session = &app->session;
+    int prc = fprintf(stdout,
+        "groups=%zu items=%zu bytes=%zu threads=%zu load=%s parse_us=%llu\n",
+        session->group_count,
+        session->item_count,
+        session->buffer_len,
+        app->threads,
+        app->source,
+        (unsigned long long)parse_us);
+
+    if (prc < 0)
+      rc = -1;
+  }
+
+  int release_rc = session_release(&app->session);
+
+  if (!assert_ok(release_rc == 0))
+    return -1;
+  return rc;
+}
+
+static int write_image(struct app* app, const char* path) {
+  char err_buf[256];
+  int rc = 0;
 
+  if (strcmp(path, "-") != 0 && image_probe(path)) {
+    rc = snprintf(err_buf,
+        sizeof(err_buf),
+        "'%s' is already a compiled deck image",
+        path);
+    if (rc < 0)
+      return -1;
+    rc = -1;
+  } else {
+    rc = parse_load_file(
+        path, &app->limits, &app->session, err_buf, sizeof(err_buf));
+  }
+  if (rc == 0)
+    rc = parse_session_buffer(
+        &app->session, app->threads, err_buf, sizeof(err_buf));
+  if (rc == 0)
+    rc = image_write(
+        &app->session, app->output, 1, err_buf, sizeof(err_buf));
   if (rc != 0) {
     rc = fprintf(stderr, "Error: %s\n", err_buf);
     if (rc < 0)
       return -1;
     return -1;
   }
+
+  const struct Session* session = &app->session;
+
+  rc = fprintf(stdout,
+      "wrote %s: groups=%zu items=%zu bytes=%zu\n",
+      app->output,
+      session->group_count,
+      session->item_count,
+      session->buffer_len);
+  if (rc < 0)
+    return -1;
+  return 0;
+}
+
+/* compile: parse once and write a self-contained image (see image.h). */
+static int compile_file(struct app* app, const char* path) {
+  if (!validate_ptr(app))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+
+  int rc = write_image(app, path);
+  int release_rc = session_release(&app->session);
+
+  if (!assert_ok(release_rc == 0))
+    return -1;
+  return rc;
+}
+
+static int stats_file(const struct app* app, const char* path) {
+  char err_buf[256];
+  int rc = stats_run(path, app->threads, err_buf, sizeof(err_buf));
+
+  if (rc != 0) {
+    rc = fprintf(stderr, "Error: %s: %s\n", path, err_buf);
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
+  return 0;
+}
+
+static int range_file(const struct app* app, const char* path) {
+  char err_buf[256];
+  int rc = logseg_range(
+      path, app->range_from, app->range_to, err_buf, sizeof(err_buf));
+
+  if (rc != 0) {
+    rc = fprintf(stderr, "Error: %s: %s\n", path, err_buf);
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
+  return 0;
+}
+
+static int tail_file(const char* path) {
+  char err_buf[256];
+  int rc = tail_run(path, err_buf, sizeof(err_buf));
+
+  if (rc != 0) {
+    rc = fprintf(stderr, "Error: %s: %s\n", path, err_buf);
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
   return 0;
 }
 
@@ -53,13 +653,17 @@ int app_main(struct app* app, int argc, char** argv) {
   if (!validate_ok(argc >= 0))
     return 1;
 
-  if (argc == 2 &&
-      (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+  const char* path = NULL;
+  int args_rc = parse_args(app, argc, argv, &path);
+
+  if (scan_init() != 0)
+    return 1;
+  if (args_rc > 0) {
     int rc = print_usage(argv[0]);
 
     return (rc == 0) ? 0 : 1;
   }
-  if (argc != 2) {
+  if (args_rc != 0) {
     int rc = print_usage(argv[0]);
 
     /* Usage error.
@@ -68,13 +672,57 @@ int app_main(struct app* app, int argc, char** argv) {
     return (rc == 0) ? 1 : 2;
   }
 
-  return (app_run_file(app, argv[1]) == 0) ? 0 : 1;
+  if (app->mode == APP_MODE_TAIL)
+    return (tail_file(path) == 0) ? 0 : 1;
+  if (app->mode == APP_MODE_STATS)
+    return (stats_file(app, path) == 0) ? 0 : 1;
+  if (app->mode == APP_MODE_RANGE)
+    return (range_file(app, path) == 0) ? 0 : 1;
+  if (cksum_init(app->threads) != 0)
+    return 1;
+  if (app->mode == APP_MODE_CHECK)
+    return (check_file(app, path) == 0) ? 0 : 1;
+  if (app->mode == APP_MODE_COMPILE)
+    return (compile_file(app, path) == 0) ? 0 : 1;
+  return (app_run_file(app, path) == 0) ? 0 : 1;
 }
 
-static int run_with_terminal(struct app* app) {
+/* --metrics: a socket the runner's event loop answers. */
+static int open_metrics(struct app* app, char* err_buf, size_t err_len) {
+  int fd = -1;
+  int rc = metrics_open(app->metrics_path, &fd, err_buf, err_len);
+
+  if (rc != 0)
+    return -1;
+  rc = event_add_fd(&app->events, fd);
+  if (rc == 0)
+    return 0;
+  rc = snprintf(err_buf, err_len, "Failed to watch metrics socket");
+  if (metrics_close() != 0 || rc < 0)
+    return -1;
+  return -1;
+}
+
+static int run_with_terminal(struct app* app, const char* path) {
   char err_buf[256];
+  int rc = 0;
 
-  int rc = term_enter_raw(&app->term, err_buf, sizeof(err_buf));
+  /* Keys come from the terminal when the deck arrived on stdin. */
+  if (strcmp(path, "-") == 0)
+    rc = term_attach_tty(err_buf, sizeof(err_buf));
+  if (rc == 0)
+    rc = term_enter_raw(&app->term, err_buf, sizeof(err_buf));
+  if (rc == 0) {
+    rc = event_open(&app->events, STDIN_FILENO, err_buf, sizeof(err_buf));
+    if (rc != 0 && term_restore(&app->term) != 0)
+      return -1;
+  }
+  if (rc == 0 && app->metrics) {
+    rc = open_metrics(app, err_buf, sizeof(err_buf));
+    if (rc != 0 &&
+        (event_close(&app->events) != 0 || term_restore(&app->term) != 0))
+      return -1;
+  }
 
   if (rc != 0) {
     rc = fprintf(stderr, "Error: %s\n", err_buf);
@@ -88,16 +736,23 @@ static int run_with_terminal(struct app* app) {
 
   if (hide_rc == 0) {
     loop_rc = runner_run(&app->term,
+        &app->events,
         &app->session,
         &app->rng,
-        app->group_order,
-        app->item_order);
+        app->session.group_order,
+        app->session.item_order);
   }
 
+  int metrics_rc = metrics_close();
+  int events_rc = event_close(&app->events);
   int restore_rc = term_restore(&app->term);
   int show_rc = term_show_cursor();
   int clear_rc = term_clear_screen();
 
+  if (!assert_ok(metrics_rc == 0))
+    return -1;
+  if (!assert_ok(events_rc == 0))
+    return -1;
   if (!assert_ok(restore_rc == 0))
     return -1;
   if (!assert_ok(show_rc == 0))
@@ -110,31 +765,133 @@ static int run_with_terminal(struct app* app) {
   return loop_rc;
 }
 
-int app_run_file(struct app* app, const char* path) {
+/* --script: drives the runner from a key script with frames sent to
+ * /dev/null, and reports how fast it went.
+ */
+static int run_script(struct app* app) {
   if (!validate_ptr(app))
     return -1;
-  if (!validate_ptr(path))
+  if (!validate_ptr(app->script))
     return -1;
 
-  int rc = setup_session(app, path);
+  int in_fd = STDIN_FILENO;
 
-  if (rc != 0)
+  if (strcmp(app->script, "-") != 0)
+    in_fd = open(app->script, O_RDONLY | O_CLOEXEC);
+  if (in_fd < 0) {
+    const char* err = strerror(errno);
+
+    if (!err)
+      err = "unknown error";
+    int rc = fprintf(stderr, "Error: %s: %s\n", app->script, err);
+
+    if (rc < 0)
+      return -1;
     return -1;
-  rc = log_open(&app->session);
+  }
+
+  int out_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  struct RunnerScript script = {
+    .fd = in_fd,
+    .out_fd = out_fd,
+    .tick_ms = (u64)app->tick_ms,
+  };
+  struct RunnerStats stats;
+  struct timespec start;
+  int rc = -1;
+
+  memset(&stats, 0, sizeof(stats));
+  memset(&start, 0, sizeof(start));
+
+  if (out_fd >= 0 && clock_gettime(CLOCK_MONOTONIC, &start) == 0) {
+    rc = runner_script(&app->session,
+        &app->rng,
+        app->session.group_order,
+        app->session.item_order,
+        &script,
+        &stats);
+  }
+
+  u64 run_us = elapsed_us(&start);
+
+  if (out_fd >= 0 && close(out_fd) != 0)
+    rc = -1;
+  if (in_fd != STDIN_FILENO && close(in_fd) != 0)
+    rc = -1;
   if (rc != 0)
     return -1;
-  rc = log_input(&app->session, path);
-  if (rc != 0)
+  if (run_us == 0)
+    run_us = 1;
+
+  int prc = fprintf(stdout,
+      "keys=%llu prompts=%llu shuffles=%llu bytes=%llu run_us=%llu "
+      "prompts_per_sec=%llu shuffles_per_sec=%llu\n",
+      stats.keys,
+      stats.prompts,
+      stats.shuffles,
+      stats.bytes,
+      run_us,
+      stats.prompts * 1000000ULL / run_us,
+      stats.shuffles * 1000000ULL / run_us);
+
+  if (prc < 0)
     return -1;
-  rc = rng_init(&app->rng);
-  if (rc != 0)
+  return 0;
+}
+
+static int run_session(struct app* app, const char* path) {
+  if (!validate_ptr(app))
     return -1;
 
-  rc = run_with_terminal(app);
+  /* A script has no redraw to keep on time, so it waits for the log. */
+  app->log.lossless = (app->mode == APP_MODE_SCRIPT);
+
+  int rc = log_open(&app->session, &app->log);
+
   if (rc != 0)
     return -1;
+  /* A deck read from stdin has no path worth logging. */
+  rc = log_input(&app->session, (strcmp(path, "-") == 0) ? NULL : path);
+  if (rc == 0)
+    rc = rng_init(&app->rng);
+  if (rc == 0 && app->mode == APP_MODE_SCRIPT)
+    rc = run_script(app);
+  else if (rc == 0)
+    rc = run_with_terminal(app, path);
+  if (rc != 0) {
+    /* Whatever was logged before the failure still reaches the file. */
+    int abort_rc = log_abort();
+
+    if (!assert_ok(abort_rc == 0))
+      return -1;
+    return -1;
+  }
   rc = log_close(&app->session);
   if (rc != 0)
     return -1;
   return 0;
 }
+
+int app_run_file(struct app* app, const char* path) {
+  if (!validate_ptr(app))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+
+  int rc = setup_session(app, path);
+
+  if (rc != 0) {
+    int release_rc = session_release(&app->session);
+
+    if (!assert_ok(release_rc == 0))
+      return -1;
+    return -1;
+  }
+  rc = run_session(app, path);
+
+  int release_rc = session_release(&app->session);
+
+  if (!assert_ok(release_rc == 0))
+    return -1;
+  return rc;
+}
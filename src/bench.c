@@ -0,0 +1,355 @@
+// SPDX-License-Identifier: MIT
+/* cram-bench: times the engine's hot paths and prints the results as one
+ * JSON document. For each deck named: parse_session_buffer() on one thread
+ * and term_frame_draw() of its items into /dev/null, as the runner's
+ * draw_prompt() does. Then cksum_bytes(), rng_range(), rng_shuffle_items()
+ * and, with the first deck loaded, log_prompt() into a scratch directory.
+ * Each case runs BENCH_RUNS times and its fastest run is kept, the one the
+ * rest of the machine disturbed least.
+ *
+ * `make bench` feeds it the decks from scripts/gen_deck.sh, and
+ * scripts/bench_compare.sh holds the results against a baseline.
+ */
+#include "cksum.h"
+#include "config.h"
+#include "log.h"
+#include "model.h"
+#include "parser.h"
+#include "rng.h"
+#include "scan.h"
+#include "term.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RUNS 5U
+#define BENCH_MAX_DECKS 16U
+#define BENCH_NAME_BYTES 128U
+#define BENCH_CKSUM_BYTES (16U * 1024U * 1024U)
+#define BENCH_RNG_CALLS 4194304U
+#define BENCH_SHUFFLES 64U
+#define BENCH_DRAWS 65536U
+#define BENCH_LOG_EVENTS 262144U
+
+struct bench_result {
+  char name[BENCH_NAME_BYTES];
+  /* Operations and bytes handled by one run. */
+  u64 ops;
+  u64 bytes;
+  /* The fastest run. */
+  u64 best_ns;
+};
+
+static unsigned char g_cksum_buf[BENCH_CKSUM_BYTES];
+static size_t g_values[MAX_ITEMS_PER_GROUP];
+static struct Session g_session;
+static struct Limits g_limits;
+static int g_printed;
+/* Keeps the optimizer from dropping the rng_range() calls. */
+static volatile size_t g_sink;
+
+static int print_error(const char* name, const char* msg) {
+  int rc = fprintf(stderr, "Error: %s: %s\n", name, msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+static u64 now_ns(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+static void take_run(struct bench_result* res, u64 start) {
+  u64 ns = now_ns() - start;
+
+  if (ns == 0)
+    ns = 1;
+  if (res->best_ns == 0 || ns < res->best_ns)
+    res->best_ns = ns;
+}
+
+/* "<kind>:<basename of path>", with anything JSON would need escaped
+ * replaced by '_'.
+ */
+static void set_name(
+    struct bench_result* res, const char* kind, const char* path) {
+  const char* base = strrchr(path, '/');
+  int rc = snprintf(
+      res->name, sizeof(res->name), "%s:%s", kind, base ? base + 1 : path);
+
+  if (rc < 0)
+    res->name[0] = '\0';
+  for (size_t i = 0; i < BENCH_NAME_BYTES; i++) {
+    unsigned char ch = (unsigned char)res->name[i];
+
+    if (ch == '\0')
+      break;
+    if (ch == '"' || ch == '\\' || ch < 0x20U)
+      res->name[i] = '_';
+  }
+}
+
+static int print_result(const struct bench_result* res) {
+  u64 ops = res->ops ? res->ops : 1U;
+  double ns_per_op = (double)res->best_ns / (double)ops;
+  double mb_per_sec = (double)res->bytes * 1000.0 / (double)res->best_ns;
+  int rc = fprintf(stdout,
+      "%s\n    {\"name\": \"%s\", \"ops\": %llu, \"bytes\": %llu, "
+      "\"ns\": %llu, \"ns_per_op\": %.3f, \"mb_per_sec\": %.3f}",
+      g_printed ? "," : "",
+      res->name,
+      res->ops,
+      res->bytes,
+      res->best_ns,
+      ns_per_op,
+      mb_per_sec);
+
+  g_printed = 1;
+  if (rc < 0)
+    return -1;
+  return 0;
+}
+
+static int load_deck(const char* path) {
+  char err_buf[256];
+
+  int rc = parse_load_file(
+      path, &g_limits, &g_session, err_buf, sizeof(err_buf));
+
+  if (rc != 0)
+    return print_error(path, err_buf);
+  return 0;
+}
+
+/* Leaves the deck parsed for the cases after it. */
+static int bench_parse(const char* path) {
+  struct bench_result res;
+  char err_buf[256];
+
+  memset(&res, 0, sizeof(res));
+  set_name(&res, "parse", path);
+  for (size_t run = 0; run < BENCH_RUNS; run++) {
+    if (run > 0 && session_release(&g_session) != 0)
+      return -1;
+    if (load_deck(path) != 0)
+      return -1;
+
+    u64 start = now_ns();
+
+    if (parse_session_buffer(&g_session, 1, err_buf, sizeof(err_buf)) != 0)
+      return print_error(path, err_buf);
+    take_run(&res, start);
+  }
+  res.ops = g_session.item_count;
+  res.bytes = g_session.buffer_len;
+  return print_result(&res);
+}
+
+static int bench_draw(const char* path, int null_fd) {
+  struct bench_result res;
+  struct TermFrame frame;
+  size_t count = g_session.item_count;
+
+  if (count > BENCH_DRAWS)
+    count = BENCH_DRAWS;
+  memset(&res, 0, sizeof(res));
+  set_name(&res, "draw", path);
+  for (size_t run = 0; run < BENCH_RUNS; run++) {
+    if (term_frame_init(&frame, null_fd) != 0)
+      return -1;
+
+    u64 start = now_ns();
+
+    for (size_t i = 0; i < BENCH_DRAWS; i++) {
+      if (i >= count)
+        break;
+      const struct Item* item = &g_session.items[i];
+
+      if (term_frame_draw(&frame,
+              g_session.text + item->offset,
+              item->length,
+              g_session.breaks + item->first_break,
+              item->breaks,
+              item->width) != 0)
+        return -1;
+    }
+    take_run(&res, start);
+  }
+  res.ops = count;
+  res.bytes = frame.bytes_out;
+  return print_result(&res);
+}
+
+static int bench_log(const char* dir) {
+  struct bench_result res;
+  struct LogConfig config;
+  size_t count = g_session.item_count;
+
+  if (chdir(dir) != 0)
+    return print_error(dir, "cannot enter scratch directory");
+  if (log_config_default(&config) != 0)
+    return -1;
+  memset(&res, 0, sizeof(res));
+  set_name(&res, "log_prompt", "text");
+  for (size_t run = 0; run < BENCH_RUNS; run++) {
+    if (log_open(&g_session, &config) != 0)
+      return -1;
+
+    u64 start = now_ns();
+
+    for (size_t i = 0; i < BENCH_LOG_EVENTS; i++) {
+      if (log_prompt(&g_session, 0, i % count) != 0)
+        return -1;
+    }
+    take_run(&res, start);
+    if (log_close(&g_session) != 0)
+      return -1;
+    if (unlink("cram.log") != 0)
+      return -1;
+  }
+  res.ops = BENCH_LOG_EVENTS;
+  return print_result(&res);
+}
+
+static int bench_cksum(void) {
+  struct bench_result res;
+  u64 seed = 0x9E3779B97F4A7C15ULL;
+  u32 sum = 0;
+
+  for (size_t i = 0; i < BENCH_CKSUM_BYTES; i++) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    g_cksum_buf[i] = (unsigned char)(seed >> 56);
+  }
+  memset(&res, 0, sizeof(res));
+  set_name(&res, "cksum_bytes", cksum_kernel_name());
+  for (size_t run = 0; run < BENCH_RUNS; run++) {
+    u64 start = now_ns();
+
+    if (cksum_bytes(&sum, g_cksum_buf, BENCH_CKSUM_BYTES) != 0)
+      return -1;
+    take_run(&res, start);
+  }
+  res.ops = 1;
+  res.bytes = BENCH_CKSUM_BYTES;
+  return print_result(&res);
+}
+
+static int bench_rng(struct Rng* rng) {
+  struct bench_result res;
+
+  memset(&res, 0, sizeof(res));
+  set_name(&res, "rng_range", "65536");
+  for (size_t run = 0; run < BENCH_RUNS; run++) {
+    u64 start = now_ns();
+    size_t acc = 0;
+
+    for (size_t i = 0; i < BENCH_RNG_CALLS; i++)
+      acc += rng_range(rng, MAX_ITEMS_PER_GROUP);
+    g_sink = acc;
+    take_run(&res, start);
+  }
+  res.ops = BENCH_RNG_CALLS;
+  if (print_result(&res) != 0)
+    return -1;
+
+  memset(&res, 0, sizeof(res));
+  set_name(&res, "rng_shuffle_items", "65536");
+  for (size_t i = 0; i < MAX_ITEMS_PER_GROUP; i++)
+    g_values[i] = i;
+  for (size_t run = 0; run < BENCH_RUNS; run++) {
+    u64 start = now_ns();
+
+    for (size_t i = 0; i < BENCH_SHUFFLES; i++) {
+      if (rng_shuffle_items(rng, g_values, MAX_ITEMS_PER_GROUP) != 0)
+        return -1;
+    }
+    take_run(&res, start);
+  }
+  res.ops = BENCH_SHUFFLES;
+  res.bytes = (u64)BENCH_SHUFFLES * sizeof(g_values);
+  return print_result(&res);
+}
+
+static int bench_decks(int argc, char** argv, int null_fd, const char* dir) {
+  for (size_t i = 1; i < BENCH_MAX_DECKS + 1U; i++) {
+    if (i >= (size_t)argc)
+      break;
+    if (bench_parse(argv[i]) != 0)
+      return -1;
+    if (bench_draw(argv[i], null_fd) != 0)
+      return -1;
+    if (i == 1 && g_session.item_count > 0 && bench_log(dir) != 0)
+      return -1;
+    if (session_release(&g_session) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 1 || (size_t)argc - 1 > BENCH_MAX_DECKS) {
+    int rc = fprintf(stderr,
+        "Usage: cram-bench [deck ...] (at most %u) > results.json\n",
+        BENCH_MAX_DECKS);
+
+    if (rc < 0)
+      return 1;
+    return 1;
+  }
+  if (scan_init() != 0 || cksum_init(1) != 0)
+    return 1;
+  if (limits_default(&g_limits) != 0)
+    return 1;
+
+  struct Rng rng;
+
+  if (rng_init(&rng) != 0)
+    return 1;
+
+  const char* tmp = getenv("TMPDIR");
+  char dir[MAX_PATH_LEN];
+  int rc = snprintf(dir,
+      sizeof(dir),
+      "%s/cram-bench.XXXXXX",
+      (tmp && tmp[0] != '\0') ? tmp : "/tmp");
+
+  if (rc < 0 || (size_t)rc >= sizeof(dir) || !mkdtemp(dir)) {
+    print_error(dir, "cannot create scratch directory");
+    return 1;
+  }
+
+  int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+  if (null_fd < 0)
+    return 1;
+  rc = fprintf(stdout,
+      "{\n  \"runs\": %u,\n  \"scan\": \"%s\",\n  \"cksum\": \"%s\",\n"
+      "  \"results\": [",
+      BENCH_RUNS,
+      scan_kernel_name(),
+      cksum_kernel_name());
+  if (rc >= 0)
+    rc = bench_decks(argc, argv, null_fd, dir);
+  if (rc >= 0)
+    rc = bench_cksum();
+  if (rc >= 0)
+    rc = bench_rng(&rng);
+  if (rc >= 0)
+    rc = fprintf(stdout, "\n  ]\n}\n");
+
+  int close_rc = close(null_fd);
+  int rmdir_rc = rmdir(dir);
+
+  if (rc < 0 || close_rc != 0 || rmdir_rc != 0)
+    return 1;
+  return 0;
+}
@@ -0,0 +1,311 @@
+// SPDX-License-Identifier: MIT
+#include "cksum.h"
+
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__SSE2__)
+#define CKSUM_X86 1
+#include <immintrin.h>
+#else
+#define CKSUM_X86 0
+#endif
+
+#define CKSUM_POLY 0x04C11DB7U
+
+enum cksum_kernel {
+  CKSUM_KERNEL_SLICE8 = 0,
+  CKSUM_KERNEL_PCLMUL = 1,
+};
+
+/* The CRC is MSB-first with a zero initial value: the register holds
+ * message(x) * x^32 mod P, bit i being the coefficient of x^i. Every kernel
+ * returns that raw register; cksum_bytes() appends the length and inverts.
+ */
+static u32 g_table[8][256];
+/* x^(8 * 2^k) mod P, for moving a CRC past 2^k zero bytes. */
+static u32 g_shift[64];
+/* Folding constants: x^(n + 64) and x^n mod P for n = 128 and n = 512. */
+static u32 g_fold128_hi;
+static u32 g_fold128_lo;
+static u32 g_fold512_hi;
+static u32 g_fold512_lo;
+static int g_cksum_kernel = CKSUM_KERNEL_SLICE8;
+static size_t g_cksum_threads = 1;
+static int g_cksum_ready;
+
+static u32 mul_x(u32 a) {
+  return (a & 0x80000000U) ? (a << 1) ^ CKSUM_POLY : a << 1;
+}
+
+static u32 mul_mod(u32 a, u32 b) {
+  u32 r = 0;
+
+  for (int i = 31; i >= 0; i--) {
+    r = mul_x(r);
+    if ((b >> i) & 1U)
+      r ^= a;
+  }
+  return r;
+}
+
+static u32 x_pow_mod(size_t n) {
+  u32 r = 1;
+
+  for (size_t i = 0; i < 1024; i++) {
+    if (i >= n)
+      break;
+    r = mul_x(r);
+  }
+  return r;
+}
+
+/* The register after len more zero bytes. */
+static u32 crc_shift(u32 crc, u64 len) {
+  for (size_t k = 0; k < 64; k++) {
+    if ((len >> k) == 0)
+      break;
+    if ((len >> k) & 1U)
+      crc = mul_mod(crc, g_shift[k]);
+  }
+  return crc;
+}
+
+static u32 crc_table(u32 crc, const unsigned char* buf, size_t len) {
+  for (size_t i = 0; i < MAX_DECK_BYTES; i++) {
+    if (i >= len)
+      break;
+    crc = (crc << 8) ^ g_table[0][(crc >> 24) ^ buf[i]];
+  }
+  return crc;
+}
+
+/* Eight bytes per step: the register is folded into the first four and
+ * each byte position has its own table.
+ */
+static u32 crc_slice8(u32 crc, const unsigned char* buf, size_t len) {
+  for (size_t b = 0; b < MAX_DECK_BYTES / 8U; b++) {
+    if (len < 8U)
+      break;
+    u32 hi = crc ^ ((u32)buf[0] << 24 | (u32)buf[1] << 16 |
+                       (u32)buf[2] << 8 | (u32)buf[3]);
+
+    crc = g_table[7][hi >> 24] ^ g_table[6][(hi >> 16) & 0xFFU] ^
+        g_table[5][(hi >> 8) & 0xFFU] ^ g_table[4][hi & 0xFFU] ^
+        g_table[3][buf[4]] ^ g_table[2][buf[5]] ^ g_table[1][buf[6]] ^
+        g_table[0][buf[7]];
+    buf += 8;
+    len -= 8;
+  }
+  return crc_table(crc, buf, len);
+}
+
+#if CKSUM_X86
+__attribute__((target("pclmul,ssse3"))) static __m128i load_be128(
+    const unsigned char* buf) {
+  const __m128i swap =
+      _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+  return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)buf), swap);
+}
+
+/* acc * x^n + next, kept to 128 bits modulo P. */
+__attribute__((target("pclmul,ssse3"))) static __m128i fold128(
+    __m128i acc, __m128i k, __m128i next) {
+  __m128i hi = _mm_clmulepi64_si128(acc, k, 0x11);
+  __m128i lo = _mm_clmulepi64_si128(acc, k, 0x00);
+
+  return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+
+/* Four independent 128-bit accumulators hide the multiplier latency. They
+ * are merged with 128-bit folds, and the remaining 16 bytes plus the tail
+ * go through the table, which reduces them exactly.
+ */
+__attribute__((target("pclmul,ssse3"))) static u32 crc_pclmul(
+    u32 crc, const unsigned char* buf, size_t len) {
+  if (len < 64U)
+    return crc_slice8(crc, buf, len);
+
+  __m128i k512 = _mm_set_epi64x(
+      (long long)g_fold512_hi, (long long)g_fold512_lo);
+  __m128i k128 = _mm_set_epi64x(
+      (long long)g_fold128_hi, (long long)g_fold128_lo);
+  __m128i x0 = _mm_xor_si128(
+      load_be128(buf), _mm_set_epi32((int)crc, 0, 0, 0));
+  __m128i x1 = load_be128(buf + 16);
+  __m128i x2 = load_be128(buf + 32);
+  __m128i x3 = load_be128(buf + 48);
+
+  buf += 64;
+  len -= 64;
+  for (size_t b = 0; b < MAX_DECK_BYTES / 64U; b++) {
+    if (len < 64U)
+      break;
+    x0 = fold128(x0, k512, load_be128(buf));
+    x1 = fold128(x1, k512, load_be128(buf + 16));
+    x2 = fold128(x2, k512, load_be128(buf + 32));
+    x3 = fold128(x3, k512, load_be128(buf + 48));
+    buf += 64;
+    len -= 64;
+  }
+
+  __m128i x = fold128(x0, k128, x1);
+
+  x = fold128(x, k128, x2);
+  x = fold128(x, k128, x3);
+  for (size_t b = 0; b < 4U; b++) {
+    if (len < 16U)
+      break;
+    x = fold128(x, k128, load_be128(buf));
+    buf += 16;
+    len -= 16;
+  }
+
+  const __m128i swap =
+      _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  unsigned char folded[16];
+
+  _mm_storeu_si128((__m128i*)folded, _mm_shuffle_epi8(x, swap));
+  crc = crc_slice8(0, folded, sizeof(folded));
+  return crc_slice8(crc, buf, len);
+}
+#endif
+
+static u32 crc_run(u32 crc, const unsigned char* buf, size_t len) {
+  switch (g_cksum_kernel) {
+#if CKSUM_X86
+    case CKSUM_KERNEL_PCLMUL:
+      return crc_pclmul(crc, buf, len);
+#endif
+    default:
+      return crc_slice8(crc, buf, len);
+  }
+}
+
+struct cksum_part {
+  const unsigned char* buf;
+  size_t len;
+  u32 crc;
+};
+
+static void* cksum_part_worker(void* arg) {
+  struct cksum_part* part = arg;
+
+  part->crc = crc_run(0, part->buf, part->len);
+  return NULL;
+}
+
+/* Splits a large buffer across threads and joins the partial registers:
+ * crc(A || B) = crc(A) * x^(8 * |B|) + crc(B), all modulo P.
+ */
+static u32 crc_parallel(const unsigned char* buf, size_t len) {
+  size_t count = len / CKSUM_PARALLEL_MIN_BYTES;
+
+  if (count > g_cksum_threads)
+    count = g_cksum_threads;
+  if (count > MAX_PARSE_THREADS)
+    count = MAX_PARSE_THREADS;
+  if (count < 2)
+    return crc_run(0, buf, len);
+
+  struct cksum_part parts[MAX_PARSE_THREADS];
+  pthread_t tids[MAX_PARSE_THREADS];
+  int started[MAX_PARSE_THREADS];
+  size_t step = len / count;
+
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    parts[i].buf = buf + i * step;
+    parts[i].len = (i + 1 == count) ? len - i * step : step;
+    parts[i].crc = 0;
+    started[i] = 0;
+    if (i > 0)
+      started[i] = (pthread_create(
+                        &tids[i], NULL, cksum_part_worker, &parts[i]) == 0);
+  }
+  cksum_part_worker(&parts[0]);
+
+  u32 crc = 0;
+
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    if (i > 0 && (!started[i] || pthread_join(tids[i], NULL) != 0))
+      cksum_part_worker(&parts[i]);
+    crc = crc_shift(crc, parts[i].len) ^ parts[i].crc;
+  }
+  return crc;
+}
+
+int cksum_init(size_t threads) {
+  if (!validate_ok(threads >= 1 && threads <= MAX_PARSE_THREADS))
+    return -1;
+
+  for (u32 i = 0; i < 256U; i++) {
+    u32 crc = i << 24;
+
+    for (int b = 0; b < 8; b++)
+      crc = mul_x(crc);
+    g_table[0][i] = crc;
+  }
+  for (size_t t = 1; t < 8; t++) {
+    for (size_t i = 0; i < 256U; i++) {
+      u32 prev = g_table[t - 1][i];
+
+      g_table[t][i] = (prev << 8) ^ g_table[0][prev >> 24];
+    }
+  }
+  g_shift[0] = x_pow_mod(8);
+  for (size_t k = 1; k < 64; k++)
+    g_shift[k] = mul_mod(g_shift[k - 1], g_shift[k - 1]);
+  g_fold128_hi = x_pow_mod(128 + 64);
+  g_fold128_lo = x_pow_mod(128);
+  g_fold512_hi = x_pow_mod(512 + 64);
+  g_fold512_lo = x_pow_mod(512);
+
+  g_cksum_kernel = CKSUM_KERNEL_SLICE8;
+#if CKSUM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"))
+    g_cksum_kernel = CKSUM_KERNEL_PCLMUL;
+#endif
+  g_cksum_threads = threads;
+  g_cksum_ready = 1;
+  return 0;
+}
+
+const char* cksum_kernel_name(void) {
+  switch (g_cksum_kernel) {
+    case CKSUM_KERNEL_PCLMUL:
+      return "pclmul";
+    default:
+      return "slice8";
+  }
+}
+
+int cksum_bytes(u32* out, const unsigned char* buf, size_t len) {
+  if (!validate_ptr(out))
+    return -1;
+  if (!validate_ptr(buf))
+    return -1;
+  if (!assert_ok(len <= MAX_DECK_BYTES))
+    return -1;
+  if (!assert_ok(g_cksum_ready))
+    return -1;
+
+  u32 crc = crc_parallel(buf, len);
+  unsigned char tail[sizeof(size_t)];
+  size_t tail_len = 0;
+  size_t n = len;
+
+  for (size_t i = 0; i < sizeof(size_t); i++) {
+    if (n == 0)
+      break;
+    tail[tail_len++] = (unsigned char)(n & 0xFF);
+    n >>= 8;
+  }
+  *out = ~crc_table(crc, tail, tail_len);
+  return 0;
+}
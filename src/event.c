@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: MIT
+#include "event.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Retries of a wait interrupted by a signal the loop does not take, such
+ * as SIGCONT after a stop.
+ */
+#define EVENT_WAIT_RETRIES 64U
+/* Queued signals read back at once. */
+#define EVENT_SIGNAL_BATCH 8U
+
+static int set_error(char* err_buf, size_t err_len, const char* msg) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ptr(msg))
+    return -1;
+
+  const char* err = strerror(errno);
+
+  if (!err)
+    err = "unknown error";
+
+  int rc = snprintf(err_buf, err_len, "%s: %s", msg, err);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+static int loop_signals(sigset_t* set) {
+  if (sigemptyset(set) != 0)
+    return -1;
+  if (sigaddset(set, SIGWINCH) != 0 || sigaddset(set, SIGTERM) != 0 ||
+      sigaddset(set, SIGHUP) != 0)
+    return -1;
+  return 0;
+}
+
+static int watch_fd(int epoll_fd, int fd) {
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int close_fd(int* fd) {
+  if (*fd < 0)
+    return 0;
+
+  int rc = close(*fd);
+
+  *fd = -1;
+  return rc;
+}
+
+/* Closes whatever is open and puts the signal mask back. */
+static int loop_release(struct EventLoop* loop, int restore_mask) {
+  int rc = 0;
+
+  if (close_fd(&loop->epoll_fd) != 0)
+    rc = -1;
+  if (close_fd(&loop->timer_fd) != 0)
+    rc = -1;
+  if (close_fd(&loop->signal_fd) != 0)
+    rc = -1;
+  if (restore_mask &&
+      pthread_sigmask(SIG_SETMASK, &loop->saved_mask, NULL) != 0)
+    rc = -1;
+  loop->fd_count = 0;
+  loop->active = 0;
+  return rc;
+}
+
+int event_open(
+    struct EventLoop* loop, int input_fd, char* err_buf, size_t err_len) {
+  if (!validate_ptr(loop))
+    return -1;
+  if (!validate_ok(input_fd >= 0))
+    return -1;
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+
+  loop->epoll_fd = -1;
+  loop->timer_fd = -1;
+  loop->signal_fd = -1;
+  loop->input_fd = input_fd;
+  loop->fd_count = 0;
+  loop->active = 0;
+
+  sigset_t set;
+
+  if (loop_signals(&set) != 0)
+    return set_error(err_buf, err_len, "Failed to build signal set");
+  /* Blocked first, so none of them is handled the default way meanwhile. */
+  if (pthread_sigmask(SIG_BLOCK, &set, &loop->saved_mask) != 0)
+    return set_error(err_buf, err_len, "Failed to block signals");
+
+  const char* what = NULL;
+
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epoll_fd < 0)
+    what = "Failed to create epoll set";
+  if (!what) {
+    loop->timer_fd =
+        timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->timer_fd < 0)
+      what = "Failed to create timer";
+  }
+  if (!what) {
+    loop->signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (loop->signal_fd < 0)
+      what = "Failed to create signalfd";
+  }
+  if (!what && (watch_fd(loop->epoll_fd, input_fd) != 0 ||
+                   watch_fd(loop->epoll_fd, loop->timer_fd) != 0 ||
+                   watch_fd(loop->epoll_fd, loop->signal_fd) != 0))
+    what = "Failed to watch event sources";
+  if (what) {
+    int rc = set_error(err_buf, err_len, what);
+
+    if (loop_release(loop, 1) != 0)
+      return -1;
+    return rc;
+  }
+  loop->active = 1;
+  return 0;
+}
+
+int event_close(struct EventLoop* loop) {
+  if (!validate_ptr(loop))
+    return -1;
+  if (!loop->active)
+    return 0;
+
+  /* Taken here, a pending SIGTERM cannot kill the process once unblocked,
+   * before the terminal is restored.
+   */
+  struct signalfd_siginfo info[EVENT_SIGNAL_BATCH];
+
+  for (size_t i = 0; i < EVENT_WAIT_RETRIES; i++) {
+    if (read(loop->signal_fd, info, sizeof(info)) <= 0)
+      break;
+  }
+  return loop_release(loop, 1);
+}
+
+int event_set_deadline(struct EventLoop* loop, u64 deadline_ms) {
+  if (!validate_ptr(loop))
+    return -1;
+  if (!assert_ok(loop->active))
+    return -1;
+
+  struct itimerspec spec;
+
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = (time_t)(deadline_ms / 1000ULL);
+  spec.it_value.tv_nsec = (long)(deadline_ms % 1000ULL) * 1000000L;
+  return timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+int event_add_fd(struct EventLoop* loop, int fd) {
+  if (!validate_ptr(loop))
+    return -1;
+  if (!validate_ok(fd >= 0))
+    return -1;
+  if (!assert_ok(loop->active))
+    return -1;
+  if (!validate_ok(loop->fd_count < MAX_EVENT_FDS))
+    return -1;
+
+  if (watch_fd(loop->epoll_fd, fd) != 0)
+    return -1;
+  loop->fds[loop->fd_count++] = fd;
+  return 0;
+}
+
+int event_remove_fd(struct EventLoop* loop, int fd) {
+  if (!validate_ptr(loop))
+    return -1;
+  if (!assert_ok(loop->active))
+    return -1;
+
+  for (size_t i = 0; i < MAX_EVENT_FDS; i++) {
+    if (i >= loop->fd_count)
+      break;
+    if (loop->fds[i] != fd)
+      continue;
+    loop->fds[i] = loop->fds[--loop->fd_count];
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+  }
+  return -1;
+}
+
+/* Drains the signalfd; termination outranks a resize. */
+static int take_signals(struct EventLoop* loop, struct Event* out) {
+  struct signalfd_siginfo info[EVENT_SIGNAL_BATCH];
+  ssize_t n = read(loop->signal_fd, info, sizeof(info));
+
+  if (n < 0)
+    return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+  if (!assert_ok((size_t)n % sizeof(info[0]) == 0))
+    return -1;
+  for (size_t i = 0; i < EVENT_SIGNAL_BATCH; i++) {
+    if (i >= (size_t)n / sizeof(info[0]))
+      break;
+    if (info[i].ssi_signo == SIGWINCH && out->kind == EVENT_NONE)
+      out->kind = EVENT_RESIZE;
+    if (info[i].ssi_signo == SIGTERM || info[i].ssi_signo == SIGHUP)
+      out->kind = EVENT_TERMINATE;
+  }
+  return 0;
+}
+
+static int take_timer(struct EventLoop* loop, struct Event* out) {
+  u64 expirations = 0;
+  ssize_t n = read(loop->timer_fd, &expirations, sizeof(expirations));
+
+  if (n < 0)
+    return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+  if (!assert_ok(n == (ssize_t)sizeof(expirations)))
+    return -1;
+  out->kind = EVENT_DEADLINE;
+  return 0;
+}
+
+int event_wait(struct EventLoop* loop, struct Event* out) {
+  if (!validate_ptr(loop))
+    return -1;
+  if (!validate_ptr(out))
+    return -1;
+  if (!assert_ok(loop->active))
+    return -1;
+
+  struct epoll_event ev;
+  int ready = -1;
+
+  out->kind = EVENT_NONE;
+  out->fd = -1;
+  for (size_t i = 0; i < EVENT_WAIT_RETRIES; i++) {
+    ready = epoll_wait(loop->epoll_fd, &ev, 1, -1);
+    if (ready >= 0 || errno != EINTR)
+      break;
+  }
+  if (ready < 0)
+    return -1;
+  if (ready == 0)
+    return 0;
+
+  int fd = ev.data.fd;
+
+  if (fd == loop->signal_fd)
+    return take_signals(loop, out);
+  if (fd == loop->timer_fd)
+    return take_timer(loop, out);
+  out->kind = (fd == loop->input_fd) ? EVENT_INPUT : EVENT_FD;
+  out->fd = fd;
+  return 0;
+}
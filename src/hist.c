@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: MIT
+#include "hist.h"
+
+#include <string.h>
+
+size_t hist_bucket(u64 value) {
+  if (value < HIST_SUB_BUCKETS)
+    return (size_t)value;
+
+  size_t exp = 63U - (size_t)__builtin_clzll(value);
+  size_t sub = (size_t)(value >> (exp - 4U)) & (HIST_SUB_BUCKETS - 1U);
+
+  return HIST_SUB_BUCKETS + (exp - 4U) * HIST_SUB_BUCKETS + sub;
+}
+
+u64 hist_bucket_low(size_t bucket) {
+  if (bucket < HIST_SUB_BUCKETS)
+    return (u64)bucket;
+
+  size_t exp = (bucket - HIST_SUB_BUCKETS) / HIST_SUB_BUCKETS + 4U;
+  u64 sub = (u64)((bucket - HIST_SUB_BUCKETS) % HIST_SUB_BUCKETS);
+
+  return (HIST_SUB_BUCKETS + sub) << (exp - 4U);
+}
+
+int hist_reset(struct Hist* hist) {
+  if (!assert_ptr(hist))
+    return -1;
+
+  memset(hist, 0, sizeof(*hist));
+  return 0;
+}
+
+int hist_add(struct Hist* hist, u64 value) {
+  if (!assert_ptr(hist))
+    return -1;
+
+  size_t bucket = hist_bucket(value);
+
+  if (!assert_ok(bucket < HIST_BUCKETS))
+    return -1;
+  if (hist->count == 0 || value < hist->min)
+    hist->min = value;
+  if (value > hist->max)
+    hist->max = value;
+  hist->count++;
+  hist->sum += value;
+  hist->buckets[bucket]++;
+  return 0;
+}
+
+int hist_merge(struct Hist* into, const struct Hist* from) {
+  if (!assert_ptr(into))
+    return -1;
+  if (!assert_ptr(from))
+    return -1;
+  if (from->count == 0)
+    return 0;
+
+  if (into->count == 0 || from->min < into->min)
+    into->min = from->min;
+  if (from->max > into->max)
+    into->max = from->max;
+  into->count += from->count;
+  into->sum += from->sum;
+  for (size_t i = 0; i < HIST_BUCKETS; i++)
+    into->buckets[i] += from->buckets[i];
+  return 0;
+}
+
+u64 hist_quantile(const struct Hist* hist, u64 q, u64 q_den) {
+  if (!assert_ptr(hist))
+    return 0;
+  if (!assert_ok(q_den > 0 && q <= q_den))
+    return 0;
+  if (hist->count == 0)
+    return 0;
+
+  /* 1-based rank of the value wanted, rounded up. */
+  u64 rank = (hist->count * q + q_den - 1U) / q_den;
+  u64 seen = 0;
+
+  if (rank == 0)
+    rank = 1;
+  for (size_t i = 0; i < HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen >= rank) {
+      u64 low = hist_bucket_low(i);
+
+      return (low < hist->min) ? hist->min : low;
+    }
+  }
+  return hist->max;
+}
+
+u64 hist_count_range(const struct Hist* hist, u64 low, u64 high) {
+  if (!assert_ptr(hist))
+    return 0;
+
+  u64 total = 0;
+
+  for (size_t i = 0; i < HIST_BUCKETS; i++) {
+    u64 value = hist_bucket_low(i);
+
+    if (value >= high)
+      break;
+    if (value >= low)
+      total += hist->buckets[i];
+  }
+  return total;
+}
@@ -0,0 +1,879 @@
+// SPDX-License-Identifier: MIT
+#include "image.h"
+#include "cksum.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IMAGE_FLAG_POOL 1U
+#define IMAGE_BYTE_ORDER 0x01020304U
+#define IMAGE_DIGEST_K1 0x9E3779B97F4A7C15ULL
+#define IMAGE_DIGEST_K2 0xC2B2AE3D27D4EB4FULL
+/* Bytes the digest takes per step, one word for each of four lanes. */
+#define IMAGE_DIGEST_BLOCK 32U
+#define IMAGE_CACHE_SUFFIX ".cramb"
+/* Longest cache file name noted for eviction, NUL included. */
+#define IMAGE_CACHE_NAME_BYTES 256U
+
+static const char image_magic[8] = {'C', 'R', 'A', 'M', 'I', 'M', 'G', '\0'};
+
+/* The tables follow the header back to back, then the pool if present. */
+struct image_header {
+  char magic[8];
+  u32 version;
+  u32 flags;
+  u32 header_size;
+  u32 byte_order;
+  u32 group_size;
+  u32 item_size;
+  u32 break_size;
+  u32 breaks_cksum;
+  u64 pool_len;
+  u64 group_count;
+  u64 item_count;
+  u64 break_count;
+  /* Largest item_count of any group; sizes the shuffle scratch. */
+  u64 group_items;
+  u64 groups_offset;
+  u64 items_offset;
+  u64 breaks_offset;
+  u64 pool_offset;
+  u64 image_len;
+  /* text_digest() of the deck text; cache hits must match it. */
+  u64 source_digest;
+  /* cksum_bytes() of the deck text, as log_input() reports it. */
+  u32 source_cksum;
+  u32 groups_cksum;
+  u32 items_cksum;
+  /* cksum_bytes() of the header with this field zeroed. */
+  u32 header_cksum;
+};
+
+enum {
+  static_assert_image_header =
+      1 / ((sizeof(struct image_header) == 144U) ? 1 : 0),
+  static_assert_image_tables =
+      1 / ((sizeof(struct image_header) % sizeof(u64) == 0) ? 1 : 0),
+};
+
+static int set_error(char* err_buf, size_t err_len, const char* msg) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ptr(msg))
+    return -1;
+
+  int rc = snprintf(err_buf, err_len, "%s", msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+static int set_open_error(const char* path, char* err_buf, size_t err_len) {
+  const char* err = strerror(errno);
+
+  if (!err)
+    err = "unknown error";
+  char msg[256];
+  int rc = snprintf(msg, sizeof(msg), "Failed to open '%s': %s", path, err);
+  if (rc < 0 || (size_t)rc >= sizeof(msg))
+    return set_error(err_buf, err_len, "failed to open file");
+  return set_error(err_buf, err_len, msg);
+}
+
+static u64 digest_mix(u64 h, u64 word) {
+  h ^= word * IMAGE_DIGEST_K2;
+  h = (h << 31) | (h >> 33);
+  return h * IMAGE_DIGEST_K1;
+}
+
+/* A 64-bit hash of the deck text, four independent lanes wide so it runs
+ * near memory speed. Not cryptographic: it makes an accidental match of
+ * two decks with the same cksum and length vanishingly unlikely.
+ */
+static u64 text_digest(const unsigned char* text, size_t len) {
+  u64 lane[4] = {IMAGE_DIGEST_K1,
+      IMAGE_DIGEST_K2,
+      IMAGE_DIGEST_K1 ^ IMAGE_DIGEST_K2,
+      IMAGE_DIGEST_K1 + IMAGE_DIGEST_K2};
+  u64 word[4];
+  size_t pos = 0;
+
+  for (size_t i = 0; i < MAX_DECK_BYTES / IMAGE_DIGEST_BLOCK + 1U; i++) {
+    if (len - pos < IMAGE_DIGEST_BLOCK)
+      break;
+    memcpy(word, text + pos, IMAGE_DIGEST_BLOCK);
+    for (size_t j = 0; j < 4; j++)
+      lane[j] = digest_mix(lane[j], word[j]);
+    pos += IMAGE_DIGEST_BLOCK;
+  }
+  /* The tail, zero padded; the length below tells the padding apart. */
+  memset(word, 0, sizeof(word));
+  memcpy(word, text + pos, len - pos);
+  for (size_t j = 0; j < 4; j++)
+    lane[j] = digest_mix(lane[j], word[j]);
+
+  u64 h = (u64)len;
+
+  for (size_t j = 0; j < 4; j++)
+    h = digest_mix(h, lane[j]);
+  h ^= h >> 33;
+  h *= IMAGE_DIGEST_K2;
+  h ^= h >> 29;
+  return h;
+}
+
+static int header_cksum(const struct image_header* header, u32* out) {
+  struct image_header copy = *header;
+
+  copy.header_cksum = 0;
+  return cksum_bytes(out, (const unsigned char*)&copy, sizeof(copy));
+}
+
+/* The layout is fully determined by the counts, so every offset is checked
+ * exactly rather than merely bounded.
+ */
+static int check_header(const struct image_header* header,
+    size_t image_len,
+    int with_pool,
+    char* err_buf,
+    size_t err_len) {
+  if (memcmp(header->magic, image_magic, sizeof(image_magic)) != 0)
+    return set_error(err_buf, err_len, "not a compiled deck image");
+  if (header->version != IMAGE_VERSION)
+    return set_error(err_buf, err_len, "unsupported image version");
+  if (header->header_size != sizeof(struct image_header) ||
+      header->byte_order != IMAGE_BYTE_ORDER ||
+      header->group_size != sizeof(struct Group) ||
+      header->item_size != sizeof(struct Item) ||
+      header->break_size != sizeof(struct Utf8Break))
+    return set_error(err_buf, err_len, "image built for another platform");
+
+  u32 ck = 0;
+
+  if (header_cksum(header, &ck) != 0 || ck != header->header_cksum)
+    return set_error(err_buf, err_len, "image header checksum mismatch");
+
+  u32 flags = with_pool ? IMAGE_FLAG_POOL : 0U;
+  u64 groups_end = header->groups_offset +
+      header->group_count * (u64)sizeof(struct Group);
+  u64 items_end =
+      header->items_offset + header->item_count * (u64)sizeof(struct Item);
+  u64 breaks_end = header->breaks_offset +
+      header->break_count * (u64)sizeof(struct Utf8Break);
+  u64 pool_len = with_pool ? header->pool_len : 0U;
+  int ok = (header->flags == flags);
+
+  ok = ok && header->group_count >= 1 &&
+      header->group_count <= MAX_GROUPS_CAP;
+  ok = ok && header->item_count >= 1 &&
+      header->item_count <= MAX_ITEMS_TOTAL_CAP;
+  ok = ok && header->group_items >= 1 &&
+      header->group_items <= header->item_count &&
+      header->group_items <= MAX_ITEMS_PER_GROUP_CAP;
+  ok = ok && header->pool_len >= 1 && header->pool_len <= MAX_DECK_BYTES;
+  ok = ok && header->break_count <= header->pool_len;
+  ok = ok && header->groups_offset == sizeof(struct image_header);
+  ok = ok && header->items_offset == groups_end;
+  ok = ok && header->breaks_offset == items_end;
+  ok = ok && header->pool_offset == breaks_end;
+  ok = ok && header->image_len == breaks_end + pool_len;
+  ok = ok && header->image_len == (u64)image_len;
+  if (!ok)
+    return set_error(err_buf, err_len, "image is corrupt");
+  return 0;
+}
+
+static int check_limits(const struct image_header* header,
+    const struct Limits* limits,
+    char* err_buf,
+    size_t err_len) {
+  if (header->group_count > limits->max_groups)
+    return set_error(err_buf, err_len, "image exceeds --max-groups");
+  if (header->item_count > limits->max_items_total)
+    return set_error(err_buf, err_len, "image exceeds --max-items");
+  if (header->group_items > limits->max_items_per_group)
+    return set_error(
+        err_buf, err_len, "image exceeds --max-items-per-group");
+  return 0;
+}
+
+/* The units of item start at its first byte and column and move forward
+ * through it, so the renderer never slices outside the item.
+ */
+static int layout_ok(const struct Item* item, const struct Utf8Break* breaks) {
+  u32 offset = 0;
+  u32 column = 0;
+
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (i >= item->breaks)
+      break;
+    u32 next_offset = breaks[i].offset;
+    u32 next_column = breaks[i].column;
+
+    if (i == 0 && (next_offset != 0 || next_column != 0))
+      return 0;
+    if (i > 0 && next_offset <= offset)
+      return 0;
+    if (next_offset >= item->length || next_column < column ||
+        next_column > item->width)
+      return 0;
+    offset = next_offset;
+    column = next_column;
+  }
+  return 1;
+}
+
+/* Checksums catch damage; the bounds checks keep a hostile image from
+ * steering the runner outside the pool.
+ */
+static int check_tables(const struct image_header* header,
+    const unsigned char* base,
+    char* err_buf,
+    size_t err_len) {
+  const unsigned char* group_bytes = base + header->groups_offset;
+  const unsigned char* item_bytes = base + header->items_offset;
+  const unsigned char* break_bytes = base + header->breaks_offset;
+  size_t group_count = (size_t)header->group_count;
+  size_t item_count = (size_t)header->item_count;
+  size_t break_len = (size_t)header->break_count * sizeof(struct Utf8Break);
+  u32 ck = 0;
+
+  if (cksum_bytes(&ck, group_bytes, group_count * sizeof(struct Group)) != 0 ||
+      ck != header->groups_cksum)
+    return set_error(err_buf, err_len, "image group table checksum mismatch");
+  if (cksum_bytes(&ck, item_bytes, item_count * sizeof(struct Item)) != 0 ||
+      ck != header->items_cksum)
+    return set_error(err_buf, err_len, "image item table checksum mismatch");
+  if (cksum_bytes(&ck, break_bytes, break_len) != 0 ||
+      ck != header->breaks_cksum)
+    return set_error(err_buf, err_len, "image break table checksum mismatch");
+
+  const struct Group* groups = (const struct Group*)group_bytes;
+  const struct Item* items = (const struct Item*)item_bytes;
+  const struct Utf8Break* breaks = (const struct Utf8Break*)break_bytes;
+  u64 pool_len = header->pool_len;
+  u64 next_item = 0;
+
+  for (size_t i = 0; i < MAX_GROUPS_CAP; i++) {
+    if (i >= group_count)
+      break;
+    const struct Group* group = &groups[i];
+    int ok = group->seconds >= 1 && group->seconds <= MAX_GROUP_SECONDS;
+
+    ok = ok && (u64)group->name_offset + group->name_length <= pool_len;
+    ok = ok && group->item_start == next_item;
+    ok = ok && group->item_count >= 1 &&
+        group->item_count <= header->group_items;
+    if (!ok)
+      return set_error(err_buf, err_len, "image group table is corrupt");
+    next_item += group->item_count;
+  }
+  if (next_item != header->item_count)
+    return set_error(err_buf, err_len, "image group table is corrupt");
+  u64 next_break = 0;
+
+  for (size_t i = 0; i < MAX_ITEMS_TOTAL_CAP; i++) {
+    if (i >= item_count)
+      break;
+    const struct Item* item = &items[i];
+    int ok = (u64)item->offset + item->length <= pool_len;
+
+    ok = ok && item->length <= MAX_LINE_LEN;
+    ok = ok && item->first_break == next_break;
+    ok = ok && item->breaks <= item->length && item->width <= item->length;
+    ok = ok && next_break + item->breaks <= header->break_count;
+    ok = ok && layout_ok(item, breaks + next_break);
+    if (!ok)
+      return set_error(err_buf, err_len, "image item table is corrupt");
+    next_break += item->breaks;
+  }
+  if (next_break != header->break_count)
+    return set_error(err_buf, err_len, "image item table is corrupt");
+  return 0;
+}
+
+/* Points the session at the image tables; only the shuffle scratch is
+ * allocated.
+ */
+static int adopt_tables(const struct image_header* header,
+    unsigned char* base,
+    struct Session* session,
+    char* err_buf,
+    size_t err_len) {
+  struct SessionSizes sizes;
+
+  sizes.groups = (size_t)header->group_count;
+  sizes.items = (size_t)header->item_count;
+  sizes.group_items = (size_t)header->group_items;
+  sizes.breaks = 0;
+  sizes.tables = 0;
+  if (session_reserve(session, &sizes) != 0)
+    return set_error(err_buf, err_len, "failed to allocate session tables");
+  session->groups = (struct Group*)(base + header->groups_offset);
+  session->group_cap = sizes.groups;
+  session->group_count = sizes.groups;
+  session->items = (struct Item*)(base + header->items_offset);
+  session->item_cap = sizes.items;
+  session->item_count = sizes.items;
+  session->breaks = (struct Utf8Break*)(base + header->breaks_offset);
+  session->break_cap = (size_t)header->break_count;
+  session->break_count = (size_t)header->break_count;
+  return 0;
+}
+
+/* Maps a whole image read-only. *base stays NULL on failure. */
+static int map_image(const char* path,
+    void** base,
+    size_t* len,
+    char* err_buf,
+    size_t err_len) {
+  *base = NULL;
+  *len = 0;
+
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0)
+    return set_open_error(path, err_buf, err_len);
+
+  struct stat st;
+  int rc = fstat(fd, &st);
+
+  if (rc != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size < (off_t)sizeof(struct image_header) ||
+      st.st_size > (off_t)MAX_IMAGE_BYTES) {
+    int crc = close(fd);
+
+    if (crc != 0)
+      return set_error(err_buf, err_len, "failed to close file");
+    if (rc != 0)
+      return set_error(err_buf, err_len, "failed to stat file");
+    return set_error(err_buf, err_len, "image has an invalid size");
+  }
+
+  size_t size = (size_t)st.st_size;
+  void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int crc = close(fd);
+
+  if (map == MAP_FAILED)
+    return set_error(err_buf, err_len, "failed to map file");
+  *base = map;
+  *len = size;
+  if (crc != 0)
+    return set_error(err_buf, err_len, "failed to close file");
+  return 0;
+}
+
+int image_probe(const char* path) {
+  if (!validate_ptr(path))
+    return 0;
+
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0)
+    return 0;
+
+  struct stat st;
+  char magic[sizeof(image_magic)];
+  int found = 0;
+
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+      pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic))
+    found = (memcmp(magic, image_magic, sizeof(magic)) == 0);
+
+  int crc = close(fd);
+
+  if (crc != 0)
+    return 0;
+  return found;
+}
+
+int image_load_file(const char* path,
+    const struct Limits* limits,
+    struct Session* session,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(path))
+    return -1;
+  if (!validate_ptr(limits))
+    return -1;
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+
+  int rc = session_release(session);
+
+  if (rc != 0)
+    return set_error(err_buf, err_len, "failed to release session");
+  rc = session_init(session, limits);
+  if (rc != 0)
+    return set_error(err_buf, err_len, "failed to init session");
+
+  void* map = NULL;
+  size_t len = 0;
+
+  rc = map_image(path, &map, &len, err_buf, err_len);
+  session->map_base = map;
+  session->map_len = len;
+  if (rc != 0)
+    return -1;
+
+  unsigned char* base = (unsigned char*)map;
+  struct image_header header;
+
+  memcpy(&header, base, sizeof(header));
+  rc = check_header(&header, len, 1, err_buf, err_len);
+  if (rc != 0)
+    return -1;
+  rc = check_limits(&header, limits, err_buf, err_len);
+  if (rc != 0)
+    return -1;
+
+  const unsigned char* pool = base + header.pool_offset;
+  size_t pool_len = (size_t)header.pool_len;
+  u32 ck = 0;
+
+  rc = cksum_bytes(&ck, pool, pool_len);
+  if (rc != 0 || ck != header.source_cksum)
+    return set_error(err_buf, err_len, "image pool checksum mismatch");
+  rc = check_tables(&header, base, err_buf, err_len);
+  if (rc != 0)
+    return -1;
+  rc = adopt_tables(&header, base, session, err_buf, err_len);
+  if (rc != 0)
+    return -1;
+  session->text = (const char*)pool;
+  session->buffer_len = pool_len;
+  session->cksum = ck;
+  session->have_cksum = 1;
+  return 0;
+}
+
+static int write_all_fd(int fd, const unsigned char* buf, size_t len) {
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (len == 0)
+      break;
+    ssize_t n = write(fd, buf, len);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    buf += (size_t)n;
+    len -= (size_t)n;
+  }
+  if (len != 0)
+    return -1;
+  return 0;
+}
+
+static int fill_header(const struct Session* session,
+    int with_pool,
+    struct image_header* header) {
+  size_t group_count = session->group_count;
+  size_t item_count = session->item_count;
+  size_t group_items = 0;
+
+  for (size_t i = 0; i < MAX_GROUPS_CAP; i++) {
+    if (i >= group_count)
+      break;
+    if (session->groups[i].item_count > group_items)
+      group_items = session->groups[i].item_count;
+  }
+
+  size_t group_bytes = group_count * sizeof(struct Group);
+  size_t item_bytes = item_count * sizeof(struct Item);
+  size_t break_bytes = session->break_count * sizeof(struct Utf8Break);
+
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, image_magic, sizeof(image_magic));
+  header->version = IMAGE_VERSION;
+  header->flags = with_pool ? IMAGE_FLAG_POOL : 0U;
+  header->header_size = (u32)sizeof(struct image_header);
+  header->byte_order = IMAGE_BYTE_ORDER;
+  header->group_size = (u32)sizeof(struct Group);
+  header->item_size = (u32)sizeof(struct Item);
+  header->break_size = (u32)sizeof(struct Utf8Break);
+  header->pool_len = session->buffer_len;
+  header->group_count = group_count;
+  header->item_count = item_count;
+  header->break_count = session->break_count;
+  header->group_items = group_items;
+  header->groups_offset = sizeof(struct image_header);
+  header->items_offset = header->groups_offset + group_bytes;
+  header->breaks_offset = header->items_offset + item_bytes;
+  header->pool_offset = header->breaks_offset + break_bytes;
+  header->image_len =
+      header->pool_offset + (with_pool ? session->buffer_len : 0U);
+  header->source_digest =
+      text_digest((const unsigned char*)session->text, session->buffer_len);
+
+  int rc = 0;
+
+  if (session->have_cksum)
+    header->source_cksum = session->cksum;
+  else
+    rc = cksum_bytes(&header->source_cksum,
+        (const unsigned char*)session->text,
+        session->buffer_len);
+  if (rc != 0)
+    return -1;
+  rc = cksum_bytes(&header->groups_cksum,
+      (const unsigned char*)session->groups,
+      group_bytes);
+  if (rc != 0)
+    return -1;
+  rc = cksum_bytes(
+      &header->items_cksum, (const unsigned char*)session->items, item_bytes);
+  if (rc != 0)
+    return -1;
+  rc = cksum_bytes(&header->breaks_cksum,
+      (const unsigned char*)session->breaks,
+      break_bytes);
+  if (rc != 0)
+    return -1;
+  return header_cksum(header, &header->header_cksum);
+}
+
+/* Written under a fresh mkstemp() name next to path and renamed into
+ * place, so readers never see a partial image and no leftover or planted
+ * file is ever written through; a torn file left by a crash fails its
+ * checksums.
+ */
+int image_write(const struct Session* session,
+    const char* path,
+    int with_pool,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ok(session->group_count > 0 && session->item_count > 0))
+    return set_error(err_buf, err_len, "deck has no groups");
+
+  struct image_header header;
+  int rc = fill_header(session, with_pool, &header);
+
+  if (rc != 0)
+    return set_error(err_buf, err_len, "failed to checksum deck");
+
+  char tmp[MAX_PATH_LEN];
+
+  rc = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+  if (rc < 0 || (size_t)rc >= sizeof(tmp))
+    return set_error(err_buf, err_len, "output path too long");
+
+  int fd = mkstemp(tmp);
+
+  if (fd < 0)
+    return set_open_error(tmp, err_buf, err_len);
+  /* mkstemp() creates the file 0600; images are as readable as decks. */
+  rc = fchmod(fd, 0644);
+  if (rc == 0)
+    rc = write_all_fd(fd, (const unsigned char*)&header, sizeof(header));
+  if (rc == 0)
+    rc = write_all_fd(fd,
+        (const unsigned char*)session->groups,
+        session->group_count * sizeof(struct Group));
+  if (rc == 0)
+    rc = write_all_fd(fd,
+        (const unsigned char*)session->items,
+        session->item_count * sizeof(struct Item));
+  if (rc == 0)
+    rc = write_all_fd(fd,
+        (const unsigned char*)session->breaks,
+        session->break_count * sizeof(struct Utf8Break));
+  if (rc == 0 && with_pool)
+    rc = write_all_fd(
+        fd, (const unsigned char*)session->text, session->buffer_len);
+
+  int crc = close(fd);
+
+  if (rc == 0 && crc == 0)
+    rc = rename(tmp, path);
+  else
+    rc = -1;
+  if (rc != 0) {
+    int urc = unlink(tmp);
+
+    if (urc != 0 && errno != ENOENT)
+      return set_error(err_buf, err_len, "failed to remove temporary image");
+    return set_error(err_buf, err_len, "failed to write image");
+  }
+  return 0;
+}
+
+/* "<root>/cram", where root is $XDG_CACHE_HOME or ~/.cache. */
+static int cache_dir(char* out, size_t out_len, int create) {
+  const char* root = getenv("XDG_CACHE_HOME");
+  int rc = 0;
+
+  if (root && root[0] == '/') {
+    rc = snprintf(out, out_len, "%s", root);
+  } else {
+    const char* home = getenv("HOME");
+
+    if (!home || home[0] != '/')
+      return -1;
+    rc = snprintf(out, out_len, "%s/.cache", home);
+  }
+  if (rc < 0 || (size_t)rc >= out_len)
+    return -1;
+  if (create && mkdir(out, 0700) != 0 && errno != EEXIST)
+    return -1;
+
+  size_t n = (size_t)rc;
+
+  rc = snprintf(out + n, out_len - n, "/cram");
+  if (rc < 0 || (size_t)rc >= out_len - n)
+    return -1;
+  if (create && mkdir(out, 0700) != 0 && errno != EEXIST)
+    return -1;
+  return 0;
+}
+
+static int cache_load(struct Session* session, const char* path) {
+  char err_buf[128];
+  void* map = NULL;
+  size_t len = 0;
+  int rc = map_image(path, &map, &len, err_buf, sizeof(err_buf));
+
+  if (rc == 0) {
+    unsigned char* base = (unsigned char*)map;
+    struct image_header header;
+
+    memcpy(&header, base, sizeof(header));
+    rc = check_header(&header, len, 0, err_buf, sizeof(err_buf));
+    if (rc == 0 && (header.source_cksum != session->cksum ||
+                       header.pool_len != session->buffer_len))
+      rc = -1;
+    /* Last, since it reads the whole text: only a likely hit pays. */
+    if (rc == 0 &&
+        header.source_digest !=
+            text_digest((const unsigned char*)session->text,
+                session->buffer_len))
+      rc = -1;
+    if (rc == 0)
+      rc = check_limits(&header, &session->limits, err_buf, sizeof(err_buf));
+    if (rc == 0)
+      rc = check_tables(&header, base, err_buf, sizeof(err_buf));
+    if (rc == 0)
+      rc = adopt_tables(&header, base, session, err_buf, sizeof(err_buf));
+  }
+  if (rc != 0) {
+    if (map) {
+      int mrc = munmap(map, len);
+
+      if (!assert_ok(mrc == 0))
+        return -1;
+    }
+    return -1;
+  }
+  session->image_base = map;
+  session->image_len = len;
+  return 0;
+}
+
+int image_cache_lookup(struct Session* session, char* path, size_t path_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+  if (!validate_ok(path_len > 0))
+    return -1;
+  if (!validate_ptr(session->text))
+    return -1;
+
+  if (!session->have_cksum) {
+    int rc = cksum_bytes(&session->cksum,
+        (const unsigned char*)session->text,
+        session->buffer_len);
+
+    if (rc != 0)
+      return -1;
+    session->have_cksum = 1;
+  }
+  if (cache_dir(path, path_len, 0) != 0)
+    return -1;
+
+  size_t n = strlen(path);
+  int rc = snprintf(path + n,
+      path_len - n,
+      "/%08x-%zu.cramb",
+      (unsigned)session->cksum,
+      session->buffer_len);
+
+  if (rc < 0 || (size_t)rc >= path_len - n)
+    return -1;
+  if (cache_load(session, path) != 0)
+    return 1;
+  /* Marks the entry used; eviction goes by mtime. The result is ignored:
+   * in a cache that cannot be touched the hit is just as good, and the
+   * entry is only evicted sooner.
+   */
+  (void)utimensat(AT_FDCWD, path, NULL, 0);
+  return 0;
+}
+
+static int has_suffix(const char* name, const char* suffix) {
+  size_t len = strlen(name);
+  size_t n = strlen(suffix);
+
+  return len > n && strcmp(name + len - n, suffix) == 0;
+}
+
+/* The least recently used entries of the last cache_scan(), oldest
+ * first; at most IMAGE_CACHE_EVICT_ENTRIES of them.
+ */
+struct cache_entry {
+  time_t mtime;
+  u64 size;
+  char name[IMAGE_CACHE_NAME_BYTES];
+};
+
+static struct cache_entry g_cache_oldest[IMAGE_CACHE_EVICT_ENTRIES];
+static size_t g_cache_oldest_count;
+
+/* Inserts an entry in mtime order; a full table drops its newest entry. */
+static void cache_note(const char* name, const struct stat* st) {
+  size_t count = g_cache_oldest_count;
+  size_t at = count;
+
+  for (size_t i = 0; i < IMAGE_CACHE_EVICT_ENTRIES; i++) {
+    if (i >= count)
+      break;
+    if (st->st_mtime < g_cache_oldest[i].mtime) {
+      at = i;
+      break;
+    }
+  }
+  if (at >= IMAGE_CACHE_EVICT_ENTRIES)
+    return;
+  if (count < IMAGE_CACHE_EVICT_ENTRIES)
+    count++;
+  for (size_t i = IMAGE_CACHE_EVICT_ENTRIES - 1U; i > at; i--) {
+    if (i < count)
+      g_cache_oldest[i] = g_cache_oldest[i - 1U];
+  }
+  g_cache_oldest[at].mtime = st->st_mtime;
+  g_cache_oldest[at].size = (u64)st->st_size;
+  memcpy(g_cache_oldest[at].name, name, strlen(name) + 1U);
+  g_cache_oldest_count = count;
+}
+
+/* One pass over the cache directory: removes whatever has not been used
+ * for IMAGE_CACHE_MAX_AGE_SECS, temporaries left by a crash included, sums
+ * the entries that remain and notes the oldest ones other than keep.
+ */
+static int cache_scan(const char* dir, const char* keep, u64* total) {
+  DIR* d = opendir(dir);
+
+  if (!d)
+    return -1;
+
+  time_t now = time(NULL);
+  int rc = 0;
+
+  *total = 0;
+  g_cache_oldest_count = 0;
+  for (u64 i = 0; i < MAX_DIR_ENTRIES; i++) {
+    errno = 0;
+
+    struct dirent* ent = readdir(d);
+
+    if (!ent) {
+      if (errno != 0)
+        rc = -1;
+      break;
+    }
+    if (ent->d_name[0] == '.')
+      continue;
+
+    char path[MAX_PATH_LEN];
+    struct stat st;
+    int n = snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+
+    if (n < 0 || (size_t)n >= sizeof(path))
+      continue;
+    if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    if (strcmp(path, keep) != 0 &&
+        (u64)(now - st.st_mtime) > IMAGE_CACHE_MAX_AGE_SECS) {
+      if (unlink(path) != 0 && errno != ENOENT)
+        rc = -1;
+      continue;
+    }
+    if (!has_suffix(ent->d_name, IMAGE_CACHE_SUFFIX))
+      continue;
+    *total += (u64)st.st_size;
+    if (strcmp(path, keep) != 0 &&
+        strlen(ent->d_name) < IMAGE_CACHE_NAME_BYTES)
+      cache_note(ent->d_name, &st);
+  }
+  if (closedir(d) != 0)
+    rc = -1;
+  return rc;
+}
+
+/* Least recently used first, until the cache fits; keep always stays. A
+ * cache with more than IMAGE_CACHE_EVICT_ENTRIES entries to drop sheds the
+ * rest on later stores.
+ */
+static int cache_evict(const char* dir, const char* keep) {
+  u64 total = 0;
+
+  if (cache_scan(dir, keep, &total) != 0)
+    return -1;
+  for (size_t i = 0; i < IMAGE_CACHE_EVICT_ENTRIES; i++) {
+    if (i >= g_cache_oldest_count || total <= IMAGE_CACHE_MAX_BYTES)
+      break;
+
+    const struct cache_entry* entry = &g_cache_oldest[i];
+    char path[MAX_PATH_LEN];
+    int n = snprintf(path, sizeof(path), "%s/%s", dir, entry->name);
+
+    if (n < 0 || (size_t)n >= sizeof(path))
+      return -1;
+    if (unlink(path) != 0 && errno != ENOENT)
+      return -1;
+    total -= (entry->size < total) ? entry->size : total;
+  }
+  return 0;
+}
+
+int image_cache_store(const struct Session* session, const char* path) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+
+  char dir[MAX_PATH_LEN];
+  char err_buf[128];
+
+  if (cache_dir(dir, sizeof(dir), 1) != 0)
+    return -1;
+  if (image_write(session, path, 0, err_buf, sizeof(err_buf)) != 0)
+    return -1;
+  return cache_evict(dir, path);
+}
@@ -0,0 +1,431 @@
+// SPDX-License-Identifier: MIT
+/* cram-latency: end-to-end keypress-to-paint latency. Runs bin/cram on a
+ * pseudo-terminal with a generated deck, writes a key to the master side
+ * and times how long the whole new frame takes to come back, so termios,
+ * the event loop, logging and the write are all counted. Keys that arrive
+ * after the group timer ran out switch groups and are reported apart.
+ * Needs nothing but a Linux kernel with ptys; no display or terminal.
+ */
+/* posix_openpt(), grantpt(), unlockpt(), ptsname() and realpath(). */
+#define _XOPEN_SOURCE 700
+
+#include "config.h"
+#include "hist.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LATENCY_MAX_KEYS 1000000U
+#define LATENCY_MAX_SWITCHES 1000U
+#define LATENCY_GROUPS 4U
+#define LATENCY_ITEMS 256U
+#define LATENCY_GROUP_SECONDS 1U
+/* Keys this close to a group's expiry could land either side of it, so
+ * the harness waits until it has surely passed and counts a switch.
+ */
+#define LATENCY_MARGIN_NS 20000000ULL
+#define LATENCY_TIMEOUT_MS 5000
+#define LATENCY_READ_BYTES 4096U
+/* Reads one frame may take to arrive. */
+#define LATENCY_FRAME_READS 1024U
+/* Checks for cram's exit, 10 ms apart, before it is killed. */
+#define LATENCY_EXIT_POLLS 200U
+#define LATENCY_SLEEP_RETRIES 64U
+#define LATENCY_ROWS 24U
+#define LATENCY_COLS 80U
+/* Every frame ends by erasing below its last row (see term.c). */
+#define LATENCY_FRAME_END "\033[J"
+
+struct latency_opts {
+  const char* bin;
+  size_t keys;
+  size_t switches;
+  size_t gap_us;
+};
+
+struct latency_run {
+  int master;
+  pid_t child;
+  char dir[MAX_PATH_LEN];
+  char deck[MAX_PATH_LEN];
+  char bin[PATH_MAX];
+  /* The group timer started between these two times. */
+  u64 group_lo;
+  u64 group_hi;
+  /* Last bytes of the previous read, for an end split across reads. */
+  char tail[2];
+  size_t tail_len;
+};
+
+static struct Hist g_keys;
+static struct Hist g_switches;
+
+static int print_error(const char* name, const char* msg) {
+  int rc = fprintf(stderr, "Error: %s: %s\n", name, msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+static u64 now_ns(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+static void sleep_until(u64 ns) {
+  struct timespec ts;
+
+  ts.tv_sec = (time_t)(ns / 1000000000ULL);
+  ts.tv_nsec = (long)(ns % 1000000000ULL);
+  for (size_t i = 0; i < LATENCY_SLEEP_RETRIES; i++) {
+    if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == 0)
+      break;
+  }
+}
+
+static int parse_size(const char* text, size_t cap, size_t* out) {
+  if (!text || text[0] == '\0')
+    return -1;
+
+  size_t value = 0;
+
+  for (size_t i = 0; i < 20; i++) {
+    if (text[i] == '\0') {
+      *out = value;
+      return 0;
+    }
+    if (text[i] < '0' || text[i] > '9')
+      return -1;
+    value = value * 10U + (size_t)(text[i] - '0');
+    if (value > cap)
+      return -1;
+  }
+  return -1;
+}
+
+static int parse_opts(int argc, char** argv, struct latency_opts* opts) {
+  opts->bin = "bin/cram";
+  opts->keys = 2000;
+  opts->switches = 5;
+  opts->gap_us = 1000;
+  for (size_t i = 1; i < 16; i++) {
+    if (i >= (size_t)argc)
+      return 0;
+    const char* arg = argv[i];
+    const char* value = (i + 1 < (size_t)argc) ? argv[i + 1] : NULL;
+    int rc = -1;
+
+    if (strcmp(arg, "--bin") == 0 && value) {
+      opts->bin = value;
+      rc = 0;
+    } else if (strcmp(arg, "--keys") == 0) {
+      rc = parse_size(value, LATENCY_MAX_KEYS, &opts->keys);
+    } else if (strcmp(arg, "--switches") == 0) {
+      rc = parse_size(value, LATENCY_MAX_SWITCHES, &opts->switches);
+    } else if (strcmp(arg, "--gap-us") == 0) {
+      rc = parse_size(value, 1000000U, &opts->gap_us);
+    }
+    if (rc != 0)
+      return -1;
+    i++;
+  }
+  return -1;
+}
+
+/* LATENCY_GROUPS groups of LATENCY_ITEMS one-line prompts, each group
+ * running LATENCY_GROUP_SECONDS.
+ */
+static int write_deck(const char* path) {
+  FILE* f = fopen(path, "w");
+
+  if (!f)
+    return -1;
+
+  int rc = 0;
+
+  for (size_t g = 0; g < LATENCY_GROUPS; g++) {
+    if (fprintf(f, "[Group %zu | %u]\n", g, LATENCY_GROUP_SECONDS) < 0)
+      rc = -1;
+    for (size_t i = 0; i < LATENCY_ITEMS; i++) {
+      if (fprintf(f,
+              "Prompt %zu of group %zu: the quick brown fox jumps\n",
+              i,
+              g) < 0)
+        rc = -1;
+    }
+  }
+  if (fclose(f) != 0)
+    rc = -1;
+  return rc;
+}
+
+static int open_pty(struct latency_run* run, char* slave, size_t slave_len) {
+  run->master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (run->master < 0)
+    return -1;
+  if (grantpt(run->master) != 0 || unlockpt(run->master) != 0)
+    return -1;
+
+  const char* name = ptsname(run->master);
+
+  if (!name || strlen(name) >= slave_len)
+    return -1;
+  memcpy(slave, name, strlen(name) + 1);
+
+  struct winsize ws;
+
+  memset(&ws, 0, sizeof(ws));
+  ws.ws_row = LATENCY_ROWS;
+  ws.ws_col = LATENCY_COLS;
+  return ioctl(run->master, TIOCSWINSZ, &ws);
+}
+
+/* In the child: the pty becomes its controlling terminal and stdio, and
+ * the log goes to the scratch directory.
+ */
+static void exec_cram(const struct latency_run* run, const char* slave) {
+  if (setsid() < 0)
+    _exit(127);
+
+  int fd = open(slave, O_RDWR);
+
+  if (fd < 0 || ioctl(fd, TIOCSCTTY, 0) != 0)
+    _exit(127);
+  if (dup2(fd, STDIN_FILENO) < 0 || dup2(fd, STDOUT_FILENO) < 0 ||
+      dup2(fd, STDERR_FILENO) < 0)
+    _exit(127);
+  if (fd > STDERR_FILENO && close(fd) != 0)
+    _exit(127);
+  if (close(run->master) != 0 || chdir(run->dir) != 0)
+    _exit(127);
+
+  char* args[] = {"cram", "--no-cache", (char*)run->deck, NULL};
+
+  execv(run->bin, args);
+  _exit(127);
+}
+
+/* Reads the master side until a frame has ended; *paint_ns gets the time
+ * the read holding its end returned.
+ */
+static int wait_paint(struct latency_run* run, u64* paint_ns) {
+  char buf[LATENCY_READ_BYTES + 2];
+  struct pollfd pfd;
+
+  pfd.fd = run->master;
+  pfd.events = POLLIN;
+  for (size_t i = 0; i < LATENCY_FRAME_READS; i++) {
+    int ready = poll(&pfd, 1, LATENCY_TIMEOUT_MS);
+
+    if (ready < 0 && errno == EINTR)
+      continue;
+    if (ready <= 0)
+      return -1;
+
+    memcpy(buf, run->tail, run->tail_len);
+
+    ssize_t n =
+        read(run->master, buf + run->tail_len, LATENCY_READ_BYTES);
+    u64 now = now_ns();
+
+    if (n <= 0)
+      return -1;
+
+    size_t len = run->tail_len + (size_t)n;
+    size_t keep = (len < 2U) ? len : 2U;
+    int found = 0;
+
+    for (size_t j = 0; j + 3U <= len; j++) {
+      if (j >= LATENCY_READ_BYTES)
+        break;
+      if (memcmp(&buf[j], LATENCY_FRAME_END, 3) == 0)
+        found = 1;
+    }
+    memcpy(run->tail, &buf[len - keep], keep);
+    run->tail_len = keep;
+    if (found) {
+      run->tail_len = 0;
+      *paint_ns = now;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int press(struct latency_run* run, u64* sent_ns, u64* paint_ns) {
+  *sent_ns = now_ns();
+  if (write(run->master, " ", 1) != 1)
+    return -1;
+  return wait_paint(run, paint_ns);
+}
+
+static int measure(struct latency_run* run, const struct latency_opts* opts) {
+  u64 group_ns = (u64)LATENCY_GROUP_SECONDS * 1000000000ULL;
+  size_t keys = 0;
+  size_t switches = 0;
+
+  for (size_t step = 0; step < LATENCY_MAX_KEYS + LATENCY_MAX_SWITCHES;
+       step++) {
+    if (keys >= opts->keys && switches >= opts->switches)
+      break;
+
+    u64 expiry_lo = run->group_lo + group_ns - LATENCY_MARGIN_NS;
+    u64 expiry_hi = run->group_hi + group_ns + LATENCY_MARGIN_NS;
+    int is_switch = (keys >= opts->keys || now_ns() >= expiry_lo);
+
+    if (is_switch)
+      sleep_until(expiry_hi);
+
+    u64 sent = 0;
+    u64 paint = 0;
+
+    if (press(run, &sent, &paint) != 0)
+      return print_error(run->bin, "no frame after a key");
+    struct Hist* hist = is_switch ? &g_switches : &g_keys;
+
+    if (hist_add(hist, (paint - sent) / 1000U) != 0)
+      return -1;
+    if (is_switch) {
+      run->group_lo = sent;
+      run->group_hi = paint;
+      switches++;
+    } else {
+      keys++;
+    }
+    if (opts->gap_us > 0)
+      sleep_until(now_ns() + (u64)opts->gap_us * 1000U);
+  }
+  return 0;
+}
+
+static int stop_cram(struct latency_run* run) {
+  int status = 0;
+
+  if (write(run->master, "\003", 1) != 1)
+    return -1;
+  for (size_t i = 0; i < LATENCY_EXIT_POLLS; i++) {
+    pid_t pid = waitpid(run->child, &status, WNOHANG);
+
+    if (pid == run->child)
+      return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+    if (pid < 0)
+      return -1;
+    sleep_until(now_ns() + 10000000ULL);
+  }
+  if (kill(run->child, SIGKILL) != 0)
+    return -1;
+  if (waitpid(run->child, &status, 0) != run->child)
+    return -1;
+  return -1;
+}
+
+static int print_hist(const char* name, const struct Hist* h) {
+  u64 mean = (h->count > 0) ? h->sum / h->count : 0;
+  int rc = printf(
+      "%s: count=%llu min_us=%llu p50_us=%llu p99_us=%llu p999_us=%llu "
+      "max_us=%llu mean_us=%llu\n",
+      name,
+      (unsigned long long)h->count,
+      (unsigned long long)h->min,
+      (unsigned long long)hist_quantile(h, 50, 100),
+      (unsigned long long)hist_quantile(h, 99, 100),
+      (unsigned long long)hist_quantile(h, 999, 1000),
+      (unsigned long long)h->max,
+      (unsigned long long)mean);
+
+  return (rc < 0) ? -1 : 0;
+}
+
+static int run_harness(struct latency_run* run,
+    const struct latency_opts* opts) {
+  char slave[MAX_PATH_LEN];
+
+  if (!realpath(opts->bin, run->bin))
+    return print_error(opts->bin, strerror(errno));
+  if (write_deck(run->deck) != 0)
+    return print_error(run->deck, "cannot write deck");
+  if (open_pty(run, slave, sizeof(slave)) != 0)
+    return print_error("pty", strerror(errno));
+
+  run->group_lo = now_ns();
+  run->child = fork();
+  if (run->child < 0)
+    return print_error("fork", strerror(errno));
+  if (run->child == 0)
+    exec_cram(run, slave);
+
+  /* The first group's timer starts before the first frame is painted. */
+  int rc = wait_paint(run, &run->group_hi);
+
+  if (rc != 0)
+    rc = print_error(run->bin, "no first frame");
+  if (rc == 0)
+    rc = measure(run, opts);
+  if (stop_cram(run) != 0 && rc == 0)
+    rc = print_error(run->bin, "did not exit cleanly");
+  if (rc != 0)
+    return -1;
+  if (print_hist("keypress", &g_keys) != 0)
+    return -1;
+  return print_hist("group-switch", &g_switches);
+}
+
+int main(int argc, char** argv) {
+  struct latency_opts opts;
+  static struct latency_run run;
+
+  if (parse_opts(argc, argv, &opts) != 0) {
+    int rc = fprintf(stderr,
+        "Usage: cram-latency [--bin PATH] [--keys N] [--switches N] "
+        "[--gap-us N]\n");
+
+    if (rc < 0)
+      return 1;
+    return 1;
+  }
+  if (hist_reset(&g_keys) != 0 || hist_reset(&g_switches) != 0)
+    return 1;
+  run.master = -1;
+
+  const char* tmp = getenv("TMPDIR");
+  int rc = snprintf(run.dir,
+      sizeof(run.dir),
+      "%s/cram-latency.XXXXXX",
+      (tmp && tmp[0] != '\0') ? tmp : "/tmp");
+
+  if (rc < 0 || (size_t)rc >= sizeof(run.dir) || !mkdtemp(run.dir)) {
+    print_error(run.dir, "cannot create scratch directory");
+    return 1;
+  }
+  rc = snprintf(run.deck, sizeof(run.deck), "%s/deck", run.dir);
+  if (rc < 0 || (size_t)rc >= sizeof(run.deck))
+    return 1;
+
+  rc = run_harness(&run, &opts);
+
+  char log_path[MAX_PATH_LEN];
+  int path_rc = snprintf(log_path, sizeof(log_path), "%s/cram.log", run.dir);
+
+  if (path_rc > 0 && (size_t)path_rc < sizeof(log_path))
+    unlink(log_path);
+  unlink(run.deck);
+  if (rmdir(run.dir) != 0)
+    rc = -1;
+  if (run.master >= 0 && close(run.master) != 0)
+    rc = -1;
+  return (rc == 0) ? 0 : 1;
+}
@@ -1,55 +1,88 @@
 // SPDX-License-Identifier: MIT
 #include "log.h"
+#include "cksum.h"
 #include "config.h"
+#include "logfmt.h"
+#include "logseg.h"
+#include "metrics.h"
 #include "model.h"
+#include "rng.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
-static int g_log_fd = -1;
+/* One event before encoding. path points into argv, which outlives the
+ * writer thread; it is made absolute and sanitized when encoded.
+ */
+struct log_event {
+  struct LogRecord rec;
+  const char* path;
+};
 
-static u32 cksum_update(u32 crc, unsigned char b) {
-  crc ^= (u32)b << 24;
-  for (int i = 0; i < 8; i++) {
-    if (crc & 0x80000000U)
-      crc = (crc << 1) ^ 0x04C11DB7U;
-    else
-      crc <<= 1;
-  }
-  return crc;
-}
-
-static int cksum_bytes(u32* out, const unsigned char* buf, size_t len) {
-  if (!validate_ptr(out))
-    return -1;
-  if (!validate_ptr(buf))
-    return -1;
-  if (!assert_ok(len <= MAX_FILE_BYTES))
-    return -1;
+static int g_log_fd = -1;
+static struct LogConfig g_log_config;
+/* Events written since the last fdatasync(), and when that was. */
+static size_t g_log_unsynced;
+static u64 g_log_synced_ms;
 
-  u32 crc = 0;
+/* Random per process; shard lines carry it, start records always do. */
+static u64 g_log_sid;
+static char g_log_name[64];
 
-  for (size_t i = 0; i < MAX_FILE_BYTES; i++) {
-    if (i >= len)
-      break;
-    crc = cksum_update(crc, buf[i]);
-  }
+/* --log-rotate: the active segment's index file, its size so far, when it
+ * was started, the offset at which the next periodic index entry is due and
+ * the time of the last event written.
+ * Only the thread that writes the log touches these.
+ */
+static int g_index_fd = -1;
+static u64 g_log_bytes;
+static u64 g_segment_ms;
+static u64 g_index_due;
+static u64 g_last_ms;
 
-  size_t n = len;
+/* --log-ring: the shared mapping and the next event number. */
+static struct LogRingHeader* g_shared;
+static struct LogRingSlot* g_shared_slots;
+static u64 g_shared_next;
 
-  for (size_t i = 0; i < sizeof(size_t); i++) {
-    if (n == 0)
-      break;
-    crc = cksum_update(crc, (unsigned char)(n & 0xFF));
-    n >>= 8;
-  }
-  *out = ~crc;
-  return 0;
-}
+static int g_log_async;
+static struct log_event g_ring[LOG_RING_EVENTS];
+/* Events the UI thread found no room for; the exit record reports them. */
+static u64 g_ring_dropped;
+/* Async mode: the UI thread is the only producer and the writer thread the
+ * only consumer, so head and tail each have a single writer.
+ */
+static atomic_size_t g_ring_head;
+static atomic_size_t g_ring_tail;
+static pthread_t g_writer;
+static pthread_mutex_t g_writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_writer_wake = PTHREAD_COND_INITIALIZER;
+/* Signalled by the writer when it frees slots the UI thread waits for. */
+static pthread_cond_t g_ring_room = PTHREAD_COND_INITIALIZER;
+static int g_writer_kick;
+static int g_writer_stop;
+static atomic_int g_writer_failed;
+/* Set while the writer sleeps and while the UI thread waits for room. Each
+ * side stores its flag before reading the other's index, and reads the
+ * other's flag after storing its own index, all sequentially consistent, so
+ * at least one of them sees that a wakeup is needed.
+ */
+static atomic_int g_writer_idle;
+static atomic_int g_ring_waiting;
+/* One encoded event: a text line, or a record plus its path records. */
+#define LOG_ENCODED_BYTES (LOG_RECORD_BYTES + LOG_PATH_BYTES)
+static char g_batch[LOG_BATCH_EVENTS][LOG_ENCODED_BYTES];
 
 static size_t sanitize_path(const char* path, char* out, size_t out_len) {
   if (!validate_ptr(out))
@@ -133,41 +166,305 @@ static int write_all_fd(int fd, const char* buf, size_t len) {
   return 0;
 }
 
-static int log_write(const char* tag, const char* msg) {
-  if (!validate_ptr(tag))
+static u64 now_ms(clockid_t clock) {
+  struct timespec ts;
+
+  if (clock_gettime(clock, &ts) != 0)
+    return 0;
+  return (u64)ts.tv_sec * 1000ULL + (u64)(ts.tv_nsec / 1000000L);
+}
+
+/* Logging is optional: a log that cannot be used only costs a warning. */
+static int log_warn(const char* name, const char* what, const char* why) {
+  char msg[256];
+  int rc =
+      snprintf(msg, sizeof(msg), "Warning: %s %s: %s\n", what, name, why);
+
+  if (rc < 0 || (size_t)rc >= sizeof(msg))
     return -1;
-  if (!validate_ptr(msg))
+  return write_all_fd(STDERR_FILENO, msg, (size_t)rc);
+}
+
+/* A new binary log gets a header; an existing one must start with ours. */
+static int binary_prepare(void) {
+  struct stat st;
+
+  if (fstat(g_log_fd, &st) != 0)
     return -1;
-  if (!assert_ok(g_log_fd >= 0))
+
+  struct LogHeader header;
+
+  if (st.st_size == 0) {
+    u32 flags = g_log_config.shard ? LOG_FLAG_SHARD : 0;
+
+    if (logfmt_header_init(&header, flags) != 0)
+      return -1;
+    return write_all_fd(g_log_fd, (const char*)&header, sizeof(header));
+  }
+  if (st.st_size < (off_t)sizeof(header))
+    return -1;
+  if (pread(g_log_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
     return -1;
+  if (logfmt_header_check(&header) != 0)
+    return -1;
+  if (((header.flags & LOG_FLAG_SHARD) != 0) != (g_log_config.shard != 0))
+    return -1;
+  return 0;
+}
 
-  struct timespec ts;
-  int rc = clock_gettime(CLOCK_REALTIME, &ts);
+/* Opens the active segment's index. An index that is not ours is left
+ * alone and the segment goes unindexed.
+ */
+static int index_open(void) {
+  char name[sizeof(g_log_name) + 8];
+  struct stat st;
 
-  if (rc != 0)
+  if (logseg_name(g_log_name, 0, ".idx", name, sizeof(name)) != 0)
+    return -1;
+  if (fstat(g_log_fd, &st) != 0)
+    return -1;
+  g_log_bytes = (u64)st.st_size;
+  g_index_due = g_log_bytes;
+  g_segment_ms = now_ms(CLOCK_MONOTONIC);
+  g_index_fd = open(name, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (g_index_fd < 0)
+    return log_warn(name, "cannot create index", strerror(errno));
+  if (fstat(g_index_fd, &st) != 0)
     return -1;
 
-  u64 sec = (u64)ts.tv_sec;
-  u64 ms = (u64)(ts.tv_nsec / 1000000L);
-  char line[256];
+  struct LogIndexHeader header;
 
-  rc = snprintf(line,
-      sizeof(line),
-      "%llu.%03llu [%s] %s\n",
-      (unsigned long long)sec,
-      (unsigned long long)ms,
-      tag,
-      msg);
-  if (!assert_ok(rc > 0))
+  if (st.st_size == 0) {
+    if (logfmt_index_init(&header) != 0)
+      return -1;
+    return write_all_fd(g_index_fd, (const char*)&header, sizeof(header));
+  }
+  if (st.st_size >= (off_t)sizeof(header) &&
+      pread(g_index_fd, &header, sizeof(header), 0) ==
+          (ssize_t)sizeof(header) &&
+      logfmt_index_check(&header) == 0)
+    return 0;
+  if (close(g_index_fd) != 0)
     return -1;
-  if (!assert_ok((size_t)rc < sizeof(line)))
+  g_index_fd = -1;
+  return log_warn(name, "not indexing", "not a cram log index");
+}
+
+static int index_close(void) {
+  if (g_index_fd < 0)
+    return 0;
+
+  int rc = close(g_index_fd);
+
+  g_index_fd = -1;
+  return (rc == 0) ? 0 : -1;
+}
+
+/* Counts an encoded event about to be written and indexes session starts
+ * and, every LOG_INDEX_STRIDE bytes, the next event.
+ */
+static int index_event(const struct LogRecord* rec, size_t len) {
+  if (g_log_config.rotate == LOG_ROTATE_NONE)
+    return 0;
+
+  u64 offset = g_log_bytes;
+
+  g_log_bytes += len;
+  g_last_ms = rec->time_ms;
+  if (g_index_fd < 0)
+    return 0;
+  if (rec->type != LOG_TYPE_START && offset < g_index_due)
+    return 0;
+
+  struct LogIndexEntry entry;
+
+  memset(&entry, 0, sizeof(entry));
+  entry.time_ms = rec->time_ms;
+  entry.offset = offset;
+  entry.kind = (rec->type == LOG_TYPE_START) ? LOG_INDEX_START
+                                             : LOG_INDEX_MARK;
+  g_index_due = offset + LOG_INDEX_STRIDE;
+  return write_all_fd(g_index_fd, (const char*)&entry, sizeof(entry));
+}
+
+static int rotate_due(void) {
+  u64 every = (u64)g_log_config.rotate_every;
+
+  if (g_log_config.rotate == LOG_ROTATE_KIB)
+    return g_log_bytes >= every * 1024U;
+  if (g_log_config.rotate == LOG_ROTATE_SECS)
+    return now_ms(CLOCK_MONOTONIC) - g_segment_ms >= every * 1000U;
+  return 0;
+}
+
+/* Logging carries on in the current file, unrotated. */
+static int rotate_failed(const char* why) {
+  g_log_config.rotate = LOG_ROTATE_NONE;
+  if (index_close() != 0)
+    return -1;
+  return log_warn(g_log_name, "cannot rotate", why);
+}
+
+/* Renames the active segment and its index to the next number and goes on
+ * in a fresh file. The new file is dup2()ed onto g_log_fd rather than
+ * replacing it, because the UI thread reads g_log_fd in async mode.
+ */
+static int log_rotate(void) {
+  char segment[sizeof(g_log_name) + 16];
+  char index[sizeof(g_log_name) + 8];
+  char segment_index[sizeof(g_log_name) + 24];
+  long last = logseg_last(g_log_name);
+
+  if (fdatasync(g_log_fd) != 0 && errno != EINVAL)
     return -1;
+  if (last < 0 || last >= (long)UINT32_MAX - 1)
+    return rotate_failed("cannot number the next segment");
+  if (logseg_name(g_log_name, (u32)last + 1U, "", segment, sizeof(segment)) !=
+          0 ||
+      logseg_name(g_log_name, 0, ".idx", index, sizeof(index)) != 0 ||
+      logseg_name(g_log_name,
+          (u32)last + 1U,
+          ".idx",
+          segment_index,
+          sizeof(segment_index)) != 0)
+    return rotate_failed("name too long");
+  if (rename(g_log_name, segment) != 0)
+    return rotate_failed(strerror(errno));
 
-  char* ptr = line;
-  size_t len = (size_t)rc;
+  int index_rc = 0;
+
+  if (g_index_fd >= 0) {
+    index_rc = index_close();
+    if (index_rc == 0 && rename(index, segment_index) != 0)
+      index_rc = log_warn(segment_index, "cannot create", strerror(errno));
+  }
+
+  int fd = open(g_log_name, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+  if (fd < 0)
+    return rotate_failed(strerror(errno));
+  if (dup2(fd, g_log_fd) < 0) {
+    const char* err = strerror(errno);
+
+    if (close(fd) != 0)
+      return -1;
+    return rotate_failed(err);
+  }
+  if (close(fd) != 0 || index_rc != 0)
+    return -1;
+  if (g_log_config.format == LOG_FORMAT_BINARY && binary_prepare() != 0)
+    return -1;
+  return index_open();
+}
+
+/* Encodes ev in the configured format; returns the length or 0. */
+static size_t encode_event(const struct log_event* ev, char* out, size_t len) {
+  char safe_path[LOG_PATH_BYTES];
+  size_t path_len = 0;
+
+  safe_path[0] = '\0';
+  if (ev->rec.type == LOG_TYPE_FILE)
+    path_len = sanitize_abs_path(ev->path, safe_path, sizeof(safe_path));
+  if (g_log_config.format == LOG_FORMAT_TEXT)
+    return logfmt_text(&ev->rec,
+        safe_path,
+        g_log_config.shard ? g_log_sid : 0,
+        out,
+        len);
+
+  struct LogRecord rec = ev->rec;
+  size_t path_bytes = 0;
+
+  if (path_len > 0)
+    path_bytes = (path_len + LOG_RECORD_BYTES) / LOG_RECORD_BYTES *
+        LOG_RECORD_BYTES;
+  if (!assert_ok(LOG_RECORD_BYTES + path_bytes <= len))
+    return 0;
+  rec.extra = (u32)(path_bytes / LOG_RECORD_BYTES);
+  memcpy(out, &rec, sizeof(rec));
+  if (path_bytes > 0) {
+    memset(out + LOG_RECORD_BYTES, 0, path_bytes);
+    memcpy(out + LOG_RECORD_BYTES, safe_path, path_len);
+  }
+  return LOG_RECORD_BYTES + path_bytes;
+}
+
+/* Applies the flush policy after count more events reached the file. */
+static int sync_policy(size_t count) {
+  g_log_unsynced += count;
+  if (g_log_unsynced == 0)
+    return 0;
+
+  int due = 0;
+
+  if (g_log_config.flush == LOG_FLUSH_EVENTS)
+    due = (g_log_unsynced >= g_log_config.every);
+  if (g_log_config.flush == LOG_FLUSH_MS)
+    due = (now_ms(CLOCK_MONOTONIC) - g_log_synced_ms >= g_log_config.every);
+  if (!due)
+    return 0;
+  g_log_unsynced = 0;
+  g_log_synced_ms = now_ms(CLOCK_MONOTONIC);
+  if (fdatasync(g_log_fd) != 0 && errno != EINVAL)
+    return -1;
+  return 0;
+}
+
+/* Called after each write, so rotation happens between events. The new
+ * segment opens with a record naming the session, so a binary shard segment
+ * dumps with its session ID on its own. It takes the time of the last event
+ * written, which keeps the segment in time order.
+ */
+static int rotate_check(void) {
+  if (!rotate_due())
+    return 0;
+  if (log_rotate() != 0)
+    return -1;
+  if (g_log_config.rotate == LOG_ROTATE_NONE)
+    return 0;
+
+  struct log_event ev;
+  char line[LOG_ENCODED_BYTES];
+
+  memset(&ev, 0, sizeof(ev));
+  ev.rec.type = LOG_TYPE_SEGMENT;
+  ev.rec.time_ms = g_last_ms;
+  ev.rec.value = g_log_sid;
+
+  size_t len = encode_event(&ev, line, sizeof(line));
+
+  if (len == 0 || index_event(&ev.rec, len) != 0)
+    return -1;
+  return write_all_fd(g_log_fd, line, len);
+}
+
+static int write_event(const struct log_event* ev) {
+  char line[LOG_ENCODED_BYTES];
+  size_t len = encode_event(ev, line, sizeof(line));
+
+  if (len == 0)
+    return -1;
+  if (index_event(&ev->rec, len) != 0)
+    return -1;
+
+  u64 start = metrics_start();
+
+  if (write_all_fd(g_log_fd, line, len) != 0)
+    return -1;
+  if (sync_policy(1) != 0)
+    return -1;
+  if (metrics_observe(METRIC_LOG_WRITE, start) != 0)
+    return -1;
+  return rotate_check();
+}
+
+static int writev_all(struct iovec* iov, size_t count) {
+  size_t first = 0;
 
   for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
-    ssize_t n = write(g_log_fd, ptr, len);
+    if (first >= count)
+      break;
+    ssize_t n = writev(g_log_fd, &iov[first], (int)(count - first));
 
     if (n < 0) {
       if (errno == EINTR)
@@ -175,43 +472,321 @@ static int log_write(const char* tag, const char* msg) {
       return -1;
     }
     if (n == 0)
+      return -1;
+
+    size_t done = (size_t)n;
+
+    for (size_t j = 0; j < LOG_BATCH_EVENTS; j++) {
+      if (first >= count || done < iov[first].iov_len)
+        break;
+      done -= iov[first].iov_len;
+      first++;
+    }
+    if (first < count) {
+      iov[first].iov_base = (char*)iov[first].iov_base + done;
+      iov[first].iov_len -= done;
+    }
+  }
+  if (first < count)
+    return -1;
+  return 0;
+}
+
+/* Queue length at which the UI thread wakes an idle writer. */
+static size_t ring_kick_at(void) {
+  size_t kick_at = (g_log_config.flush == LOG_FLUSH_EVENTS)
+      ? g_log_config.every
+      : LOG_RING_EVENTS / 2U;
+
+  if (kick_at > LOG_RING_EVENTS / 2U)
+    kick_at = LOG_RING_EVENTS / 2U;
+  return kick_at;
+}
+
+static size_t ring_queued(void) {
+  size_t head = atomic_load(&g_ring_head);
+  size_t tail = atomic_load(&g_ring_tail);
+
+  return head - tail;
+}
+
+static int deadline_after(u64 ms, struct timespec* deadline) {
+  if (clock_gettime(CLOCK_REALTIME, deadline) != 0)
+    return -1;
+  deadline->tv_sec += (time_t)(ms / 1000U);
+  deadline->tv_nsec += (long)(ms % 1000U) * 1000000L;
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000L;
+  }
+  return 0;
+}
+
+static int ring_room_signal(void) {
+  if (pthread_mutex_lock(&g_writer_lock) != 0)
+    return -1;
+
+  int rc = pthread_cond_signal(&g_ring_room);
+
+  if (pthread_mutex_unlock(&g_writer_lock) != 0)
+    return -1;
+  return (rc == 0) ? 0 : -1;
+}
+
+/* Writes everything queued so far, LOG_BATCH_EVENTS lines per writev(). */
+static int writer_drain(void) {
+  struct iovec iov[LOG_BATCH_EVENTS];
+  int rc = 0;
+
+  for (size_t b = 0; b <= LOG_RING_EVENTS / LOG_BATCH_EVENTS; b++) {
+    size_t tail = atomic_load_explicit(&g_ring_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&g_ring_head, memory_order_acquire);
+    size_t count = 0;
+
+    for (size_t i = 0; i < LOG_BATCH_EVENTS; i++) {
+      if (tail + i == head)
+        break;
+      const struct log_event* ev = &g_ring[(tail + i) % LOG_RING_EVENTS];
+      size_t len = encode_event(ev, g_batch[count], sizeof(g_batch[count]));
+
+      if (len == 0 || index_event(&ev->rec, len) != 0) {
+        rc = -1;
+      } else {
+        iov[count].iov_base = g_batch[count];
+        iov[count].iov_len = len;
+        count++;
+      }
+      atomic_store(&g_ring_tail, tail + i + 1);
+    }
+    if (count == 0)
       break;
-    ptr += (size_t)n;
-    len -= (size_t)n;
-    if (len == 0)
+    if (atomic_load(&g_ring_waiting) && ring_room_signal() != 0)
+      rc = -1;
+
+    u64 start = metrics_start();
+
+    if (writev_all(iov, count) != 0 || sync_policy(count) != 0)
+      rc = -1;
+    if (metrics_observe(METRIC_LOG_WRITE, start) != 0)
+      rc = -1;
+    if (rotate_check() != 0)
+      rc = -1;
+  }
+  return rc;
+}
+
+/* Sleeps until kicked, stopped or the policy's interval passes. A queue
+ * already at the kick threshold is drained without sleeping.
+ */
+static int writer_wait(void) {
+  u64 wait_ms = (g_log_config.flush == LOG_FLUSH_MS) ? g_log_config.every
+                                                     : LOG_IDLE_FLUSH_MS;
+  struct timespec deadline;
+
+  if (deadline_after(wait_ms, &deadline) != 0)
+    return -1;
+  if (pthread_mutex_lock(&g_writer_lock) != 0)
+    return -1;
+
+  int rc = 0;
+
+  atomic_store(&g_writer_idle, 1);
+  if (!g_writer_kick && !g_writer_stop && ring_queued() < ring_kick_at())
+    rc = pthread_cond_timedwait(&g_writer_wake, &g_writer_lock, &deadline);
+  atomic_store(&g_writer_idle, 0);
+
+  int stop = g_writer_stop;
+
+  g_writer_kick = 0;
+  if (pthread_mutex_unlock(&g_writer_lock) != 0)
+    return -1;
+  if (rc != 0 && rc != ETIMEDOUT)
+    return -1;
+  return stop;
+}
+
+static void* log_writer_main(void* arg) {
+  atomic_int* failed = arg;
+
+  for (u64 i = 0; i < MAX_LOG_WAKEUPS; i++) {
+    int stop = writer_wait();
+
+    if (writer_drain() != 0 || stop < 0)
+      atomic_store(failed, 1);
+    if (stop != 0)
       break;
   }
-  if (len != 0)
+  return NULL;
+}
+
+static int writer_signal(int stop) {
+  if (pthread_mutex_lock(&g_writer_lock) != 0)
     return -1;
-  return 0;
+  g_writer_kick = 1;
+  if (stop)
+    g_writer_stop = 1;
+
+  int rc = pthread_cond_signal(&g_writer_wake);
+
+  if (pthread_mutex_unlock(&g_writer_lock) != 0)
+    return -1;
+  return (rc == 0) ? 0 : -1;
 }
 
-int log_simple(const char* tag, const char* msg) {
-  if (!validate_ptr(tag))
+/* With the ring full, wakes the writer and waits for it to free a slot:
+ * at most LOG_FULL_WAIT_MS, or for as long as it takes when the config is
+ * lossless. Returns 1 once there is room and 0 if the wait timed out.
+ */
+static int ring_wait_room(size_t head) {
+  struct timespec deadline;
+
+  if (deadline_after(LOG_FULL_WAIT_MS, &deadline) != 0)
+    return -1;
+  if (pthread_mutex_lock(&g_writer_lock) != 0)
+    return -1;
+  atomic_store(&g_ring_waiting, 1);
+  g_writer_kick = 1;
+
+  int rc = pthread_cond_signal(&g_writer_wake);
+  int room = 0;
+
+  for (u64 i = 0; i < MAX_WAIT_LOOPS; i++) {
+    if (head - atomic_load(&g_ring_tail) < LOG_RING_EVENTS) {
+      room = 1;
+      break;
+    }
+    if (rc == ETIMEDOUT && g_log_config.lossless)
+      rc = deadline_after(LOG_FULL_WAIT_MS, &deadline);
+    if (rc != 0)
+      break;
+    rc = pthread_cond_timedwait(&g_ring_room, &g_writer_lock, &deadline);
+  }
+  atomic_store(&g_ring_waiting, 0);
+  if (pthread_mutex_unlock(&g_writer_lock) != 0)
     return -1;
-  if (!validate_ptr(msg))
+  if (rc != 0 && rc != ETIMEDOUT)
     return -1;
+  return room;
+}
+
+/* Wakes the writer whenever it sleeps with kick_at or more events queued.
+ * A full ring waits briefly for room (see ring_wait_room()); only if the
+ * writer is stuck, e.g. on a stalled disk, is the event dropped and counted,
+ * so the log cannot hold up a redraw for long.
+ */
+static int ring_push(const struct log_event* ev) {
+  size_t head = atomic_load_explicit(&g_ring_head, memory_order_relaxed);
+
+  if (head - atomic_load(&g_ring_tail) >= LOG_RING_EVENTS) {
+    int room = ring_wait_room(head);
+
+    if (room < 0)
+      return -1;
+    if (room == 0) {
+      g_ring_dropped++;
+      return 0;
+    }
+  }
+  g_ring[head % LOG_RING_EVENTS] = *ev;
+  atomic_store(&g_ring_head, head + 1);
+  if (ring_queued() >= ring_kick_at() && atomic_load(&g_writer_idle))
+    return writer_signal(0);
+  return 0;
+}
+
+static int level_of(u32 type) {
+  switch (type) {
+    case LOG_TYPE_ERROR:
+      return LOG_LEVEL_ERROR;
+    case LOG_TYPE_GROUP:
+    case LOG_TYPE_EXPIRED:
+    case LOG_TYPE_ITEMS:
+    case LOG_TYPE_SHUFFLE:
+      return LOG_LEVEL_GROUP;
+    case LOG_TYPE_PROMPT:
+      return LOG_LEVEL_PROMPT;
+    case LOG_TYPE_KEY:
+      return LOG_LEVEL_KEY;
+    default:
+      return LOG_LEVEL_SESSION;
+  }
+}
+
+/* Checked before any work is done for an event. */
+static int log_wanted(u32 type) {
+  int level = level_of(type);
+
   if (g_log_fd < 0)
     return 0;
-  return log_write(tag, msg);
+  return LOG_ENABLED(level) && level <= g_log_config.level;
 }
 
-int log_key(int key) {
-  if (!validate_ok(key >= 0))
+/* Stores are plain memory writes: no syscall and no wait for readers. */
+static void shared_publish(const struct LogRecord* rec) {
+  u64 seq = g_shared_next++;
+  struct LogRingSlot* slot = &g_shared_slots[seq % LOG_SHARED_SLOTS];
+  u64 words[LOG_RING_RECORD_WORDS];
+
+  memcpy(words, rec, sizeof(words));
+  atomic_store_explicit(&slot->seq, 2U * seq + 1U, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  for (size_t i = 0; i < LOG_RING_RECORD_WORDS; i++)
+    atomic_store_explicit(&slot->rec[i], words[i], memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, 2U * seq + 2U, memory_order_release);
+  atomic_store_explicit(&g_shared->head, seq + 1U, memory_order_release);
+}
+
+static int log_emit(struct log_event* ev) {
+  if (!assert_ok(g_log_fd >= 0))
     return -1;
-  if (!validate_ok(key <= 255))
+
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_REALTIME, &ts) != 0)
     return -1;
-  if (g_log_fd < 0)
+  ev->rec.time_ms =
+      (u64)ts.tv_sec * 1000ULL + (u64)(ts.tv_nsec / 1000000L);
+  if (g_shared)
+    shared_publish(&ev->rec);
+  if (g_log_async)
+    return ring_push(ev);
+  return write_event(ev);
+}
+
+static void event_init(struct log_event* ev, int type) {
+  memset(ev, 0, sizeof(*ev));
+  ev->rec.type = (u32)type;
+}
+
+int log_simple(int type) {
+  if (!validate_ok(logfmt_is_simple((u32)type)))
+    return -1;
+  if (!log_wanted((u32)type))
     return 0;
 
-  char msg[64];
-  int rc = snprintf(msg, sizeof(msg), "key=%d", key);
+  struct log_event ev;
 
-  if (!assert_ok(rc > 0))
+  event_init(&ev, type);
+  if (type == LOG_TYPE_START)
+    ev.rec.value = g_log_sid;
+  if (type == LOG_TYPE_EXIT)
+    ev.rec.value = g_ring_dropped;
+  return log_emit(&ev);
+}
+
+int log_key(int key) {
+  if (!validate_ok(key >= 0))
     return -1;
-  if (!assert_ok((size_t)rc < sizeof(msg)))
+  if (!validate_ok(key <= (int)MAX_KEY_CODE))
     return -1;
-  return log_write("key", msg);
+  if (!log_wanted(LOG_TYPE_KEY))
+    return 0;
+
+  struct log_event ev;
+
+  event_init(&ev, LOG_TYPE_KEY);
+  ev.rec.value = (u64)key;
+  return log_emit(&ev);
 }
 
 int log_prompt(
@@ -222,19 +797,18 @@ int log_prompt(
     return -1;
   if (!assert_ok(item_index < session->item_count))
     return -1;
-  if (!assert_ok(group_index < MAX_GROUPS))
+  if (!assert_ok(group_index < MAX_GROUPS_CAP))
     return -1;
-  if (!assert_ok(item_index < MAX_ITEMS_TOTAL))
+  if (!assert_ok(item_index < MAX_ITEMS_TOTAL_CAP))
     return -1;
-  if (g_log_fd < 0)
+  if (!log_wanted(LOG_TYPE_PROMPT))
     return 0;
 
   const struct Group* group = &session->groups[group_index];
   const struct Item* item = &session->items[item_index];
-  const char* buf = session->buffer;
-  u32 group_name_offset = group->name_offset;
+  u64 group_name_offset = group->name_offset;
   u32 group_name_length = group->name_length;
-  u32 item_offset = item->offset;
+  u64 item_offset = item->offset;
   u32 item_length = item->length;
 
   size_t group_name_end = (size_t)group_name_offset + (size_t)group_name_length;
@@ -247,151 +821,315 @@ int log_prompt(
   if (!assert_ok(item_end <= session->buffer_len))
     return -1;
 
-  const unsigned char* gname = (const unsigned char*)&buf[group_name_offset];
-  const unsigned char* ibytes = (const unsigned char*)&buf[item_offset];
+  /* Checksums were taken by the parser; see struct Item. */
+  struct log_event ev;
 
-  u32 gck = 0;
-  int rc = cksum_bytes(&gck, gname, (size_t)group_name_length);
-  if (rc != 0)
-    return -1;
-  u32 ick = 0;
-  rc = cksum_bytes(&ick, ibytes, (size_t)item_length);
-  if (rc != 0)
-    return -1;
+  event_init(&ev, LOG_TYPE_PROMPT);
+  ev.rec.group = (u32)group_index;
+  ev.rec.item = (u32)item_index;
+  ev.rec.gck = group->name_cksum;
+  ev.rec.glen = group_name_length;
+  ev.rec.ick = item->cksum;
+  ev.rec.ilen = item_length;
+  return log_emit(&ev);
+}
 
-  char msg[96];
-  rc = snprintf(msg,
-      sizeof(msg),
-      "group=%zu item=%zu gck=%u glen=%u ick=%u ilen=%u",
-      group_index,
-      item_index,
-      gck,
-      (unsigned int)group_name_length,
-      ick,
-      (unsigned int)item_length);
-  if (!assert_ok(rc > 0))
+int log_group(int type, size_t group_index) {
+  if (!validate_ok(type == LOG_TYPE_GROUP || type == LOG_TYPE_EXPIRED ||
+          type == LOG_TYPE_ITEMS))
     return -1;
-  if (!assert_ok((size_t)rc < sizeof(msg)))
+  if (!assert_ok(group_index < MAX_GROUPS_CAP))
     return -1;
-  return log_write("prompt", msg);
+  if (!log_wanted((u32)type))
+    return 0;
+
+  struct log_event ev;
+
+  event_init(&ev, type);
+  ev.rec.group = (u32)group_index;
+  return log_emit(&ev);
 }
 
-int log_group(const char* tag, size_t group_index) {
-  if (!validate_ptr(tag))
-    return -1;
-  if (!assert_ok(group_index < MAX_GROUPS))
+int log_input(const struct Session* session, const char* path) {
+  if (!validate_ptr(session))
     return -1;
-  if (g_log_fd < 0)
+  if (!log_wanted(LOG_TYPE_FILE))
     return 0;
+  size_t len = session->buffer_len;
+  const char* buf = session->text;
 
-  char msg[64];
-  int rc = snprintf(msg, sizeof(msg), "group=%zu", group_index);
-
-  if (!assert_ok(rc > 0))
+  if (!assert_ok(len <= MAX_DECK_BYTES))
     return -1;
-  if (!assert_ok((size_t)rc < sizeof(msg)))
+
+  u32 ck = session->cksum;
+  int rc = 0;
+
+  if (!session->have_cksum)
+    rc = cksum_bytes(&ck, (const unsigned char*)buf, len);
+  if (rc != 0)
     return -1;
-  return log_write(tag, msg);
+
+  struct log_event ev;
+
+  if (g_shared)
+    sanitize_abs_path(path, g_shared->path, sizeof(g_shared->path));
+  event_init(&ev, LOG_TYPE_FILE);
+  ev.path = path;
+  ev.rec.ick = ck;
+  ev.rec.value = (u64)len;
+  return log_emit(&ev);
 }
 
-int log_shuffle(const char* tag, size_t group_index) {
-  if (!validate_ptr(tag))
+int log_config_default(struct LogConfig* config) {
+  if (!assert_ptr(config))
     return -1;
-  if (!assert_ok(group_index < MAX_GROUPS))
-    return -1;
-  if (g_log_fd < 0)
+
+  config->async = 0;
+  config->format = LOG_FORMAT_TEXT;
+  config->level = LOG_LEVEL_MAX;
+  config->shard = 0;
+  config->ring = NULL;
+  config->flush = LOG_FLUSH_EXIT;
+  config->every = 0;
+  config->rotate = LOG_ROTATE_NONE;
+  config->rotate_every = 0;
+  config->lossless = 0;
+  return 0;
+}
+
+static int log_config_valid(const struct LogConfig* config) {
+  if (config->level < LOG_LEVEL_ERROR || config->level > LOG_LEVEL_MAX)
+    return 0;
+  if (config->format != LOG_FORMAT_TEXT && config->format != LOG_FORMAT_BINARY)
     return 0;
+  if (config->rotate == LOG_ROTATE_KIB &&
+      (config->rotate_every < 1 || config->rotate_every > LOG_ROTATE_KIB_CAP))
+    return 0;
+  if (config->rotate == LOG_ROTATE_SECS &&
+      (config->rotate_every < 1 || config->rotate_every > LOG_ROTATE_SECS_CAP))
+    return 0;
+  if (config->rotate != LOG_ROTATE_NONE && config->rotate != LOG_ROTATE_KIB &&
+      config->rotate != LOG_ROTATE_SECS)
+    return 0;
+  if (config->flush == LOG_FLUSH_EXIT)
+    return 1;
+  if (config->flush != LOG_FLUSH_EVENTS && config->flush != LOG_FLUSH_MS)
+    return 0;
+  return config->every >= 1 && config->every <= LOG_FLUSH_EVERY_CAP;
+}
 
-  char msg[64];
-  int rc = snprintf(msg, sizeof(msg), "group=%zu", group_index);
+/* cram.log, or cram.<pid>.log for a shard; binary logs end in .logb. */
+static int log_file_name(const struct LogConfig* config) {
+  const char* ext = (config->format == LOG_FORMAT_BINARY) ? "logb" : "log";
+  int rc = 0;
 
-  if (!assert_ok(rc > 0))
-    return -1;
-  if (!assert_ok((size_t)rc < sizeof(msg)))
+  if (config->shard) {
+    rc = snprintf(g_log_name,
+        sizeof(g_log_name),
+        "cram.%ld.%s",
+        (long)getpid(),
+        ext);
+  } else {
+    rc = snprintf(g_log_name, sizeof(g_log_name), "cram.%s", ext);
+  }
+  if (rc < 0 || (size_t)rc >= sizeof(g_log_name))
     return -1;
-  return log_write(tag, msg);
+  return 0;
 }
 
-int log_input(const struct Session* session, const char* path) {
-  if (!validate_ptr(session))
-    return -1;
-  if (g_log_fd < 0)
-    return 0;
-  size_t len = session->buffer_len;
-  const char* buf = session->buffer;
+static int new_session_id(void) {
+  struct Rng rng;
 
-  if (!assert_ok(len <= MAX_FILE_BYTES))
+  if (rng_init(&rng) != 0)
     return -1;
-  if (!assert_ok(buf[len] == '\0'))
+  g_log_sid = rng_next_u64(&rng);
+  if (g_log_sid == 0)
+    g_log_sid = 1;
+  return 0;
+}
+
+/* The ring is a plain file so readers can attach by name; /dev/shm keeps
+ * it off disk.
+ */
+static int shared_open(const char* path) {
+  size_t len = LOG_RING_HEADER_BYTES +
+      (size_t)LOG_SHARED_SLOTS * LOG_RING_SLOT_BYTES;
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0)
     return -1;
 
-  u32 ck = 0;
-  int rc = cksum_bytes(&ck, (const unsigned char*)buf, len);
-  if (rc != 0)
+  int rc = ftruncate(fd, (off_t)len);
+  void* base = MAP_FAILED;
+
+  if (rc == 0)
+    base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (close(fd) != 0 || base == MAP_FAILED) {
+    if (base != MAP_FAILED)
+      munmap(base, len);
     return -1;
+  }
+  g_shared = base;
+  g_shared_slots =
+      (struct LogRingSlot*)((char*)base + LOG_RING_HEADER_BYTES);
+  g_shared_next = 0;
+  return logfmt_ring_init(g_shared, (u64)getpid(), g_log_sid);
+}
 
-  char safe_path[192];
-  size_t have_path = sanitize_abs_path(path, safe_path, sizeof(safe_path));
+static int shared_close(void) {
+  if (!g_shared)
+    return 0;
 
-  char msg[256];
-  rc = 0;
+  size_t len = LOG_RING_HEADER_BYTES +
+      (size_t)LOG_SHARED_SLOTS * LOG_RING_SLOT_BYTES;
 
-  if (have_path) {
-    rc = snprintf(
-        msg, sizeof(msg), "cksum=%u len=%zu path=%s", ck, len, safe_path);
-  } else {
-    rc = snprintf(msg, sizeof(msg), "cksum=%u len=%zu", ck, len);
-  }
-  if (rc < 0 || (size_t)rc >= sizeof(msg))
+  atomic_store_explicit(&g_shared->closed, 1U, memory_order_release);
+
+  int rc = munmap(g_shared, len);
+
+  g_shared = NULL;
+  g_shared_slots = NULL;
+  return (rc == 0) ? 0 : -1;
+}
+
+/* Async mode falls back to direct writes if the writer cannot start. */
+static int start_writer(void) {
+  atomic_store(&g_ring_head, 0);
+  atomic_store(&g_ring_tail, 0);
+  atomic_store(&g_writer_failed, 0);
+  atomic_store(&g_writer_idle, 0);
+  atomic_store(&g_ring_waiting, 0);
+  g_ring_dropped = 0;
+  g_writer_kick = 0;
+  g_writer_stop = 0;
+
+  /* The writer starts with every signal blocked, so SIGTERM and SIGWINCH
+   * wait for the runner's signalfd instead of landing on this thread.
+   */
+  sigset_t all;
+  sigset_t saved;
+
+  if (sigfillset(&all) != 0)
     return -1;
-  return log_write("file", msg);
+  if (pthread_sigmask(SIG_SETMASK, &all, &saved) != 0)
+    return -1;
+  g_log_async =
+      (pthread_create(&g_writer, NULL, log_writer_main, &g_writer_failed) ==
+          0);
+  if (pthread_sigmask(SIG_SETMASK, &saved, NULL) != 0)
+    return -1;
+  return 0;
 }
 
-int log_open(const struct Session* session) {
+int log_open(const struct Session* session, const struct LogConfig* config) {
   if (!validate_ptr(session))
     return -1;
-  if (!assert_ok(session->group_count <= MAX_GROUPS))
+  if (!validate_ptr(config))
+    return -1;
+  if (!validate_ok(log_config_valid(config)))
+    return -1;
+  if (!assert_ok(session->group_count <= MAX_GROUPS_CAP))
     return -1;
-  if (!assert_ok(session->item_count <= MAX_ITEMS_TOTAL))
+  if (!assert_ok(session->item_count <= MAX_ITEMS_TOTAL_CAP))
     return -1;
 
-  g_log_fd = open("cram.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
+  g_log_config = *config;
+  g_log_unsynced = 0;
+  g_log_synced_ms = now_ms(CLOCK_MONOTONIC);
+  g_log_async = 0;
+  if (new_session_id() != 0)
+    return -1;
+  if (log_file_name(config) != 0)
+    return -1;
+
+  const char* name = g_log_name;
+
+  g_log_fd = open(name, O_RDWR | O_CREAT | O_APPEND, 0644);
   if (g_log_fd < 0) {
     const char* err = strerror(errno);
 
     if (!err)
       err = "unknown error";
-    char msg[256];
-    int rc = snprintf(
-        msg, sizeof(msg), "Warning: failed to open cram.log: %s\n", err);
-    if (rc < 0 || (size_t)rc >= sizeof(msg))
+    return log_warn(name, "failed to open", err);
+  }
+  if (config->format == LOG_FORMAT_BINARY && binary_prepare() != 0) {
+    int close_rc = close(g_log_fd);
+
+    g_log_fd = -1;
+    if (close_rc != 0)
       return -1;
-    int wrc = write_all_fd(STDERR_FILENO, msg, (size_t)rc);
+    return log_warn(name, "not logging to", "not a cram event log");
+  }
+  if (config->rotate != LOG_ROTATE_NONE && index_open() != 0)
+    return -1;
+  if (config->ring && shared_open(config->ring) != 0) {
+    const char* err = strerror(errno);
 
-    if (wrc != 0)
+    if (shared_close() != 0)
+      return -1;
+    if (log_warn(config->ring, "cannot create ring log", err) != 0)
       return -1;
-    return 0;
   }
-  return log_simple("start", "session started");
+  if ((config->async || g_shared) && start_writer() != 0)
+    return -1;
+  return log_simple(LOG_TYPE_START);
+}
+
+/* Stops the writer once it has written every queued event; later events
+ * are written directly.
+ */
+static int writer_stop(void) {
+  if (!g_log_async)
+    return 0;
+
+  int rc = 0;
+
+  if (writer_signal(1) != 0 || pthread_join(g_writer, NULL) != 0)
+    rc = -1;
+  if (atomic_load(&g_writer_failed))
+    rc = -1;
+  g_log_async = 0;
+  return rc;
+}
+
+/* Stops the writer, then syncs and closes the file. */
+static int log_finish(void) {
+  int rc = writer_stop();
+
+  if (fdatasync(g_log_fd) != 0 && errno != EINVAL)
+    rc = -1;
+  if (close(g_log_fd) != 0)
+    rc = -1;
+  if (index_close() != 0)
+    rc = -1;
+  if (shared_close() != 0)
+    rc = -1;
+  g_log_fd = -1;
+  return rc;
 }
 
 int log_close(const struct Session* session) {
   if (!validate_ptr(session))
     return -1;
-  if (!assert_ok(session->group_count <= MAX_GROUPS))
+  if (!assert_ok(session->group_count <= MAX_GROUPS_CAP))
     return -1;
-  if (!assert_ok(session->item_count <= MAX_ITEMS_TOTAL))
+  if (!assert_ok(session->item_count <= MAX_ITEMS_TOTAL_CAP))
     return -1;
   if (g_log_fd < 0)
     return 0;
 
-  int rc = log_simple("exit", "session end");
+  /* Written after the queue, so it lands even if the ring is full. */
+  int stop_rc = writer_stop();
+  int rc = log_simple(LOG_TYPE_EXIT);
+  int finish_rc = log_finish();
 
-  if (rc != 0)
+  if (stop_rc != 0 || rc != 0 || finish_rc != 0)
     return -1;
-  rc = close(g_log_fd);
-  if (rc != 0)
-    return -1;
-  g_log_fd = -1;
   return 0;
 }
+
+int log_abort(void) {
+  if (g_log_fd < 0)
+    return 0;
+  return log_finish();
+}
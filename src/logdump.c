@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: MIT
+/* cram-logdump: prints a binary event log (cram.logb) in the cram.log text
+ * format.
+ */
+#include "config.h"
+#include "logfmt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DUMP_OUT_BYTES (256U * 1024U)
+#define DUMP_LINE_BYTES 512U
+
+static struct LogRecord g_window[LOGDUMP_WINDOW_RECORDS];
+static char g_out[DUMP_OUT_BYTES];
+
+struct dump_state {
+  size_t out_len;
+  /* Shard logs: the session ID from the last start record. */
+  int shard;
+  u64 sid;
+  /* A file event waiting for `path_left` more path records. */
+  struct LogRecord file;
+  size_t path_left;
+  size_t path_len;
+  char path[LOG_PATH_BYTES + 1];
+};
+
+static int print_error(const char* path, const char* msg) {
+  int rc = fprintf(stderr, "Error: %s: %s\n", path, msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+/* Reads until len bytes or end of file; returns the count or -1. */
+static ssize_t read_full(int fd, void* buf, size_t len) {
+  size_t have = 0;
+
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (have >= len)
+      break;
+    ssize_t n = read(fd, (char*)buf + have, len - have);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    have += (size_t)n;
+  }
+  return (ssize_t)have;
+}
+
+static int write_all(const char* buf, size_t len) {
+  size_t done = 0;
+
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (done >= len)
+      break;
+    ssize_t n = write(STDOUT_FILENO, buf + done, len - done);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      return -1;
+    done += (size_t)n;
+  }
+  return (done == len) ? 0 : -1;
+}
+
+static int flush_out(struct dump_state* st) {
+  int rc = write_all(g_out, st->out_len);
+
+  st->out_len = 0;
+  return rc;
+}
+
+static int emit(struct dump_state* st, const struct LogRecord* rec) {
+  if (st->out_len + DUMP_LINE_BYTES > sizeof(g_out) && flush_out(st) != 0)
+    return -1;
+
+  const char* path = (rec->type == LOG_TYPE_FILE) ? st->path : NULL;
+
+  if (st->shard &&
+      (rec->type == LOG_TYPE_START || rec->type == LOG_TYPE_SEGMENT))
+    st->sid = rec->value;
+
+  size_t len = logfmt_text(rec,
+      path,
+      st->shard ? st->sid : 0,
+      g_out + st->out_len,
+      sizeof(g_out) - st->out_len);
+
+  if (len == 0)
+    return -1;
+  st->out_len += len;
+  return 0;
+}
+
+static int take_record(struct dump_state* st, const struct LogRecord* rec) {
+  if (st->path_left > 0) {
+    size_t room = sizeof(st->path) - 1 - st->path_len;
+    size_t n = (room < LOG_RECORD_BYTES) ? room : LOG_RECORD_BYTES;
+
+    memcpy(st->path + st->path_len, rec, n);
+    st->path_len += n;
+    st->path_left--;
+    if (st->path_left > 0)
+      return 0;
+    st->path[st->path_len] = '\0';
+    return emit(st, &st->file);
+  }
+  if (rec->type == LOG_TYPE_FILE && rec->extra > 0) {
+    if (rec->extra > LOG_PATH_BYTES / LOG_RECORD_BYTES)
+      return -1;
+    st->file = *rec;
+    st->path_left = rec->extra;
+    st->path_len = 0;
+    return 0;
+  }
+  st->path[0] = '\0';
+  return emit(st, rec);
+}
+
+static int dump_fd(int fd, const char* name) {
+  struct LogHeader header;
+
+  if (read_full(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) ||
+      logfmt_header_check(&header) != 0)
+    return print_error(name, "not a cram event log");
+
+  static struct dump_state st;
+  size_t record = 0;
+
+  memset(&st, 0, sizeof(st));
+  st.shard = (header.flags & LOG_FLAG_SHARD) != 0;
+  for (u64 w = 0; w < MAX_LOGDUMP_WINDOWS; w++) {
+    ssize_t n = read_full(fd, g_window, sizeof(g_window));
+
+    if (n < 0)
+      return print_error(name, strerror(errno));
+
+    size_t count = (size_t)n / LOG_RECORD_BYTES;
+
+    for (size_t i = 0; i < LOGDUMP_WINDOW_RECORDS; i++) {
+      if (i >= count)
+        break;
+      if (take_record(&st, &g_window[i]) != 0) {
+        char msg[64];
+        int rc =
+            snprintf(msg, sizeof(msg), "bad record %zu", record + i + 1);
+
+        if (rc < 0 || flush_out(&st) != 0)
+          return -1;
+        return print_error(name, msg);
+      }
+    }
+    record += count;
+    if ((size_t)n < sizeof(g_window)) {
+      if (flush_out(&st) != 0)
+        return print_error("stdout", strerror(errno));
+      if ((size_t)n % LOG_RECORD_BYTES != 0 || st.path_left > 0)
+        return print_error(name, "truncated record at end");
+      return 0;
+    }
+  }
+  return print_error(name, "too many records");
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2 || argv[1][0] == '\0' ||
+      (argv[1][0] == '-' && argv[1][1] != '\0')) {
+    int rc = fprintf(stderr, "Usage: cram-logdump <cram.logb | ->\n");
+
+    if (rc < 0)
+      return 1;
+    return 1;
+  }
+
+  const char* path = argv[1];
+  int fd = STDIN_FILENO;
+
+  if (strcmp(path, "-") != 0) {
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      print_error(path, strerror(errno));
+      return 1;
+    }
+  }
+
+  int rc = dump_fd(fd, path);
+
+  if (fd != STDIN_FILENO && close(fd) != 0)
+    rc = -1;
+  return (rc == 0) ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: MIT
+#include "logfmt.h"
+
+#include <string.h>
+
+#define LOG_MAGIC "CRAMLOG"
+#define LOG_RING_MAGIC "CRAMRNG"
+#define LOG_INDEX_MAGIC "CRAMIDX"
+#define LOG_BYTE_ORDER 0x01020304U
+
+/* Appends to a fixed buffer; full is set instead of overrunning it. */
+struct line_out {
+  char* buf;
+  size_t cap;
+  size_t len;
+  int full;
+};
+
+static void put_char(struct line_out* out, char ch) {
+  if (out->len + 1 >= out->cap) {
+    out->full = 1;
+    return;
+  }
+  out->buf[out->len++] = ch;
+}
+
+static void put_str(struct line_out* out, const char* text) {
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (text[i] == '\0')
+      break;
+    put_char(out, text[i]);
+  }
+}
+
+/* snprintf("%llu") without the format parsing; this runs once per record
+ * in cram-logdump.
+ */
+static void put_u64(struct line_out* out, u64 value) {
+  char digits[20];
+  size_t n = 0;
+
+  for (size_t i = 0; i < sizeof(digits); i++) {
+    digits[n++] = (char)('0' + value % 10U);
+    value /= 10U;
+    if (value == 0)
+      break;
+  }
+  for (size_t i = 0; i < sizeof(digits); i++) {
+    if (i >= n)
+      break;
+    put_char(out, digits[n - 1 - i]);
+  }
+}
+
+static void put_hex64(struct line_out* out, u64 value) {
+  for (int shift = 60; shift >= 0; shift -= 4)
+    put_char(out, "0123456789abcdef"[(value >> shift) & 0xFU]);
+}
+
+static void put_field(struct line_out* out, const char* name, u64 value) {
+  put_str(out, name);
+  put_char(out, '=');
+  put_u64(out, value);
+}
+
+const char* logfmt_tag(u32 type) {
+  switch (type) {
+    case LOG_TYPE_START:
+      return "start";
+    case LOG_TYPE_EXIT:
+      return "exit";
+    case LOG_TYPE_FILE:
+      return "file";
+    case LOG_TYPE_PROMPT:
+      return "prompt";
+    case LOG_TYPE_KEY:
+      return "key";
+    case LOG_TYPE_GROUP:
+      return "group";
+    case LOG_TYPE_EXPIRED:
+      return "expired";
+    case LOG_TYPE_ITEMS:
+      return "items";
+    case LOG_TYPE_SHUFFLE:
+      return "shuffle";
+    case LOG_TYPE_ERROR:
+      return "error";
+    case LOG_TYPE_SEGMENT:
+      return "segment";
+    default:
+      return NULL;
+  }
+}
+
+static const char* simple_text(u32 type) {
+  switch (type) {
+    case LOG_TYPE_START:
+      return "session started";
+    case LOG_TYPE_EXIT:
+      return "session end";
+    case LOG_TYPE_SHUFFLE:
+      return "groups";
+    case LOG_TYPE_ERROR:
+      return "wait loop exceeded";
+    case LOG_TYPE_SEGMENT:
+      return "log continued";
+    default:
+      return NULL;
+  }
+}
+
+int logfmt_is_simple(u32 type) {
+  return simple_text(type) != NULL;
+}
+
+int logfmt_header_init(struct LogHeader* header, u32 flags) {
+  if (!assert_ptr(header))
+    return -1;
+
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+  header->version = LOG_BINARY_VERSION;
+  header->record_bytes = LOG_RECORD_BYTES;
+  header->byte_order = LOG_BYTE_ORDER;
+  header->flags = flags;
+  return 0;
+}
+
+int logfmt_header_check(const struct LogHeader* header) {
+  if (!validate_ptr(header))
+    return -1;
+  if (memcmp(header->magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0)
+    return -1;
+  if (header->byte_order != LOG_BYTE_ORDER)
+    return -1;
+  if (header->version != LOG_BINARY_VERSION)
+    return -1;
+  if (header->record_bytes != LOG_RECORD_BYTES)
+    return -1;
+  if ((header->flags & ~LOG_FLAG_SHARD) != 0)
+    return -1;
+  return 0;
+}
+
+int logfmt_ring_init(struct LogRingHeader* header, u64 pid, u64 sid) {
+  if (!assert_ptr(header))
+    return -1;
+
+  memcpy(header->magic, LOG_RING_MAGIC, sizeof(LOG_RING_MAGIC));
+  header->version = LOG_RING_VERSION;
+  header->slot_count = LOG_SHARED_SLOTS;
+  header->slot_bytes = LOG_RING_SLOT_BYTES;
+  header->byte_order = LOG_BYTE_ORDER;
+  header->pid = pid;
+  header->sid = sid;
+  header->path[0] = '\0';
+  atomic_store_explicit(&header->closed, 0, memory_order_relaxed);
+  atomic_store_explicit(&header->head, 0, memory_order_release);
+  return 0;
+}
+
+int logfmt_ring_check(const struct LogRingHeader* header) {
+  if (!validate_ptr(header))
+    return -1;
+  if (memcmp(header->magic, LOG_RING_MAGIC, sizeof(LOG_RING_MAGIC)) != 0)
+    return -1;
+  if (header->byte_order != LOG_BYTE_ORDER)
+    return -1;
+  if (header->version != LOG_RING_VERSION)
+    return -1;
+  if (header->slot_count != LOG_SHARED_SLOTS)
+    return -1;
+  if (header->slot_bytes != LOG_RING_SLOT_BYTES)
+    return -1;
+  return 0;
+}
+
+int logfmt_index_init(struct LogIndexHeader* header) {
+  if (!assert_ptr(header))
+    return -1;
+
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, LOG_INDEX_MAGIC, sizeof(LOG_INDEX_MAGIC));
+  header->version = LOG_INDEX_VERSION;
+  header->entry_bytes = LOG_INDEX_ENTRY_BYTES;
+  header->byte_order = LOG_BYTE_ORDER;
+  return 0;
+}
+
+int logfmt_index_check(const struct LogIndexHeader* header) {
+  if (!validate_ptr(header))
+    return -1;
+  if (memcmp(header->magic, LOG_INDEX_MAGIC, sizeof(LOG_INDEX_MAGIC)) != 0)
+    return -1;
+  if (header->byte_order != LOG_BYTE_ORDER)
+    return -1;
+  if (header->version != LOG_INDEX_VERSION)
+    return -1;
+  if (header->entry_bytes != LOG_INDEX_ENTRY_BYTES)
+    return -1;
+  return 0;
+}
+
+size_t logfmt_text(const struct LogRecord* rec,
+    const char* path,
+    u64 sid,
+    char* line,
+    size_t len) {
+  if (!validate_ptr(rec))
+    return 0;
+  if (!validate_ptr(line))
+    return 0;
+
+  const char* tag = logfmt_tag(rec->type);
+
+  if (!tag)
+    return 0;
+
+  struct line_out out = {line, len, 0, 0};
+  u64 ms = rec->time_ms % 1000U;
+
+  put_u64(&out, rec->time_ms / 1000U);
+  put_char(&out, '.');
+  put_char(&out, (char)('0' + ms / 100U));
+  put_char(&out, (char)('0' + ms / 10U % 10U));
+  put_char(&out, (char)('0' + ms % 10U));
+  if (sid != 0) {
+    put_char(&out, ' ');
+    put_hex64(&out, sid);
+  }
+  put_str(&out, " [");
+  put_str(&out, tag);
+  put_str(&out, "] ");
+  switch (rec->type) {
+    case LOG_TYPE_FILE:
+      put_field(&out, "cksum", rec->ick);
+      put_field(&out, " len", rec->value);
+      if (path && path[0] != '\0') {
+        put_str(&out, " path=");
+        put_str(&out, path);
+      }
+      break;
+    case LOG_TYPE_PROMPT:
+      put_field(&out, "group", rec->group);
+      put_field(&out, " item", rec->item);
+      put_field(&out, " gck", rec->gck);
+      put_field(&out, " glen", rec->glen);
+      put_field(&out, " ick", rec->ick);
+      put_field(&out, " ilen", rec->ilen);
+      break;
+    case LOG_TYPE_KEY:
+      put_field(&out, "key", rec->value);
+      break;
+    case LOG_TYPE_GROUP:
+    case LOG_TYPE_EXPIRED:
+    case LOG_TYPE_ITEMS:
+      put_field(&out, "group", rec->group);
+      break;
+    case LOG_TYPE_EXIT:
+      put_str(&out, simple_text(rec->type));
+      if (rec->value != 0)
+        put_field(&out, " dropped", rec->value);
+      break;
+    default:
+      put_str(&out, simple_text(rec->type));
+      break;
+  }
+  put_char(&out, '\n');
+  if (out.full)
+    return 0;
+  out.buf[out.len] = '\0';
+  return out.len;
+}
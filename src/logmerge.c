@@ -0,0 +1,250 @@
+// SPDX-License-Identifier: MIT
+/* cram-logmerge: merges text log shards (cram.<pid>.log) into one stream
+ * ordered by timestamp. Each shard is mapped read-only and the lines are
+ * written straight from the mappings with writev().
+ */
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define MERGE_IOV_BATCH 1024U
+
+struct shard {
+  const char* base;
+  size_t len;
+  /* Start of the next line not yet written. */
+  size_t pos;
+  /* Timestamp of that line in milliseconds. */
+  u64 key;
+};
+
+static struct shard g_shards[MAX_MERGE_SHARDS];
+/* Min-heap of shard indexes ordered by (key, index), so equal timestamps
+ * keep the order the shards were named in.
+ */
+static size_t g_heap[MAX_MERGE_SHARDS];
+static size_t g_heap_len;
+static struct iovec g_iov[MERGE_IOV_BATCH];
+static size_t g_iov_len;
+
+static int print_error(const char* name, const char* msg) {
+  int rc = fprintf(stderr, "Error: %s: %s\n", name, msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+/* "<sec>.<ms> ..." to milliseconds. A line without a timestamp keeps the
+ * previous key, so it stays next to the line before it.
+ */
+static void read_key(struct shard* sh) {
+  const char* p = sh->base + sh->pos;
+  size_t left = sh->len - sh->pos;
+  u64 sec = 0;
+  size_t i = 0;
+
+  for (; i < 20; i++) {
+    if (i >= left || p[i] < '0' || p[i] > '9')
+      break;
+    sec = sec * 10U + (u64)(p[i] - '0');
+  }
+  if (i == 0 || i + 4 > left || p[i] != '.')
+    return;
+
+  u64 ms = 0;
+
+  for (size_t j = 1; j <= 3; j++) {
+    if (p[i + j] < '0' || p[i + j] > '9')
+      return;
+    ms = ms * 10U + (u64)(p[i + j] - '0');
+  }
+  sh->key = sec * 1000U + ms;
+}
+
+static int shard_before(size_t a, size_t b) {
+  if (g_shards[a].key != g_shards[b].key)
+    return g_shards[a].key < g_shards[b].key;
+  return a < b;
+}
+
+static void sift_down(size_t at) {
+  for (size_t depth = 0; depth < 64; depth++) {
+    size_t best = at;
+    size_t left = 2 * at + 1;
+    size_t right = left + 1;
+
+    if (left < g_heap_len && shard_before(g_heap[left], g_heap[best]))
+      best = left;
+    if (right < g_heap_len && shard_before(g_heap[right], g_heap[best]))
+      best = right;
+    if (best == at)
+      break;
+
+    size_t tmp = g_heap[at];
+
+    g_heap[at] = g_heap[best];
+    g_heap[best] = tmp;
+    at = best;
+  }
+}
+
+static int flush_iov(void) {
+  size_t first = 0;
+
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (first >= g_iov_len)
+      break;
+    ssize_t n = writev(STDOUT_FILENO, &g_iov[first], (int)(g_iov_len - first));
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      return -1;
+
+    size_t done = (size_t)n;
+
+    for (size_t j = 0; j < MERGE_IOV_BATCH; j++) {
+      if (first >= g_iov_len || done < g_iov[first].iov_len)
+        break;
+      done -= g_iov[first].iov_len;
+      first++;
+    }
+    if (first < g_iov_len) {
+      g_iov[first].iov_base = (char*)g_iov[first].iov_base + done;
+      g_iov[first].iov_len -= done;
+    }
+  }
+  if (first < g_iov_len)
+    return -1;
+  g_iov_len = 0;
+  return 0;
+}
+
+static int put_iov(const char* buf, size_t len) {
+  if (g_iov_len == MERGE_IOV_BATCH && flush_iov() != 0)
+    return -1;
+  g_iov[g_iov_len].iov_base = (void*)buf;
+  g_iov[g_iov_len].iov_len = len;
+  g_iov_len++;
+  return 0;
+}
+
+/* Writes lines from the shard at the top of the heap for as long as they
+ * sort before every other shard's next line.
+ */
+static int write_run(size_t top) {
+  struct shard* sh = &g_shards[top];
+  size_t next = SIZE_MAX;
+  size_t start = sh->pos;
+
+  if (g_heap_len > 1)
+    next = g_heap[1];
+  if (g_heap_len > 2 && shard_before(g_heap[2], next))
+    next = g_heap[2];
+  for (u64 i = 0; i < MAX_MERGE_STEPS; i++) {
+    const char* nl = memchr(sh->base + sh->pos, '\n', sh->len - sh->pos);
+
+    sh->pos = nl ? (size_t)(nl - sh->base) + 1 : sh->len;
+    if (sh->pos >= sh->len)
+      break;
+    read_key(sh);
+    if (next != SIZE_MAX && !shard_before(top, next))
+      break;
+  }
+  if (put_iov(sh->base + start, sh->pos - start) != 0)
+    return -1;
+  if (sh->base[sh->pos - 1] != '\n')
+    return put_iov("\n", 1);
+  return 0;
+}
+
+static int map_shard(const char* name, struct shard* sh) {
+  int fd = open(name, O_RDONLY);
+
+  if (fd < 0)
+    return print_error(name, strerror(errno));
+
+  struct stat st;
+  int rc = fstat(fd, &st);
+
+  if (rc == 0 && !S_ISREG(st.st_mode)) {
+    close(fd);
+    return print_error(name, "not a regular file");
+  }
+  if (rc == 0 && st.st_size > 0) {
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (base == MAP_FAILED) {
+      rc = -1;
+    } else {
+      sh->base = base;
+      sh->len = (size_t)st.st_size;
+      posix_madvise(base, sh->len, POSIX_MADV_SEQUENTIAL);
+    }
+  }
+  if (close(fd) != 0 || rc != 0)
+    return print_error(name, strerror(errno));
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2 || (size_t)argc - 1 > MAX_MERGE_SHARDS) {
+    int rc = fprintf(stderr,
+        "Usage: cram-logmerge <shard> [shard ...] (at most %u)\n",
+        MAX_MERGE_SHARDS);
+
+    if (rc < 0)
+      return 1;
+    return 1;
+  }
+
+  size_t count = (size_t)argc - 1;
+
+  for (size_t i = 0; i < MAX_MERGE_SHARDS; i++) {
+    if (i >= count)
+      break;
+    if (map_shard(argv[i + 1], &g_shards[i]) != 0)
+      return 1;
+    if (g_shards[i].len == 0)
+      continue;
+    read_key(&g_shards[i]);
+    g_heap[g_heap_len++] = i;
+  }
+  for (size_t i = g_heap_len / 2; i > 0; i--)
+    sift_down(i - 1);
+
+  for (u64 step = 0; step < MAX_MERGE_STEPS; step++) {
+    if (g_heap_len == 0)
+      break;
+
+    size_t top = g_heap[0];
+
+    if (write_run(top) != 0) {
+      print_error("stdout", strerror(errno));
+      return 1;
+    }
+    if (g_shards[top].pos >= g_shards[top].len)
+      g_heap[0] = g_heap[--g_heap_len];
+    sift_down(0);
+  }
+  if (g_heap_len != 0) {
+    print_error("stdout", "too many lines");
+    return 1;
+  }
+  if (flush_iov() != 0) {
+    print_error("stdout", strerror(errno));
+    return 1;
+  }
+  return 0;
+}
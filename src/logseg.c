@@ -0,0 +1,495 @@
+// SPDX-License-Identifier: MIT
+#include "logseg.h"
+#include "logfmt.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A mapped segment and, if it has a usable one, its mapped index. */
+struct segment {
+  const char* buf;
+  size_t len;
+  const char* index_buf;
+  size_t index_len;
+  const struct LogIndexEntry* index;
+  size_t entry_count;
+  int binary;
+  /* Offset of the first event: past the header in a binary log. */
+  size_t data_start;
+};
+
+/* Closed segment numbers, oldest first; the active segment follows them. */
+static u32 g_numbers[MAX_LOG_SEGMENTS];
+static int g_present[MAX_LOG_SEGMENTS + 1];
+/* Time of a segment's first event, when its index records it. */
+static u64 g_first_ms[MAX_LOG_SEGMENTS + 1];
+static int g_first_known[MAX_LOG_SEGMENTS + 1];
+
+static int set_error(char* err_buf, size_t err_len, const char* msg) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ptr(msg))
+    return -1;
+
+  int rc = snprintf(err_buf, err_len, "%s", msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+int logseg_name(
+    const char* base, u32 number, const char* suffix, char* out, size_t len) {
+  if (!validate_ptr(base))
+    return -1;
+  if (!validate_ptr(suffix))
+    return -1;
+  if (!validate_ptr(out))
+    return -1;
+
+  int rc = 0;
+
+  if (number == 0)
+    rc = snprintf(out, len, "%s%s", base, suffix);
+  else
+    rc = snprintf(out, len, "%s.%u%s", base, number, suffix);
+  if (rc < 0 || (size_t)rc >= len)
+    return -1;
+  return 0;
+}
+
+/* The directory to list, and the file name within it. */
+static int split_base(
+    const char* base, char* dir, size_t dir_len, const char** file) {
+  const char* slash = strrchr(base, '/');
+
+  if (!slash) {
+    *file = base;
+    return (snprintf(dir, dir_len, ".") == 1) ? 0 : -1;
+  }
+
+  size_t len = (size_t)(slash - base);
+
+  if (len == 0)
+    len = 1;
+  if (len >= dir_len)
+    return -1;
+  memcpy(dir, base, len);
+  dir[len] = '\0';
+  *file = slash + 1;
+  return 0;
+}
+
+/* Matches "<file>.<n>" with n a positive decimal number. */
+static int segment_number(const char* file, const char* name, u32* number) {
+  size_t file_len = strlen(file);
+
+  if (strncmp(name, file, file_len) != 0 || name[file_len] != '.')
+    return -1;
+
+  const char* digits = name + file_len + 1;
+  u32 value = 0;
+  size_t i = 0;
+
+  for (; i < 10; i++) {
+    if (digits[i] < '0' || digits[i] > '9')
+      break;
+    value = value * 10U + (u32)(digits[i] - '0');
+  }
+  if (i == 0 || i > 9 || digits[i] != '\0' || value == 0)
+    return -1;
+  *number = value;
+  return 0;
+}
+
+/* Finds base's closed segments; with numbers, also stores them in order.
+ * Returns how many there are, or -1.
+ */
+static long list_segments(
+    const char* base, u32* numbers, size_t max, u32* last) {
+  char dir[MAX_PATH_LEN];
+  const char* file = NULL;
+
+  *last = 0;
+  if (split_base(base, dir, sizeof(dir), &file) != 0)
+    return -1;
+
+  DIR* d = opendir(dir);
+
+  if (!d)
+    return -1;
+
+  size_t count = 0;
+  int rc = 0;
+
+  for (u64 i = 0; i < MAX_DIR_ENTRIES; i++) {
+    errno = 0;
+
+    struct dirent* ent = readdir(d);
+
+    if (!ent) {
+      if (errno != 0)
+        rc = -1;
+      break;
+    }
+
+    u32 number = 0;
+
+    if (segment_number(file, ent->d_name, &number) != 0)
+      continue;
+    if (number > *last)
+      *last = number;
+    if (!numbers)
+      continue;
+    if (count >= max) {
+      rc = -1;
+      break;
+    }
+
+    size_t at = count;
+
+    for (size_t k = 0; k < MAX_LOG_SEGMENTS; k++) {
+      if (at == 0 || numbers[at - 1] < number)
+        break;
+      numbers[at] = numbers[at - 1];
+      at--;
+    }
+    numbers[at] = number;
+    count++;
+  }
+  if (closedir(d) != 0)
+    rc = -1;
+  return (rc == 0) ? (long)count : -1;
+}
+
+long logseg_last(const char* base) {
+  if (!validate_ptr(base))
+    return -1;
+
+  u32 last = 0;
+
+  if (list_segments(base, NULL, 0, &last) < 0)
+    return -1;
+  return (long)last;
+}
+
+/* Returns 0 with the file mapped, 1 if it does not exist, -1 on error. */
+static int map_file(const char* name, const char** buf, size_t* len) {
+  int fd = open(name, O_RDONLY);
+
+  *buf = "";
+  *len = 0;
+  if (fd < 0)
+    return (errno == ENOENT) ? 1 : -1;
+
+  struct stat st;
+  int rc = fstat(fd, &st);
+
+  if (rc == 0 && !S_ISREG(st.st_mode))
+    rc = -1;
+  if (rc == 0 && st.st_size > 0) {
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (base == MAP_FAILED) {
+      rc = -1;
+    } else {
+      *buf = base;
+      *len = (size_t)st.st_size;
+    }
+  }
+  if (close(fd) != 0)
+    rc = -1;
+  return rc;
+}
+
+static void unmap_file(const char* buf, size_t len) {
+  if (len > 0)
+    munmap((void*)buf, len);
+}
+
+static void segment_close(struct segment* seg) {
+  unmap_file(seg->buf, seg->len);
+  unmap_file(seg->index_buf, seg->index_len);
+  memset(seg, 0, sizeof(*seg));
+}
+
+/* Returns 0 with the segment mapped, 1 if it does not exist, -1 on error.
+ * A missing or foreign index only means the segment is read from the
+ * start.
+ */
+static int segment_open(const char* base, u32 number, struct segment* seg) {
+  char name[MAX_PATH_LEN];
+
+  memset(seg, 0, sizeof(*seg));
+  if (logseg_name(base, number, "", name, sizeof(name)) != 0)
+    return -1;
+
+  int rc = map_file(name, &seg->buf, &seg->len);
+
+  if (rc != 0)
+    return rc;
+  seg->binary = seg->len >= LOG_HEADER_BYTES &&
+      logfmt_header_check((const struct LogHeader*)seg->buf) == 0;
+  seg->data_start = seg->binary ? LOG_HEADER_BYTES : 0;
+  if (logseg_name(base, number, ".idx", name, sizeof(name)) != 0)
+    return 0;
+  if (map_file(name, &seg->index_buf, &seg->index_len) != 0)
+    return 0;
+  if (seg->index_len < LOG_INDEX_HEADER_BYTES ||
+      logfmt_index_check((const struct LogIndexHeader*)seg->index_buf) != 0) {
+    unmap_file(seg->index_buf, seg->index_len);
+    seg->index_buf = NULL;
+    seg->index_len = 0;
+    return 0;
+  }
+  seg->index = (const struct LogIndexEntry*)(seg->index_buf +
+      LOG_INDEX_HEADER_BYTES);
+  seg->entry_count =
+      (seg->index_len - LOG_INDEX_HEADER_BYTES) / LOG_INDEX_ENTRY_BYTES;
+  return 0;
+}
+
+static int entry_valid(
+    const struct segment* seg, const struct LogIndexEntry* entry) {
+  if (entry->offset < seg->data_start || entry->offset > seg->len)
+    return 0;
+  if (seg->binary &&
+      (entry->offset - seg->data_start) % LOG_RECORD_BYTES != 0)
+    return 0;
+  return 1;
+}
+
+/* "<sec>.<ms> ..." to milliseconds; other lines keep *time_ms. */
+static void line_time(const char* p, size_t left, u64* time_ms) {
+  u64 sec = 0;
+  size_t i = 0;
+
+  for (; i < 20; i++) {
+    if (i >= left || p[i] < '0' || p[i] > '9')
+      break;
+    sec = sec * 10U + (u64)(p[i] - '0');
+  }
+  if (i == 0 || i + 4 > left || p[i] != '.')
+    return;
+
+  u64 ms = 0;
+
+  for (size_t j = 1; j <= 3; j++) {
+    if (p[i + j] < '0' || p[i + j] > '9')
+      return;
+    ms = ms * 10U + (u64)(p[i + j] - '0');
+  }
+  *time_ms = sec * 1000U + ms;
+}
+
+/* Reads the time of the event at pos; returns where the next one starts. */
+static size_t next_event(const struct segment* seg, size_t pos, u64* time_ms) {
+  if (!seg->binary) {
+    const char* nl = memchr(seg->buf + pos, '\n', seg->len - pos);
+
+    line_time(seg->buf + pos, seg->len - pos, time_ms);
+    return nl ? (size_t)(nl - seg->buf) + 1 : seg->len;
+  }
+  if (seg->len - pos < LOG_RECORD_BYTES)
+    return seg->len;
+
+  struct LogRecord rec;
+  size_t extra = 0;
+
+  memcpy(&rec, seg->buf + pos, sizeof(rec));
+  *time_ms = rec.time_ms;
+  if (rec.type == LOG_TYPE_FILE &&
+      rec.extra <= LOG_PATH_BYTES / LOG_RECORD_BYTES)
+    extra = rec.extra;
+
+  size_t end = pos + (1U + extra) * LOG_RECORD_BYTES;
+
+  return (end < seg->len) ? end : seg->len;
+}
+
+/* The offset of the last indexed event before from_ms; every event ahead
+ * of it is older still.
+ */
+static size_t seek_start(const struct segment* seg, u64 from_ms) {
+  size_t lo = 0;
+  size_t hi = seg->entry_count;
+
+  for (size_t i = 0; i < 64; i++) {
+    if (lo >= hi)
+      break;
+
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (seg->index[mid].time_ms < from_ms)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  size_t pos = seg->data_start;
+
+  if (lo > 0 && entry_valid(seg, &seg->index[lo - 1]))
+    pos = (size_t)seg->index[lo - 1].offset;
+  if (!seg->binary && pos > 0 && seg->buf[pos - 1] != '\n') {
+    const char* nl = memchr(seg->buf + pos, '\n', seg->len - pos);
+
+    pos = nl ? (size_t)(nl - seg->buf) + 1 : seg->len;
+  }
+  return pos;
+}
+
+static int write_out(const char* buf, size_t len) {
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (len == 0)
+      break;
+    ssize_t n = write(STDOUT_FILENO, buf, len);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      return -1;
+    buf += (size_t)n;
+    len -= (size_t)n;
+  }
+  return (len == 0) ? 0 : -1;
+}
+
+/* Writes the segment's events in [from_ms, to_ms), which are contiguous.
+ * Returns 1 once an event at or after to_ms was seen, 0 if the segment
+ * ended first, -1 on a write error.
+ */
+static int write_window(const struct segment* seg, u64 from_ms, u64 to_ms) {
+  size_t pos = seek_start(seg, from_ms);
+  size_t begin = seg->len;
+  size_t end = seg->len;
+  u64 time_ms = 0;
+  int done = 0;
+
+  for (u64 i = 0; i < MAX_RANGE_EVENTS; i++) {
+    if (pos >= seg->len)
+      break;
+
+    size_t next = next_event(seg, pos, &time_ms);
+
+    if (time_ms >= to_ms) {
+      end = pos;
+      done = 1;
+      break;
+    }
+    if (time_ms >= from_ms && begin == seg->len)
+      begin = pos;
+    pos = next;
+  }
+  if (begin >= end)
+    return done;
+  if (write_out(seg->buf + begin, end - begin) != 0)
+    return -1;
+  if (!seg->binary && seg->buf[end - 1] != '\n' && write_out("\n", 1) != 0)
+    return -1;
+  return done;
+}
+
+/* Notes which segments exist and when each starts; binary logs also give
+ * the header to copy to the output.
+ */
+static int survey(
+    const char* base, size_t total, struct LogHeader* header, int* binary) {
+  int found = 0;
+
+  *binary = 0;
+  for (size_t k = 0; k <= MAX_LOG_SEGMENTS; k++) {
+    if (k >= total)
+      break;
+
+    struct segment seg;
+    u32 number = (k + 1 < total) ? g_numbers[k] : 0;
+    int rc = segment_open(base, number, &seg);
+
+    g_present[k] = (rc == 0);
+    g_first_known[k] = 0;
+    if (rc < 0)
+      return -1;
+    if (rc > 0)
+      continue;
+    found = 1;
+    if (seg.entry_count > 0 && seg.index[0].offset == seg.data_start) {
+      g_first_ms[k] = seg.index[0].time_ms;
+      g_first_known[k] = 1;
+    }
+    if (seg.binary && !*binary) {
+      memcpy(header, seg.buf, sizeof(*header));
+      *binary = 1;
+    }
+    segment_close(&seg);
+  }
+  return found ? 0 : 1;
+}
+
+int logseg_range(const char* base,
+    u64 from_ms,
+    u64 to_ms,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(base))
+    return -1;
+
+  u32 last = 0;
+  long closed = list_segments(base, g_numbers, MAX_LOG_SEGMENTS, &last);
+
+  if (closed < 0)
+    return set_error(err_buf, err_len, "cannot list log segments");
+
+  size_t total = (size_t)closed + 1;
+  struct LogHeader header;
+  int binary = 0;
+  int rc = survey(base, total, &header, &binary);
+
+  if (rc < 0)
+    return set_error(err_buf, err_len, strerror(errno));
+  if (rc > 0)
+    return set_error(err_buf, err_len, strerror(ENOENT));
+  if (binary && write_out((const char*)&header, sizeof(header)) != 0)
+    return set_error(err_buf, err_len, "cannot write to stdout");
+  for (size_t k = 0; k <= MAX_LOG_SEGMENTS; k++) {
+    if (k >= total)
+      break;
+    if (!g_present[k])
+      continue;
+    if (g_first_known[k] && g_first_ms[k] >= to_ms)
+      break;
+
+    /* Every event of segment k is no later than the next one's first. */
+    size_t next = k + 1;
+
+    for (size_t j = 0; j <= MAX_LOG_SEGMENTS; j++) {
+      if (next >= total || g_present[next])
+        break;
+      next++;
+    }
+    if (next < total && g_first_known[next] && g_first_ms[next] < from_ms)
+      continue;
+
+    struct segment seg;
+
+    if (segment_open(base, (k + 1 < total) ? g_numbers[k] : 0, &seg) != 0)
+      return set_error(err_buf, err_len, "log segment disappeared");
+    rc = write_window(&seg, from_ms, to_ms);
+    segment_close(&seg);
+    if (rc < 0)
+      return set_error(err_buf, err_len, "cannot write to stdout");
+    if (rc > 0)
+      break;
+  }
+  return 0;
+}
@@ -0,0 +1,419 @@
+// SPDX-License-Identifier: MIT
+#include "metrics.h"
+#include "hist.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Connections answered per wakeup; more wait for the next one. */
+#define METRICS_ACCEPTS 8U
+#define METRICS_BACKLOG 8
+/* A response goes out in pieces of this size. */
+#define METRICS_OUT_BYTES 4096U
+/* Room left for the next line before a piece is sent. */
+#define METRICS_LINE_BYTES 256U
+/* Histograms list one le boundary per power of two of nanoseconds, from
+ * about a microsecond to about 69 seconds, whatever they hold.
+ */
+#define METRICS_LE_MIN_EXP 10U
+#define METRICS_LE_MAX_EXP 36U
+
+enum {
+  static_assert_metrics_line_bytes =
+      1 / ((METRICS_LINE_BYTES < METRICS_OUT_BYTES) ? 1 : 0),
+  static_assert_metrics_le_min_exp = 1 / ((METRICS_LE_MIN_EXP >= 4U) ? 1 : 0),
+  static_assert_metrics_le_max_exp =
+      1 / ((METRICS_LE_MAX_EXP >= METRICS_LE_MIN_EXP) ? 1 : 0),
+  static_assert_metrics_le_max_exp_u64 =
+      1 / ((METRICS_LE_MAX_EXP < 64U) ? 1 : 0),
+};
+
+struct metric_buckets {
+  atomic_ullong sum;
+  atomic_ullong buckets[HIST_BUCKETS];
+};
+
+struct metric_info {
+  const char* name;
+  const char* help;
+};
+
+static const struct metric_info counter_info[METRIC_COUNTERS] = {
+    {"cram_prompts_total", "Prompts shown."},
+    {"cram_shuffles_total", "Group and item orders shuffled."},
+    {"cram_group_expiries_total", "Groups whose time ran out."},
+    {"cram_keys_total", "Keys read."},
+};
+
+static const struct metric_info hist_info[METRIC_HISTS] = {
+    {"cram_key_to_draw_seconds",
+        "From waking up to a key batch to the end of its frame."},
+    {"cram_log_write_seconds", "One write of log lines and its sync."},
+    {"cram_shuffle_seconds", "One group or item order shuffle."},
+};
+
+struct metrics_out {
+  int fd;
+  size_t len;
+  char buf[METRICS_OUT_BYTES];
+};
+
+static atomic_int g_metrics_on;
+static atomic_ullong g_counters[METRIC_COUNTERS];
+static struct metric_buckets g_hists[METRIC_HISTS];
+static int g_metrics_fd = -1;
+static struct sockaddr_un g_metrics_addr;
+/* Responses are built one at a time, a piece at a time. */
+static struct metrics_out g_out;
+
+static int set_error(char* err_buf, size_t err_len, const char* msg) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ptr(msg))
+    return -1;
+
+  const char* err = strerror(errno);
+
+  if (!err)
+    err = "unknown error";
+
+  int rc = snprintf(err_buf,
+      err_len,
+      "%s: %s: %s",
+      msg,
+      g_metrics_addr.sun_path,
+      err);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+static u64 now_ns(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+static int set_path(const char* path) {
+  const char* dir = getenv("XDG_RUNTIME_DIR");
+  size_t cap = sizeof(g_metrics_addr.sun_path);
+  int rc = 0;
+
+  if (!dir || dir[0] == '\0')
+    dir = "/tmp";
+  if (path)
+    rc = snprintf(g_metrics_addr.sun_path, cap, "%s", path);
+  else
+    rc = snprintf(g_metrics_addr.sun_path,
+        cap,
+        "%s/cram.%ld.sock",
+        dir,
+        (long)getpid());
+  if (rc < 0 || (size_t)rc >= cap) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  return 0;
+}
+
+static int set_flags(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
+    return -1;
+  return fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+int metrics_open(
+    const char* path, int* out_fd, char* err_buf, size_t err_len) {
+  if (!validate_ptr(out_fd))
+    return -1;
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ok(g_metrics_fd < 0))
+    return -1;
+
+  memset(&g_metrics_addr, 0, sizeof(g_metrics_addr));
+  g_metrics_addr.sun_family = AF_UNIX;
+  if (set_path(path) != 0)
+    return set_error(err_buf, err_len, "Metrics socket path too long");
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0)
+    return set_error(err_buf, err_len, "Failed to create metrics socket");
+
+  const char* what = NULL;
+  int bound = 0;
+
+  if (set_flags(fd) != 0)
+    what = "Failed to set up metrics socket";
+  if (!what && bind(fd,
+                   (const struct sockaddr*)&g_metrics_addr,
+                   sizeof(g_metrics_addr)) != 0)
+    what = "Failed to bind metrics socket";
+  bound = !what;
+  /* Nobody can connect before listen(), so the mode is set in time. */
+  if (!what && chmod(g_metrics_addr.sun_path, 0600) != 0)
+    what = "Failed to restrict metrics socket";
+  if (!what && listen(fd, METRICS_BACKLOG) != 0)
+    what = "Failed to listen on metrics socket";
+  if (what) {
+    int rc = set_error(err_buf, err_len, what);
+
+    if (bound && unlink(g_metrics_addr.sun_path) != 0)
+      rc = -1;
+    if (close(fd) != 0)
+      return -1;
+    return rc;
+  }
+  g_metrics_fd = fd;
+  atomic_store_explicit(&g_metrics_on, 1, memory_order_relaxed);
+  *out_fd = fd;
+  return 0;
+}
+
+int metrics_close(void) {
+  if (g_metrics_fd < 0)
+    return 0;
+
+  int rc = 0;
+
+  atomic_store_explicit(&g_metrics_on, 0, memory_order_relaxed);
+  if (unlink(g_metrics_addr.sun_path) != 0)
+    rc = -1;
+  if (close(g_metrics_fd) != 0)
+    rc = -1;
+  g_metrics_fd = -1;
+  return rc;
+}
+
+int metrics_count(int counter) {
+  if (!assert_ok(counter >= 0 && counter < METRIC_COUNTERS))
+    return -1;
+  if (!atomic_load_explicit(&g_metrics_on, memory_order_relaxed))
+    return 0;
+
+  atomic_fetch_add_explicit(&g_counters[counter], 1, memory_order_relaxed);
+  return 0;
+}
+
+u64 metrics_start(void) {
+  if (!atomic_load_explicit(&g_metrics_on, memory_order_relaxed))
+    return 0;
+  return now_ns();
+}
+
+int metrics_observe(int hist, u64 start) {
+  if (!assert_ok(hist >= 0 && hist < METRIC_HISTS))
+    return -1;
+  if (start == 0)
+    return 0;
+
+  u64 now = now_ns();
+  u64 ns = (now > start) ? now - start : 0;
+  size_t bucket = hist_bucket(ns);
+
+  if (!assert_ok(bucket < HIST_BUCKETS))
+    return -1;
+  atomic_fetch_add_explicit(&g_hists[hist].sum, ns, memory_order_relaxed);
+  atomic_fetch_add_explicit(
+      &g_hists[hist].buckets[bucket], 1, memory_order_relaxed);
+  return 0;
+}
+
+/* Sends what is buffered. A full socket buffer drops the client rather
+ * than stall the runner.
+ */
+static int out_flush(struct metrics_out* out) {
+  size_t done = 0;
+
+  for (size_t i = 0; i < METRICS_OUT_BYTES; i++) {
+    if (done >= out->len)
+      break;
+    ssize_t n = send(out->fd, out->buf + done, out->len - done, MSG_NOSIGNAL);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    done += (size_t)n;
+  }
+  if (done < out->len)
+    return -1;
+  out->len = 0;
+  return 0;
+}
+
+/* Makes room for one line of at most METRICS_LINE_BYTES. */
+static char* out_line(struct metrics_out* out) {
+  if (METRICS_OUT_BYTES - out->len < METRICS_LINE_BYTES &&
+      out_flush(out) != 0)
+    return NULL;
+  return out->buf + out->len;
+}
+
+/* Takes the snprintf() result for the line from out_line(). */
+static int out_commit(struct metrics_out* out, int rc) {
+  if (rc < 0 || (size_t)rc >= METRICS_LINE_BYTES)
+    return -1;
+  out->len += (size_t)rc;
+  return 0;
+}
+
+static int put_header(
+    struct metrics_out* out, const struct metric_info* info, const char* type) {
+  char* line = out_line(out);
+
+  if (!line)
+    return -1;
+
+  int rc = snprintf(line,
+      METRICS_LINE_BYTES,
+      "# HELP %s %s\n# TYPE %s %s\n",
+      info->name,
+      info->help,
+      info->name,
+      type);
+
+  return out_commit(out, rc);
+}
+
+static int put_counter(struct metrics_out* out, int counter) {
+  const struct metric_info* info = &counter_info[counter];
+
+  if (put_header(out, info, "counter") != 0)
+    return -1;
+
+  char* line = out_line(out);
+
+  if (!line)
+    return -1;
+
+  u64 value =
+      atomic_load_explicit(&g_counters[counter], memory_order_relaxed);
+  int rc = snprintf(line, METRICS_LINE_BYTES, "%s %llu\n", info->name, value);
+
+  return out_commit(out, rc);
+}
+
+/* The same le boundaries on every scrape and in every process, so rates
+ * and quantiles can be taken across them: each power of two of
+ * nanoseconds is a bucket edge in hist.h, and a line counts the values
+ * below it.
+ */
+static int put_hist(struct metrics_out* out, int hist) {
+  const struct metric_info* info = &hist_info[hist];
+  const struct metric_buckets* h = &g_hists[hist];
+
+  if (put_header(out, info, "histogram") != 0)
+    return -1;
+
+  u64 count = 0;
+  size_t next = 0;
+
+  for (size_t exp = METRICS_LE_MIN_EXP; exp <= METRICS_LE_MAX_EXP; exp++) {
+    size_t end = hist_bucket(1ULL << exp);
+
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+      if (next >= end)
+        break;
+      count += atomic_load_explicit(&h->buckets[next], memory_order_relaxed);
+      next++;
+    }
+
+    u64 le = (1ULL << exp) - 1U;
+    char* line = out_line(out);
+
+    if (!line)
+      return -1;
+
+    int rc = snprintf(line,
+        METRICS_LINE_BYTES,
+        "%s_bucket{le=\"%llu.%09llu\"} %llu\n",
+        info->name,
+        le / 1000000000ULL,
+        le % 1000000000ULL,
+        count);
+
+    if (out_commit(out, rc) != 0)
+      return -1;
+  }
+  for (size_t i = 0; i < HIST_BUCKETS; i++) {
+    if (next >= HIST_BUCKETS)
+      break;
+    count += atomic_load_explicit(&h->buckets[next], memory_order_relaxed);
+    next++;
+  }
+
+  u64 sum = atomic_load_explicit(&h->sum, memory_order_relaxed);
+  char* line = out_line(out);
+
+  if (!line)
+    return -1;
+
+  int rc = snprintf(line,
+      METRICS_LINE_BYTES,
+      "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %llu.%09llu\n%s_count %llu\n",
+      info->name,
+      count,
+      info->name,
+      sum / 1000000000ULL,
+      sum % 1000000000ULL,
+      info->name,
+      count);
+
+  return out_commit(out, rc);
+}
+
+static int put_all(struct metrics_out* out) {
+  for (int i = 0; i < METRIC_COUNTERS; i++) {
+    if (put_counter(out, i) != 0)
+      return -1;
+  }
+  for (int i = 0; i < METRIC_HISTS; i++) {
+    if (put_hist(out, i) != 0)
+      return -1;
+  }
+  return out_flush(out);
+}
+
+int metrics_serve(void) {
+  if (!assert_ok(g_metrics_fd >= 0))
+    return -1;
+
+  for (size_t i = 0; i < METRICS_ACCEPTS; i++) {
+    int fd = accept(g_metrics_fd, NULL, NULL);
+
+    if (fd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+          errno == ECONNABORTED)
+        return 0;
+      return -1;
+    }
+    g_out.fd = fd;
+    g_out.len = 0;
+    /* A client that does not take its response just loses the rest. */
+    if (set_flags(fd) != 0 || put_all(&g_out) != 0)
+      g_out.len = 0;
+    if (close(fd) != 0 && errno != EINTR)
+      return -1;
+  }
+  return 0;
+}
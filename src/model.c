@@ -1,12 +1,139 @@
 // SPDX-License-Identifier: MIT
 #include "model.h"
 
-int session_init(struct Session* session) {
-  if (!assert_ptr(session))
+#include <stdlib.h>
+#include <sys/mman.h>
+
+int limits_default(struct Limits* limits) {
+  if (!assert_ptr(limits))
     return -1;
 
+  limits->max_groups = MAX_GROUPS;
+  limits->max_items_total = MAX_ITEMS_TOTAL;
+  limits->max_items_per_group = MAX_ITEMS_PER_GROUP;
+  limits->max_spool_mib = SPOOL_MAX_MIB;
+  return 0;
+}
+
+static int limits_valid(const struct Limits* limits) {
+  if (!assert_ptr(limits))
+    return 0;
+  if (limits->max_groups < 1 || limits->max_groups > MAX_GROUPS_CAP)
+    return 0;
+  if (limits->max_items_total < 1 ||
+      limits->max_items_total > MAX_ITEMS_TOTAL_CAP)
+    return 0;
+  if (limits->max_items_per_group < 1 ||
+      limits->max_items_per_group > MAX_ITEMS_PER_GROUP_CAP)
+    return 0;
+  if (limits->max_spool_mib < 1 || limits->max_spool_mib > SPOOL_MAX_MIB_CAP)
+    return 0;
+  return 1;
+}
+
+static void session_clear(struct Session* session) {
+  session->text = NULL;
   session->buffer_len = 0;
+  session->map_base = NULL;
+  session->map_len = 0;
+  session->cksum = 0;
+  session->have_cksum = 0;
+  session->image_base = NULL;
+  session->image_len = 0;
+  session->arena = NULL;
+  session->groups = NULL;
+  session->group_cap = 0;
   session->group_count = 0;
+  session->items = NULL;
+  session->item_cap = 0;
   session->item_count = 0;
+  session->breaks = NULL;
+  session->break_cap = 0;
+  session->break_count = 0;
+  session->group_order = NULL;
+  session->item_order = NULL;
+}
+
+int session_init(struct Session* session, const struct Limits* limits) {
+  if (!assert_ptr(session))
+    return -1;
+  if (!assert_ptr(limits))
+    return -1;
+  if (!validate_ok(limits_valid(limits)))
+    return -1;
+
+  session_clear(session);
+  session->limits = *limits;
+  return 0;
+}
+
+static size_t min_size(size_t a, size_t b) {
+  return (a < b) ? a : b;
+}
+
+/* Carves all per-deck tables out of one allocation. Counts beyond the
+ * runtime limits are clamped: the fill pass fails before writing past them.
+ * The size_t arrays go first so every table stays naturally aligned.
+ */
+int session_reserve(
+    struct Session* session, const struct SessionSizes* sizes) {
+  if (!assert_ptr(session))
+    return -1;
+  if (!assert_ptr(sizes))
+    return -1;
+  if (!assert_ok(session->arena == NULL))
+    return -1;
+
+  const struct Limits* limits = &session->limits;
+  size_t groups = min_size(sizes->groups, limits->max_groups);
+  size_t items = min_size(sizes->items, limits->max_items_total);
+  size_t group_items =
+      min_size(sizes->group_items, limits->max_items_per_group);
+
+  group_items = min_size(group_items, items);
+
+  size_t order_bytes = (groups + group_items) * sizeof(size_t);
+  size_t item_bytes = sizes->tables ? items * sizeof(struct Item) : 0;
+  size_t group_bytes = sizes->tables ? groups * sizeof(struct Group) : 0;
+  size_t break_bytes =
+      sizes->tables ? sizes->breaks * sizeof(struct Utf8Break) : 0;
+  size_t total = order_bytes + item_bytes + group_bytes + break_bytes;
+
+  if (total == 0)
+    return 0;
+
+  unsigned char* arena = malloc(total);
+
+  if (!arena)
+    return -1;
+  session->arena = arena;
+  session->group_order = (size_t*)arena;
+  session->item_order = session->group_order + groups;
+  if (!sizes->tables)
+    return 0;
+  session->items = (struct Item*)(arena + order_bytes);
+  session->item_cap = items;
+  session->groups = (struct Group*)(arena + order_bytes + item_bytes);
+  session->group_cap = groups;
+  session->breaks = (struct Utf8Break*)(arena + order_bytes + item_bytes +
+      group_bytes);
+  session->break_cap = sizes->breaks;
+  return 0;
+}
+
+int session_release(struct Session* session) {
+  if (!assert_ptr(session))
+    return -1;
+
+  int rc = 0;
+
+  if (session->map_base)
+    rc = munmap(session->map_base, session->map_len);
+  if (session->image_base && munmap(session->image_base, session->image_len))
+    rc = -1;
+  free(session->arena);
+  session_clear(session);
+  if (rc != 0)
+    return -1;
   return 0;
 }
@@ -1,16 +1,56 @@
 // SPDX-License-Identifier: MIT
 #include "parser.h"
+#include "cksum.h"
+#include "scan.h"
+#include "utf8.h"
 
-#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 struct parse_state {
   size_t line_no;
   int has_group;
   size_t current_group;
+  /* Items in current_group so far, including those of earlier chunks. */
+  size_t group_items;
+  size_t group_count;
+  size_t item_count;
+  /* Groups below group_base were opened by earlier chunks. */
+  size_t group_base;
+  /* Break table entries taken by this and earlier chunks. */
+  size_t break_count;
+  size_t carry_items;
+  size_t carry_added;
+};
+
+/* A newline-aligned slice of the deck, parsed on its own thread. */
+struct parse_chunk {
+  struct Session* session;
+  size_t begin;
+  size_t end;
+  int last;
+  int fill;
+  int rc;
+  /* Counting pass results. */
+  size_t lines;
+  size_t groups;
+  size_t items;
+  size_t lead_items;
+  size_t tail_items;
+  size_t group_items_max;
+  size_t breaks;
+  /* Offset of the first invalid UTF-8 sequence, or SIZE_MAX. */
+  size_t bad_utf8;
+  /* Fill pass state and first error. */
+  struct parse_state state;
+  char err[256];
 };
 
 static int set_error(char* err_buf, size_t err_len, const char* msg) {
@@ -50,13 +90,7 @@ static size_t trim_left_index(const char* line, size_t line_len) {
   if (!validate_ok(line_len <= MAX_LINE_LEN))
     return line_len;
 
-  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
-    if (i >= line_len)
-      break;
-    if (!isspace((unsigned char)line[i]))
-      return i;
-  }
-  return line_len;
+  return scan_span_space(line, line_len);
 }
 
 static size_t trim_right_index(
@@ -65,19 +99,10 @@ static size_t trim_right_index(
     return start;
   if (!validate_ok(line_len <= MAX_LINE_LEN))
     return start;
+  if (start >= line_len)
+    return start;
 
-  size_t end = line_len;
-
-  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
-    if (i >= line_len)
-      break;
-    if (end <= start || end == 0)
-      break;
-    if (!isspace((unsigned char)line[end - 1]))
-      break;
-    end--;
-  }
-  return end;
+  return scan_rspan_space(line, line_len, start);
 }
 
 static int is_blank_or_comment(const char* line, size_t line_len) {
@@ -100,18 +125,25 @@ static int find_pipe_index(
   if (!validate_ptr(out_index))
     return -1;
 
-  for (size_t i = 1; i < MAX_LINE_LEN; i++) {
-    if (i + 1 >= line_len)
-      break;
-    if (line[i] == '|') {
-      *out_index = i;
-      return 0;
-    }
-  }
-  return -1;
+  if (line_len < 3)
+    return -1;
+
+  /* Only bytes strictly between '[' and ']' are candidates. */
+  size_t span = line_len - 2;
+  size_t i = scan_find_byte(line + 1, span, '|');
+
+  if (i >= span)
+    return -1;
+  *out_index = i + 1;
+  return 0;
 }
 
+/* Accepts what strtoul(sec, &end, 10) with *end == '\0' accepted before
+ * the parser stopped writing terminators into the deck: an optional '+',
+ * decimal digits, and nothing else up to the field end or a NUL byte.
+ */
 static int parse_seconds_value(const char* sec,
+    size_t sec_len,
     size_t line_no,
     char* err_buf,
     size_t err_len,
@@ -120,31 +152,50 @@ static int parse_seconds_value(const char* sec,
     return -1;
   if (!validate_ptr(out_seconds))
     return -1;
+  if (!validate_ok(sec_len <= MAX_LINE_LEN))
+    return -1;
 
-  errno = 0;
-  char* endptr = NULL;
-  unsigned long secs = strtoul(sec, &endptr, 10);
+  size_t start = 0;
 
-  if (errno != 0 || !endptr || *endptr != '\0' || secs < 1 ||
-      secs > MAX_GROUP_SECONDS)
+  if (sec_len > 0 && sec[0] == '+')
+    start = 1;
+
+  unsigned long secs = 0;
+  int valid = 1;
+
+  for (size_t i = start; i < MAX_LINE_LEN; i++) {
+    if (i >= sec_len || sec[i] == '\0')
+      break;
+    if (sec[i] < '0' || sec[i] > '9') {
+      valid = 0;
+      break;
+    }
+    if (secs <= MAX_GROUP_SECONDS)
+      secs = secs * 10UL + (unsigned long)(sec[i] - '0');
+  }
+  if (!valid || secs < 1 || secs > MAX_GROUP_SECONDS)
     return set_error_line(err_buf, err_len, line_no, "invalid seconds value");
   *out_seconds = (unsigned int)secs;
   return 0;
 }
 
 static int parse_header_line(struct Session* session,
-    char* line,
+    struct parse_state* state,
+    const char* line,
     size_t line_len,
-    size_t line_no,
     char* err_buf,
     size_t err_len) {
   if (!validate_ptr(session))
     return -1;
+  if (!validate_ptr(state))
+    return -1;
   if (!validate_ptr(line))
     return -1;
   if (!validate_ok(line_len <= MAX_LINE_LEN))
     return -1;
 
+  size_t line_no = state->line_no;
+
   if (line_len < 3 || line[0] != '[' || line[line_len - 1] != ']')
     return set_error_line(err_buf, err_len, line_no, "malformed header");
 
@@ -154,60 +205,72 @@ static int parse_header_line(struct Session* session,
   if (rc != 0)
     return set_error_line(err_buf, err_len, line_no, "malformed header");
 
-  line[line_len - 1] = '\0';
-  line[pipe_index] = '\0';
-
-  char* name = line + 1;
+  const char* name = line + 1;
   size_t name_len = pipe_index - 1;
   size_t name_start = trim_left_index(name, name_len);
   size_t name_end = trim_right_index(name, name_len, name_start);
 
   if (name_start >= name_end)
     return set_error_line(err_buf, err_len, line_no, "malformed header");
-  name[name_end] = '\0';
   name += name_start;
 
-  char* sec = line + pipe_index + 1;
+  const char* sec = line + pipe_index + 1;
   size_t sec_len = (line_len - 1) - (pipe_index + 1);
   size_t sec_start = trim_left_index(sec, sec_len);
   size_t sec_end = trim_right_index(sec, sec_len, sec_start);
 
   if (sec_start >= sec_end)
     return set_error_line(err_buf, err_len, line_no, "malformed header");
-  sec[sec_end] = '\0';
-  sec += sec_start;
 
   unsigned int seconds = 0;
 
-  rc = parse_seconds_value(sec, line_no, err_buf, err_len, &seconds);
+  rc = parse_seconds_value(sec + sec_start,
+      sec_end - sec_start,
+      line_no,
+      err_buf,
+      err_len,
+      &seconds);
   if (rc != 0)
     return -1;
-  size_t group_index = session->group_count;
-  size_t item_count = session->item_count;
-  const char* buffer = session->buffer;
+  size_t group_index = state->group_count;
+  size_t item_count = state->item_count;
+  const char* buffer = session->text;
 
-  if (group_index >= MAX_GROUPS)
+  if (group_index >= session->limits.max_groups)
     return set_error_line(err_buf, err_len, line_no, "too many groups");
+  if (!assert_ok(group_index < session->group_cap))
+    return -1;
 
   struct Group* group = &session->groups[group_index];
-  size_t name_length = strlen(name);
+  size_t name_length = name_end - name_start;
+  const char* name_nul = memchr(name, '\0', name_length);
+
+  /* An embedded NUL ends the name, as strlen() did. */
+  if (name_nul)
+    name_length = (size_t)(name_nul - name);
 
   if (name_length > MAX_LINE_LEN)
     return set_error_line(err_buf, err_len, line_no, "group name too long");
 
   size_t name_offset = (size_t)(name - buffer);
+  u32 name_cksum = 0;
 
-  group->name_offset = (u32)name_offset;
+  rc = cksum_bytes(&name_cksum, (const unsigned char*)name, name_length);
+  if (rc != 0)
+    return set_error_line(err_buf, err_len, line_no, "checksum failed");
+  group->name_offset = (u64)name_offset;
   group->name_length = (u32)name_length;
   group->seconds = (u32)seconds;
   group->item_start = (u32)item_count;
   group->item_count = 0;
-  session->group_count++;
+  group->name_cksum = name_cksum;
+  group->reserved = 0;
+  state->group_count++;
   return 0;
 }
 
 static int parse_item_line(struct Session* session,
-    const struct parse_state* state,
+    struct parse_state* state,
     size_t line_start,
     size_t line_len,
     char* err_buf,
@@ -220,31 +283,64 @@ static int parse_item_line(struct Session* session,
   if (!state->has_group)
     return set_error_line(
         err_buf, err_len, state->line_no, "item before any group header");
-  if (session->item_count >= MAX_ITEMS_TOTAL)
+  if (state->item_count >= session->limits.max_items_total)
     return set_error_line(err_buf, err_len, state->line_no, "too many items");
-  size_t group_index = state->current_group;
-
-  if (!assert_ok(group_index < session->group_count))
+  if (!assert_ok(state->item_count < session->item_cap))
+    return -1;
+  if (!assert_ok(state->current_group < state->group_count))
     return -1;
-  struct Group* group = &session->groups[group_index];
 
-  if (group->item_count >= MAX_ITEMS_PER_GROUP)
+  if (state->group_items >= session->limits.max_items_per_group)
     return set_error_line(
         err_buf, err_len, state->line_no, "too many items in group");
 
-  size_t item_index = session->item_count;
+  size_t item_index = state->item_count;
   struct Item* item = &session->items[item_index];
+  u32 cksum = 0;
+  int rc = cksum_bytes(
+      &cksum, (const unsigned char*)session->text + line_start, line_len);
+
+  if (rc != 0)
+    return set_error_line(err_buf, err_len, state->line_no, "checksum failed");
+  if (!assert_ok(state->break_count <= session->break_cap))
+    return -1;
 
-  item->offset = (u32)line_start;
+  u32 width = 0;
+  size_t breaks = utf8_breaks(session->text + line_start,
+      line_len,
+      session->breaks + state->break_count,
+      session->break_cap - state->break_count,
+      &width);
+
+  item->offset = (u64)line_start;
+  item->first_break = (u64)state->break_count;
   item->length = (u32)line_len;
-  session->item_count++;
-  group->item_count++;
+  item->cksum = cksum;
+  item->breaks = (u32)breaks;
+  item->width = width;
+  state->break_count += breaks;
+  state->item_count++;
+  state->group_items++;
   return 0;
 }
 
+/* Stores the item count of the group being left. A group carried in from an
+ * earlier chunk belongs to that chunk; only the items added here are kept,
+ * and stitched in once every chunk is done.
+ */
+static void close_group(struct Session* session, struct parse_state* state) {
+  if (!state->has_group)
+    return;
+  if (state->current_group >= state->group_base) {
+    session->groups[state->current_group].item_count = (u32)state->group_items;
+    return;
+  }
+  state->carry_added = state->group_items - state->carry_items;
+}
+
 static int handle_line(struct Session* session,
     struct parse_state* state,
-    char* line,
+    const char* line,
     size_t line_len,
     size_t line_start,
     char* err_buf,
@@ -259,34 +355,298 @@ static int handle_line(struct Session* session,
   if (is_blank_or_comment(line, line_len))
     return 0;
   if (line[0] == '[') {
-    if (state->has_group) {
-      size_t group_index = state->current_group;
-
-      if (!assert_ok(group_index < session->group_count))
-        return -1;
-      const struct Group* group = &session->groups[group_index];
-      if (group->item_count == 0)
-        return set_error_line(
-            err_buf, err_len, state->line_no, "previous group has no items");
-    }
+    if (state->has_group && state->group_items == 0)
+      return set_error_line(
+          err_buf, err_len, state->line_no, "previous group has no items");
+    close_group(session, state);
     int rc = parse_header_line(
-        session, line, line_len, state->line_no, err_buf, err_len);
+        session, state, line, line_len, err_buf, err_len);
     if (rc != 0)
       return -1;
-    size_t group_count = session->group_count;
+    size_t group_count = state->group_count;
 
     if (!assert_ok(group_count > 0))
       return -1;
     state->current_group = group_count - 1;
     state->has_group = 1;
+    state->group_items = 0;
     return 0;
   }
   return parse_item_line(
       session, state, line_start, line_len, err_buf, err_len);
 }
 
-static int parse_session_buffer(
-    struct Session* session, char* err_buf, size_t err_len) {
+/* Returns the length of the line starting at line_start, without its
+ * LF or CRLF terminator, and sets *next to the start of the following line
+ * (buf_len + 1 once the last line is consumed).
+ */
+static size_t next_line(
+    const char* buf, size_t buf_len, size_t line_start, size_t* next) {
+  size_t line_len =
+      scan_find_byte(buf + line_start, buf_len - line_start, '\n');
+
+  *next = line_start + line_len + 1;
+  if (line_len > 0 && buf[line_start + line_len - 1] == '\r')
+    line_len--;
+  return line_len;
+}
+
+/* Every chunk but the last ends just past a '\n'; the last one also owns
+ * the (possibly empty) line after the final newline.
+ */
+static int chunk_has_line(
+    const struct parse_chunk* chunk, size_t line_start) {
+  if (line_start < chunk->end)
+    return 1;
+  return chunk->last && line_start == chunk->end;
+}
+
+/* Counting pass: sizes the session arena exactly. Lines are classified the
+ * same way handle_line() does, and item lines laid out to size the break
+ * table; validation is left to the fill pass, which reports the UTF-8 check
+ * done here when it reaches the line at fault. Chunks end at a newline, so
+ * they never split a character.
+ */
+static int count_chunk(struct parse_chunk* chunk) {
+  if (!validate_ptr(chunk))
+    return -1;
+  if (!validate_ptr(chunk->session))
+    return -1;
+
+  const char* buf = chunk->session->text;
+  size_t line_start = chunk->begin;
+  size_t group_items = 0;
+
+  chunk->lines = 0;
+  chunk->groups = 0;
+  chunk->items = 0;
+  chunk->lead_items = 0;
+  chunk->group_items_max = 0;
+  chunk->breaks = 0;
+  chunk->bad_utf8 = SIZE_MAX;
+
+  size_t chunk_len = chunk->end - chunk->begin;
+  size_t bad = scan_find_bad_utf8(buf + chunk->begin, chunk_len);
+
+  if (bad < chunk_len)
+    chunk->bad_utf8 = chunk->begin + bad;
+  for (size_t n = 0; n <= MAX_DECK_BYTES; n++) {
+    if (!chunk_has_line(chunk, line_start))
+      break;
+    size_t next = 0;
+    size_t line_len = next_line(buf, chunk->end, line_start, &next);
+    const char* line = &buf[line_start];
+
+    chunk->lines++;
+    if (line_len <= MAX_LINE_LEN && !is_blank_or_comment(line, line_len)) {
+      if (line[0] == '[') {
+        if (chunk->groups > 0 && group_items > chunk->group_items_max)
+          chunk->group_items_max = group_items;
+        chunk->groups++;
+        group_items = 0;
+      } else {
+        u32 width = 0;
+
+        chunk->items++;
+        chunk->breaks += utf8_breaks(line, line_len, NULL, 0, &width);
+        if (chunk->groups == 0)
+          chunk->lead_items++;
+        else
+          group_items++;
+      }
+    }
+    line_start = next;
+  }
+  chunk->tail_items = group_items;
+  return 0;
+}
+
+/* Fill pass over one chunk, starting from the state the chunks before it
+ * leave behind; errors carry absolute line numbers.
+ */
+static int fill_chunk(struct parse_chunk* chunk) {
+  if (!validate_ptr(chunk))
+    return -1;
+  if (!validate_ptr(chunk->session))
+    return -1;
+
+  struct Session* session = chunk->session;
+  struct parse_state* state = &chunk->state;
+  const char* buf = session->text;
+  size_t line_start = chunk->begin;
+
+  for (size_t n = 0; n <= MAX_DECK_BYTES; n++) {
+    if (!chunk_has_line(chunk, line_start))
+      break;
+    size_t next = 0;
+    size_t line_len = next_line(buf, chunk->end, line_start, &next);
+
+    if (line_len > MAX_LINE_LEN)
+      return set_error_line(
+          chunk->err, sizeof(chunk->err), state->line_no, "line too long");
+    if (chunk->bad_utf8 < next)
+      return set_error_line(
+          chunk->err, sizeof(chunk->err), state->line_no, "invalid UTF-8");
+    const char* line = &buf[line_start];
+    int rc = handle_line(session,
+        state,
+        line,
+        line_len,
+        line_start,
+        chunk->err,
+        sizeof(chunk->err));
+
+    if (rc != 0)
+      return -1;
+    line_start = next;
+    state->line_no++;
+  }
+  close_group(session, state);
+  return 0;
+}
+
+static void* parse_chunk_worker(void* arg) {
+  struct parse_chunk* chunk = arg;
+
+  chunk->rc = chunk->fill ? fill_chunk(chunk) : count_chunk(chunk);
+  return NULL;
+}
+
+/* Runs chunk 0 on the calling thread and the rest on worker threads. A
+ * chunk whose thread cannot be started runs inline instead.
+ */
+static void run_chunks(struct parse_chunk* chunks, size_t count, int fill) {
+  pthread_t threads[MAX_PARSE_THREADS];
+  int started[MAX_PARSE_THREADS];
+
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    chunks[i].fill = fill;
+    chunks[i].rc = -1;
+    started[i] = 0;
+    if (i > 0) {
+      int rc =
+          pthread_create(&threads[i], NULL, parse_chunk_worker, &chunks[i]);
+
+      started[i] = (rc == 0);
+    }
+  }
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    if (!started[i])
+      parse_chunk_worker(&chunks[i]);
+  }
+  for (size_t i = 1; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    if (started[i] && pthread_join(threads[i], NULL) != 0)
+      chunks[i].rc = -1;
+  }
+}
+
+/* Cuts the deck into up to `threads` chunks of at least
+ * PARSE_CHUNK_MIN_BYTES, each ending just past a newline.
+ */
+static size_t split_chunks(
+    struct Session* session, size_t threads, struct parse_chunk* chunks) {
+  size_t len = session->buffer_len;
+  size_t want = len / PARSE_CHUNK_MIN_BYTES;
+
+  if (want > threads)
+    want = threads;
+  if (want > MAX_PARSE_THREADS)
+    want = MAX_PARSE_THREADS;
+  if (want < 1)
+    want = 1;
+
+  size_t count = 0;
+  size_t begin = 0;
+
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= want)
+      break;
+    size_t end = len;
+
+    if (i + 1 < want) {
+      size_t target = (len / want) * (i + 1);
+
+      if (target < begin)
+        target = begin;
+      end = target +
+          scan_find_byte(session->text + target, len - target, '\n');
+      if (end < len)
+        end++;
+    }
+    chunks[i].session = session;
+    chunks[i].begin = begin;
+    chunks[i].end = end;
+    chunks[i].last = (end == len);
+    chunks[i].err[0] = '\0';
+    count++;
+    begin = end;
+    if (end == len)
+      break;
+  }
+  return count;
+}
+
+static size_t max_size(size_t a, size_t b) {
+  return (a > b) ? a : b;
+}
+
+/* Turns per-chunk counts into arena sizes and into the parser state each
+ * chunk starts from. Returns the line number just past the deck.
+ */
+static size_t plan_chunks(
+    struct parse_chunk* chunks, size_t count, struct SessionSizes* sizes) {
+  size_t line_no = 1;
+  size_t groups = 0;
+  size_t items = 0;
+  size_t open_items = 0;
+  size_t group_items = 0;
+  size_t breaks = 0;
+
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    struct parse_chunk* chunk = &chunks[i];
+    struct parse_state* state = &chunk->state;
+
+    state->line_no = line_no;
+    state->has_group = (groups > 0);
+    state->current_group = (groups > 0) ? groups - 1 : 0;
+    state->group_items = open_items;
+    state->group_count = groups;
+    state->item_count = items;
+    state->group_base = groups;
+    state->break_count = breaks;
+    state->carry_items = open_items;
+    state->carry_added = 0;
+
+    if (chunk->groups > 0) {
+      group_items = max_size(group_items, open_items + chunk->lead_items);
+      group_items = max_size(group_items, chunk->group_items_max);
+      open_items = chunk->tail_items;
+    } else if (groups > 0) {
+      open_items += chunk->lead_items;
+    }
+    line_no += chunk->lines;
+    groups += chunk->groups;
+    items += chunk->items;
+    breaks += chunk->breaks;
+  }
+  sizes->groups = groups;
+  sizes->items = items;
+  sizes->group_items = max_size(group_items, open_items);
+  sizes->breaks = breaks;
+  sizes->tables = 1;
+  return line_no;
+}
+
+int parse_session_buffer(
+    struct Session* session, size_t threads, char* err_buf, size_t err_len) {
   if (!validate_ptr(session))
     return -1;
   if (!validate_ptr(err_buf))
@@ -294,105 +654,223 @@ static int parse_session_buffer(
   if (!validate_ok(err_len > 0))
     return -1;
 
-  struct parse_state state;
+  static struct parse_chunk chunks[MAX_PARSE_THREADS];
+  size_t count = split_chunks(session, threads, chunks);
+
+  run_chunks(chunks, count, 0);
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    if (chunks[i].rc != 0)
+      return set_error(err_buf, err_len, "failed to count deck lines");
+  }
+
+  struct SessionSizes sizes;
+  size_t end_line = plan_chunks(chunks, count, &sizes);
+  int rc = session_reserve(session, &sizes);
+
+  if (rc != 0)
+    return set_error(err_buf, err_len, "failed to allocate session tables");
 
-  state.line_no = 1;
-  state.has_group = 0;
-  state.current_group = 0;
-
-  size_t buf_len = session->buffer_len;
-  char* buf = session->buffer;
-  size_t line_start = 0;
-
-  for (size_t i = 0; i <= MAX_FILE_BYTES; i++) {
-    if (i == buf_len || buf[i] == '\n') {
-      size_t line_len = i - line_start;
-
-      if (line_len > 0 && buf[line_start + line_len - 1] == '\r')
-        line_len--;
-      if (line_len > MAX_LINE_LEN)
-        return set_error_line(err_buf, err_len, state.line_no, "line too long");
-      char* line = &buf[line_start];
-
-      line[line_len] = '\0';
-      int rc = handle_line(
-          session, &state, line, line_len, line_start, err_buf, err_len);
-      if (rc != 0)
-        return -1;
-      line_start = i + 1;
-      state.line_no++;
-      if (i == buf_len)
-        break;
+  /* The first failing chunk holds the error a sequential parse would hit. */
+  run_chunks(chunks, count, 1);
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    if (chunks[i].rc != 0) {
+      if (chunks[i].err[0] == '\0')
+        return set_error(err_buf, err_len, "failed to parse deck");
+      return set_error(err_buf, err_len, chunks[i].err);
     }
   }
+  for (size_t i = 1; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    const struct parse_state* state = &chunks[i].state;
+
+    if (state->group_base > 0)
+      session->groups[state->group_base - 1].item_count +=
+          (u32)state->carry_added;
+  }
+  session->group_count = sizes.groups;
+  session->item_count = sizes.items;
+  session->break_count = sizes.breaks;
 
   if (session->group_count == 0)
     return set_error(err_buf, err_len, "no groups found");
-  if (state.has_group) {
-    size_t group_index = state.current_group;
 
-    if (!assert_ok(group_index < session->group_count))
+  const struct Group* group = &session->groups[session->group_count - 1];
+
+  if (group->item_count == 0)
+    return set_error_line(
+        err_buf, err_len, end_line, "last group has no items");
+  return 0;
+}
+
+static int set_open_error(const char* path, char* err_buf, size_t err_len) {
+  const char* err = strerror(errno);
+
+  if (!err)
+    err = "unknown error";
+  char msg[256];
+  int rc = snprintf(msg, sizeof(msg), "Failed to open '%s': %s", path, err);
+  if (rc < 0 || (size_t)rc >= sizeof(msg))
+    return set_error(err_buf, err_len, "failed to open file");
+  return set_error(err_buf, err_len, msg);
+}
+
+static int write_all_fd(int fd, const char* buf, size_t len) {
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (len == 0)
+      break;
+    ssize_t n = write(fd, buf, len);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
       return -1;
-    const struct Group* group = &session->groups[group_index];
-    if (group->item_count == 0)
-      return set_error_line(
-          err_buf, err_len, state.line_no, "last group has no items");
+    }
+    if (n == 0)
+      break;
+    buf += (size_t)n;
+    len -= (size_t)n;
   }
+  if (len != 0)
+    return -1;
   return 0;
 }
 
-static int read_file_into_session(
-    const char* path, struct Session* session, char* err_buf, size_t err_len) {
-  if (!validate_ptr(path))
-    return -1;
-  if (!validate_ptr(session))
-    return -1;
-  if (!validate_ptr(err_buf))
-    return -1;
-  if (!validate_ok(err_len > 0))
-    return -1;
+/* An anonymous file in $CRAM_SPOOL_DIR (or /var/tmp), unlinked before use.
+ * Not $TMPDIR or /tmp: those are often tmpfs, where the copy would sit in
+ * RAM at the size of the deck.
+ */
+static int open_spool_file(void) {
+  const char* dir = getenv("CRAM_SPOOL_DIR");
 
-  FILE* fp = fopen(path, "rb");
+  if (!dir || dir[0] != '/')
+    dir = "/var/tmp";
 
-  if (!fp) {
-    const char* err = strerror(errno);
+  char path[MAX_PATH_LEN];
+  int rc = snprintf(path, sizeof(path), "%s/cram.XXXXXX", dir);
 
-    if (!err)
-      err = "unknown error";
-    char msg[256];
-    int rc = snprintf(msg, sizeof(msg), "Failed to open '%s': %s", path, err);
-    if (rc < 0 || (size_t)rc >= sizeof(msg))
-      return set_error(err_buf, err_len, "failed to open file");
-    return set_error(err_buf, err_len, msg);
-  }
+  if (rc < 0 || (size_t)rc >= sizeof(path))
+    return -1;
 
-  size_t nread = fread(session->buffer, 1, MAX_FILE_BYTES, fp);
+  int fd = mkstemp(path);
 
-  if (ferror(fp)) {
-    int crc = fclose(fp);
+  if (fd < 0)
+    return -1;
+  if (unlink(path) != 0) {
+    int crc = close(fd);
 
     if (crc != 0)
-      return set_error(err_buf, err_len, "failed to close file");
-    return set_error(err_buf, err_len, "failed to read file");
+      return -1;
+    return -1;
   }
-  int extra = fgetc(fp);
+  return fd;
+}
+
+/* Maps a regular file privately and read-only. Item and group offsets then
+ * point straight into the mapping, so no page is copied and only pages the
+ * parser touches become resident.
+ */
+static int map_file_into_session(int fd,
+    size_t size,
+    struct Session* session,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ok(fd >= 0))
+    return -1;
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ok(size > 0))
+    return -1;
 
-  if (extra != EOF) {
-    int crc = fclose(fp);
+  if (size > MAX_DECK_BYTES) {
+    int crc = close(fd);
 
     if (crc != 0)
       return set_error(err_buf, err_len, "failed to close file");
-    return set_error(err_buf, err_len, "file exceeds MAX_FILE_BYTES");
+    return set_error(err_buf, err_len, "file exceeds MAX_DECK_BYTES");
   }
-  if (fclose(fp) != 0)
+
+  void* base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int crc = close(fd);
+
+  if (base == MAP_FAILED)
+    return set_error(err_buf, err_len, "failed to map file");
+  session->map_base = base;
+  session->map_len = size;
+  if (crc != 0)
     return set_error(err_buf, err_len, "failed to close file");
 
-  session->buffer_len = nread;
-  session->buffer[nread] = '\0';
+  /* Advisory only; the parser reads front to back exactly once. */
+  int arc = posix_madvise(base, size, POSIX_MADV_SEQUENTIAL);
+
+  if (arc != 0 && arc != EINVAL)
+    return set_error(err_buf, err_len, "failed to advise file mapping");
+
+  session->text = (const char*)base;
+  session->buffer_len = size;
   return 0;
 }
 
-int parse_session_file(
+/* Input of unknown size (a pipe, a device, stdin) is copied one
+ * LOAD_WINDOW_BYTES window at a time into a spool file, which is then mapped
+ * like any deck file. Only the window lives in process memory; the deck
+ * pages are file-backed and the kernel can drop them under pressure. The
+ * spool stops at limits.max_spool_mib, well below MAX_DECK_BYTES by default.
+ */
+static int spool_file_into_session(
+    int fd, struct Session* session, char* err_buf, size_t err_len) {
+  if (!validate_ok(fd >= 0))
+    return -1;
+  if (!validate_ptr(session))
+    return -1;
+
+  static char window[LOAD_WINDOW_BYTES];
+  u64 cap = (u64)session->limits.max_spool_mib << 20;
+  int spool = open_spool_file();
+  const char* err = (spool < 0) ? "failed to create spool file" : NULL;
+  u64 total = 0;
+
+  /* Every pass but an EINTR retry consumes at least one byte. */
+  for (u64 i = 0; i <= MAX_DECK_BYTES; i++) {
+    if (err)
+      break;
+    ssize_t n = read(fd, window, sizeof(window));
+
+    if (n < 0) {
+      if (errno != EINTR)
+        err = "failed to read file";
+      continue;
+    }
+    if (n == 0)
+      break;
+    total += (u64)n;
+    if (total > cap)
+      err = "input exceeds the spool cap (see --max-spool-mib)";
+    else if (write_all_fd(spool, window, (size_t)n) != 0)
+      err = "failed to write spool file";
+  }
+
+  int crc = close(fd);
+
+  if (!err && crc != 0)
+    err = "failed to close file";
+  if (err || total == 0) {
+    if (spool >= 0 && close(spool) != 0 && !err)
+      err = "failed to close spool file";
+    if (err)
+      return set_error(err_buf, err_len, err);
+    session->text = "";
+    session->buffer_len = 0;
+    return 0;
+  }
+  return map_file_into_session(spool, (size_t)total, session, err_buf, err_len);
+}
+
+static int load_file_into_session(
     const char* path, struct Session* session, char* err_buf, size_t err_len) {
   if (!validate_ptr(path))
     return -1;
@@ -403,15 +881,50 @@ int parse_session_file(
   if (!validate_ok(err_len > 0))
     return -1;
 
-  int rc = session_init(session);
+  /* "-" reads the deck from stdin; the duplicate is closed like any file. */
+  int fd = (strcmp(path, "-") == 0) ? dup(STDIN_FILENO) : open(path, O_RDONLY);
 
-  if (rc != 0)
-    return set_error(err_buf, err_len, "failed to init session");
-  rc = read_file_into_session(path, session, err_buf, err_len);
-  if (rc != 0)
+  if (fd < 0)
+    return set_open_error(path, err_buf, err_len);
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0) {
+    int crc = close(fd);
+
+    if (crc != 0)
+      return set_error(err_buf, err_len, "failed to close file");
+    return set_error(err_buf, err_len, "failed to stat file");
+  }
+  /* Pipes, devices and empty files cannot be mapped; spool those instead. */
+  if (LOAD_USE_MMAP && S_ISREG(st.st_mode) && st.st_size > 0)
+    return map_file_into_session(
+        fd, (size_t)st.st_size, session, err_buf, err_len);
+  return spool_file_into_session(fd, session, err_buf, err_len);
+}
+
+int parse_load_file(const char* path,
+    const struct Limits* limits,
+    struct Session* session,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(path))
     return -1;
-  rc = parse_session_buffer(session, err_buf, err_len);
-  if (rc != 0)
+  if (!validate_ptr(limits))
     return -1;
-  return 0;
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+
+  int rc = session_release(session);
+
+  if (rc != 0)
+    return set_error(err_buf, err_len, "failed to release session");
+  rc = session_init(session, limits);
+  if (rc != 0)
+    return set_error(err_buf, err_len, "failed to init session");
+  return load_file_into_session(path, session, err_buf, err_len);
 }
@@ -84,12 +84,12 @@ int rng_shuffle_groups(struct Rng* rng, size_t* values, size_t count) {
     return -1;
   if (!validate_ptr(values))
     return -1;
-  if (!validate_ok(count <= MAX_GROUPS))
+  if (!validate_ok(count <= MAX_GROUPS_CAP))
     return -1;
 
   if (count < 2)
     return 0;
-  for (size_t i = 1; i < MAX_GROUPS; i++) {
+  for (size_t i = 1; i < MAX_GROUPS_CAP; i++) {
     if (i >= count)
       break;
     size_t j = rng_range(rng, i + 1);
@@ -106,12 +106,12 @@ int rng_shuffle_items(struct Rng* rng, size_t* values, size_t count) {
     return -1;
   if (!validate_ptr(values))
     return -1;
-  if (!validate_ok(count <= MAX_ITEMS_PER_GROUP))
+  if (!validate_ok(count <= MAX_ITEMS_PER_GROUP_CAP))
     return -1;
 
   if (count < 2)
     return 0;
-  for (size_t i = 1; i < MAX_ITEMS_PER_GROUP; i++) {
+  for (size_t i = 1; i < MAX_ITEMS_PER_GROUP_CAP; i++) {
     if (i >= count)
       break;
     size_t j = rng_range(rng, i + 1);
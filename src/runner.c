@@ -1,15 +1,17 @@
 // SPDX-License-Identifier: MIT
 #include "runner.h"
 #include "config.h"
+#include "event.h"
 #include "log.h"
+#include "metrics.h"
 #include "model.h"
 #include "rng.h"
 #include "term.h"
 
 #include <ctype.h>
-#include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 struct runtime {
   size_t order_pos;
@@ -18,9 +20,21 @@ struct runtime {
   size_t item_index;
   u64 group_end;
   int pending_switch;
+  /* The prompt at item_index is logged but not drawn yet. */
+  int stale;
+  /* Virtual time of a scripted run, in milliseconds from its start. */
+  u64 clock_ms;
+  struct RunnerStats stats;
+  /* What is on screen, so the next prompt can paint over it. */
+  struct TermFrame frame;
+  struct TermInput input;
 };
 
 struct ctx {
+  /* NULL for a scripted run, which keeps time by its virtual clock. */
+  struct EventLoop* events;
+  /* Virtual milliseconds each scripted key takes. */
+  u64 tick_ms;
   struct Session* session;
   struct Rng* rng;
   size_t* group_order;
@@ -32,16 +46,16 @@ static int assert_session_bounds(const struct Session* session) {
     return -1;
   if (!assert_ok(session->group_count > 0))
     return -1;
-  if (!assert_ok(session->group_count <= MAX_GROUPS))
+  if (!assert_ok(session->group_count <= session->limits.max_groups))
     return -1;
 
-  for (size_t i = 0; i < MAX_GROUPS; i++) {
+  for (size_t i = 0; i < MAX_GROUPS_CAP; i++) {
     if (i >= session->group_count)
       break;
     size_t count = session->groups[i].item_count;
     if (!assert_ok(count > 0))
       return -1;
-    if (!assert_ok(count <= MAX_ITEMS_PER_GROUP))
+    if (!assert_ok(count <= session->limits.max_items_per_group))
       return -1;
   }
   return 0;
@@ -60,9 +74,13 @@ static int now_ms(u64* out_ms) {
   return 0;
 }
 
-static int draw_prompt(const struct Session* session, size_t item_index) {
+static int draw_prompt(const struct Session* session,
+    struct TermFrame* frame,
+    size_t item_index) {
   if (!validate_ptr(session))
     return -1;
+  if (!validate_ptr(frame))
+    return -1;
   if (!assert_ok(item_index < session->item_count))
     return -1;
   if (!assert_ok(session->buffer_len > 0))
@@ -76,35 +94,40 @@ static int draw_prompt(const struct Session* session, size_t item_index) {
           (size_t)item.offset + (size_t)item.length <= session->buffer_len))
     return -1;
 
-  int rc = term_clear_screen();
-
-  if (rc != 0)
+  if (!assert_ok(item.first_break + item.breaks <= session->break_count))
     return -1;
 
-  const char* text = session->buffer + item.offset;
-  size_t written = fwrite(text, 1, item.length, stdout);
-
-  if (!assert_ok(written == item.length))
-    return -1;
-  rc = fputc('\n', stdout);
-  if (!assert_ok(rc != EOF))
-    return -1;
-  rc = fflush(stdout);
-  if (rc != 0)
-    return -1;
-  return 0;
+  return term_frame_draw(frame,
+      session->text + item.offset,
+      item.length,
+      session->breaks + item.first_break,
+      item.breaks,
+      item.width);
 }
 
 static int is_advance_key(int key) {
   if (!validate_ok(key >= 0))
     return 0;
-  if (!validate_ok(key <= 255))
+  if (key > 255)
     return 0;
   if (key == ' ' || key == '\r' || key == '\n')
     return 1;
   return isalnum((unsigned char)key) != 0;
 }
 
+/* Counts a shuffle timed from start, taken by metrics_start() before it. */
+static int count_shuffle(struct runtime* rt, u64 start) {
+  rt->stats.shuffles++;
+  if (metrics_count(METRIC_SHUFFLES) != 0)
+    return -1;
+  return metrics_observe(METRIC_SHUFFLE, start);
+}
+
+static int count_prompt(struct runtime* rt) {
+  rt->stats.prompts++;
+  return metrics_count(METRIC_PROMPTS);
+}
+
 static int init_group_order(const struct ctx* c) {
   if (!validate_ptr(c))
     return -1;
@@ -118,7 +141,7 @@ static int init_group_order(const struct ctx* c) {
   const struct Session* session = c->session;
   size_t group_count = session->group_count;
 
-  for (size_t i = 0; i < MAX_GROUPS; i++) {
+  for (size_t i = 0; i < MAX_GROUPS_CAP; i++) {
     if (i >= group_count)
       break;
     c->group_order[i] = i;
@@ -145,10 +168,10 @@ static int init_item_order(const struct ctx* c, size_t group_index) {
 
   if (!assert_ok(count > 0))
     return -1;
-  if (!assert_ok(count <= MAX_ITEMS_PER_GROUP))
+  if (!assert_ok(count <= session->limits.max_items_per_group))
     return -1;
 
-  for (size_t i = 0; i < MAX_ITEMS_PER_GROUP; i++) {
+  for (size_t i = 0; i < MAX_ITEMS_PER_GROUP_CAP; i++) {
     if (i >= count)
       break;
     c->item_order[i] = start + i;
@@ -177,11 +200,16 @@ static int select_next_group(const struct ctx* c, struct runtime* rt) {
 
   if (rt->order_pos >= group_count) {
     struct Rng* rng = c->rng;
+    u64 start = metrics_start();
     int rc = rng_shuffle_groups(rng, group_order, group_count);
+    if (rc != 0)
+      return -1;
+    rc = count_shuffle(rt, start);
     if (rc != 0)
       return -1;
     rt->order_pos = 0;
-    rc = log_simple("shuffle", "groups");
+    if (LOG_ENABLED(LOG_LEVEL_GROUP))
+      rc = log_simple(LOG_TYPE_SHUFFLE);
     if (rc != 0)
       return -1;
   }
@@ -215,7 +243,7 @@ static int select_next_item(const struct ctx* c, struct runtime* rt) {
 
   if (!assert_ok(count > 0))
     return -1;
-  if (!assert_ok(count <= MAX_ITEMS_PER_GROUP))
+  if (!assert_ok(count <= session->limits.max_items_per_group))
     return -1;
 
   if (rt->item_pos >= count)
@@ -248,13 +276,14 @@ static int update_group_timer(const struct ctx* c, struct runtime* rt) {
   if (!assert_ok(seconds <= MAX_GROUP_SECONDS))
     return -1;
 
-  u64 now = 0;
-  int rc = now_ms(&now);
+  u64 now = rt->clock_ms;
 
-  if (rc != 0)
+  if (c->events && now_ms(&now) != 0)
     return -1;
   rt->group_end = now + (u64)seconds * 1000ULL;
-  return 0;
+  if (!c->events)
+    return 0;
+  return event_set_deadline(c->events, rt->group_end);
 }
 
 static int advance_prompt(
@@ -278,7 +307,7 @@ static int advance_prompt(
 
   if (!assert_ok(count > 0))
     return -1;
-  if (!assert_ok(count <= MAX_ITEMS_PER_GROUP))
+  if (!assert_ok(count <= session->limits.max_items_per_group))
     return -1;
 
   if (due_to_switch) {
@@ -288,15 +317,20 @@ static int advance_prompt(
       return -1;
     struct Rng* rng = c->rng;
     size_t* item_order = c->item_order;
+    u64 start = metrics_start();
 
     rc = rng_shuffle_items(rng, item_order, count);
+    if (rc != 0)
+      return -1;
+    rc = count_shuffle(rt, start);
     if (rc != 0)
       return -1;
     rt->item_pos = 0;
     rc = update_group_timer(c, rt);
     if (rc != 0)
       return -1;
-    rc = log_group("group", rt->group_index);
+    if (LOG_ENABLED(LOG_LEVEL_GROUP))
+      rc = log_group(LOG_TYPE_GROUP, rt->group_index);
     if (rc != 0)
       return -1;
   } else {
@@ -304,11 +338,16 @@ static int advance_prompt(
     if (rt->item_pos >= count) {
       struct Rng* rng = c->rng;
       size_t* item_order = c->item_order;
+      u64 start = metrics_start();
       int rc = rng_shuffle_items(rng, item_order, count);
+      if (rc != 0)
+        return -1;
+      rc = count_shuffle(rt, start);
       if (rc != 0)
         return -1;
       rt->item_pos = 0;
-      rc = log_shuffle("items", rt->group_index);
+      if (LOG_ENABLED(LOG_LEVEL_GROUP))
+        rc = log_group(LOG_TYPE_ITEMS, rt->group_index);
       if (rc != 0)
         return -1;
     }
@@ -320,75 +359,51 @@ static int advance_prompt(
     return -1;
   size_t item_index = rt->item_index;
 
-  rc = draw_prompt(session, item_index);
+  /* Drawn by show_prompt() once no queued key moves past it. */
+  rt->stale = 1;
+  rc = count_prompt(rt);
   if (rc != 0)
     return -1;
-  rc = log_prompt(session, group_index, item_index);
+  if (LOG_ENABLED(LOG_LEVEL_PROMPT))
+    rc = log_prompt(session, group_index, item_index);
   if (rc != 0)
     return -1;
   return 0;
 }
 
-static int update_expiry(
-    const struct ctx* c, struct runtime* rt, u64* remaining_ms) {
+static int show_prompt(const struct ctx* c, struct runtime* rt) {
   if (!validate_ptr(c))
     return -1;
   if (!validate_ptr(rt))
     return -1;
-  if (!validate_ptr(remaining_ms))
-    return -1;
-  if (!validate_ptr(c->session))
-    return -1;
-  const struct Session* session = c->session;
-  size_t group_count = session->group_count;
-  size_t group_index = rt->group_index;
-
-  if (!assert_ok(group_index < group_count))
-    return -1;
-
-  *remaining_ms = 0;
-  if (rt->pending_switch)
+  if (!rt->stale)
     return 0;
 
-  u64 now = 0;
-  int rc = now_ms(&now);
-
-  if (rc != 0)
-    return -1;
-  if (now >= rt->group_end) {
-    rt->pending_switch = 1;
-    rc = log_group("expired", rt->group_index);
-    if (rc != 0)
-      return -1;
-    return 0;
-  }
-  *remaining_ms = rt->group_end - now;
-  return 0;
+  rt->stale = 0;
+  return draw_prompt(c->session, &rt->frame, rt->item_index);
 }
 
-static int read_key(const struct ctx* c,
-    const struct runtime* rt,
-    u64 remaining_ms,
-    int* key_out) {
-  if (!validate_ptr(c))
-    return -1;
+static int expire_group(struct runtime* rt) {
   if (!validate_ptr(rt))
     return -1;
-  if (!validate_ptr(key_out))
-    return -1;
-  if (!validate_ok(remaining_ms <= MAX_GROUP_MILLISECONDS))
-    return -1;
+  if (rt->pending_switch)
+    return 0;
 
-  int timeout = rt->pending_switch ? -1 : (int)remaining_ms;
-  int rc = term_read_key_timeout(timeout, key_out);
+  int rc = 0;
 
-  if (rc < 0)
+  rt->pending_switch = 1;
+  rc = metrics_count(METRIC_EXPIRIES);
+  if (rc != 0)
+    return -1;
+  if (LOG_ENABLED(LOG_LEVEL_GROUP))
+    rc = log_group(LOG_TYPE_EXPIRED, rt->group_index);
+  if (rc != 0)
     return -1;
-  return rc;
+  return 0;
 }
 
 static int handle_key(
-    const struct ctx* c, struct runtime* rt, int key, int* advanced) {
+    const struct ctx* c, struct runtime* rt, int key, size_t* advanced) {
   if (!validate_ptr(c))
     return -1;
   if (!validate_ptr(rt))
@@ -396,12 +411,23 @@ static int handle_key(
   if (!validate_ptr(advanced))
     return -1;
 
-  int rc = log_key(key);
+  int rc = 0;
 
+  rt->stats.keys++;
+  rc = metrics_count(METRIC_KEYS);
+  if (rc != 0)
+    return -1;
+  if (LOG_ENABLED(LOG_LEVEL_KEY))
+    rc = log_key(key);
   if (rc != 0)
     return -1;
   if (key == 3)
     return 1;
+  /* Pages through a prompt longer than the window. */
+  if (key == '<' || key == TERM_KEY_PAGE_UP)
+    return (show_prompt(c, rt) == 0) ? term_frame_scroll(&rt->frame, -1) : -1;
+  if (key == '>' || key == TERM_KEY_PAGE_DOWN)
+    return (show_prompt(c, rt) == 0) ? term_frame_scroll(&rt->frame, 1) : -1;
   if (!is_advance_key(key))
     return 0;
 
@@ -418,12 +444,46 @@ static int handle_key(
     if (rc != 0)
       return -1;
   }
-  *advanced = 1;
+  (*advanced)++;
   return 0;
 }
 
-static int run_wait_loop(
-    const struct ctx* c, struct runtime* rt, int* advanced) {
+/* Handles every queued key, then draws the last prompt they reached, so a
+ * burst of advances costs one frame. Stops early at a quit key or once
+ * limit prompts have been passed. A scripted run moves its clock on before
+ * each key and draws after each one, as if they were typed one by one.
+ */
+static int handle_keys(
+    const struct ctx* c, struct runtime* rt, size_t limit, size_t* advanced) {
+  for (size_t i = 0; i < TERM_INPUT_BYTES; i++) {
+    if (*advanced >= limit)
+      break;
+
+    int key = 0;
+    int rc = term_input_next(&rt->input, &key);
+
+    if (rc < 0)
+      return -1;
+    if (rc == 0)
+      break;
+    if (!c->events) {
+      rt->clock_ms += c->tick_ms;
+      if (rt->clock_ms >= rt->group_end && expire_group(rt) != 0)
+        return -1;
+    }
+    rc = handle_key(c, rt, key, advanced);
+    if (rc != 0)
+      return rc;
+    if (!c->events && show_prompt(c, rt) != 0)
+      return -1;
+  }
+  return show_prompt(c, rt);
+}
+
+static int run_wait_loop(const struct ctx* c,
+    struct runtime* rt,
+    size_t limit,
+    size_t* advanced) {
   if (!validate_ptr(c))
     return -1;
   if (!validate_ptr(rt))
@@ -431,25 +491,41 @@ static int run_wait_loop(
   if (!validate_ptr(advanced))
     return -1;
 
+  /* Each pass takes one event; waking up never costs a pass by itself. */
   for (size_t wait = 0; wait < MAX_WAIT_LOOPS; wait++) {
-    u64 remaining_ms = 0;
-    int rc = update_expiry(c, rt, &remaining_ms);
+    struct Event event;
+    int rc = event_wait(c->events, &event);
 
     if (rc != 0)
       return -1;
-    int key = 0;
-
-    rc = read_key(c, rt, remaining_ms, &key);
-    if (rc < 0)
+    if (event.kind == EVENT_TERMINATE)
+      return 1;
+    if (event.kind == EVENT_DEADLINE && expire_group(rt) != 0)
       return -1;
-    if (rc == 0)
+    if (event.kind == EVENT_RESIZE && term_frame_redraw(&rt->frame) != 0)
+      return -1;
+    /* The only fd added is the --metrics socket. */
+    if (event.kind == EVENT_FD && metrics_serve() != 0)
+      return -1;
+    if (event.kind != EVENT_INPUT)
       continue;
-    int key_rc = handle_key(c, rt, key, advanced);
 
-    if (key_rc < 0)
+    /* Timed only when the batch paints something. */
+    u64 start = metrics_start();
+    u64 bytes_out = rt->frame.bytes_out;
+
+    rc = term_input_read(&rt->input, STDIN_FILENO);
+    /* Readable with nothing to read: the terminal hung up. */
+    if (rc <= 0)
+      return -1;
+    rc = handle_keys(c, rt, limit, advanced);
+    if (rc < 0)
       return -1;
-    if (key_rc > 0 || *advanced)
-      return key_rc;
+    if (rt->frame.bytes_out != bytes_out &&
+        metrics_observe(METRIC_KEY_TO_DRAW, start) != 0)
+      return -1;
+    if (rc > 0 || *advanced > 0)
+      return rc;
   }
   return -1;
 }
@@ -468,25 +544,32 @@ static int run_loop(const struct ctx* c, struct runtime* rt) {
   if (!assert_ok(group_count > 0))
     return -1;
 
+  /* The first prompt is up before the loop starts. */
+  size_t shown = 1;
+
   for (size_t step = 1; step < MAX_PROMPTS_PER_RUN; step++) {
-    int advanced = 0;
-    int rc = run_wait_loop(c, rt, &advanced);
+    if (shown >= MAX_PROMPTS_PER_RUN)
+      break;
+    size_t advanced = 0;
+    int rc = run_wait_loop(c, rt, MAX_PROMPTS_PER_RUN - shown, &advanced);
 
     if (rc < 0)
       return -1;
     if (rc > 0)
       return 0;
-    if (!advanced) {
-      rc = log_simple("error", "wait loop exceeded");
+    if (advanced == 0) {
+      if (LOG_ENABLED(LOG_LEVEL_ERROR))
+        rc = log_simple(LOG_TYPE_ERROR);
       if (rc != 0)
         return -1;
       return -1;
     }
+    shown += advanced;
   }
   return 0;
 }
 
-static int init_runtime(const struct ctx* c, struct runtime* rt) {
+static int init_runtime(const struct ctx* c, struct runtime* rt, int out_fd) {
   if (!validate_ptr(c))
     return -1;
   if (!validate_ptr(rt))
@@ -508,15 +591,30 @@ static int init_runtime(const struct ctx* c, struct runtime* rt) {
   rt->item_index = 0;
   rt->group_end = 0;
   rt->pending_switch = 0;
+  rt->stale = 0;
+  rt->clock_ms = 0;
+  memset(&rt->stats, 0, sizeof(rt->stats));
 
-  int rc = init_group_order(c);
+  int rc = term_frame_init(&rt->frame, out_fd);
+
+  if (rc != 0)
+    return -1;
+  rc = term_input_init(&rt->input);
+  if (rc != 0)
+    return -1;
+  rc = init_group_order(c);
 
   if (rc != 0)
     return -1;
   struct Rng* rng = c->rng;
   size_t* group_order = c->group_order;
 
+  u64 start = metrics_start();
+
   rc = rng_shuffle_groups(rng, group_order, group_count);
+  if (rc != 0)
+    return -1;
+  rc = count_shuffle(rt, start);
   if (rc != 0)
     return -1;
   rc = select_next_group(c, rt);
@@ -532,12 +630,16 @@ static int init_runtime(const struct ctx* c, struct runtime* rt) {
 
   if (!assert_ok(count > 0))
     return -1;
-  if (!assert_ok(count <= MAX_ITEMS_PER_GROUP))
+  if (!assert_ok(count <= session->limits.max_items_per_group))
     return -1;
   struct Rng* item_rng = c->rng;
   size_t* item_order = c->item_order;
 
+  start = metrics_start();
   rc = rng_shuffle_items(item_rng, item_order, count);
+  if (rc != 0)
+    return -1;
+  rc = count_shuffle(rt, start);
   if (rc != 0)
     return -1;
   rc = select_next_item(c, rt);
@@ -545,10 +647,14 @@ static int init_runtime(const struct ctx* c, struct runtime* rt) {
     return -1;
   size_t item_index = rt->item_index;
 
-  rc = draw_prompt(session, item_index);
+  rc = draw_prompt(session, &rt->frame, item_index);
   if (rc != 0)
     return -1;
-  rc = log_prompt(session, group_index, item_index);
+  rc = count_prompt(rt);
+  if (rc != 0)
+    return -1;
+  if (LOG_ENABLED(LOG_LEVEL_PROMPT))
+    rc = log_prompt(session, group_index, item_index);
   if (rc != 0)
     return -1;
   rc = update_group_timer(c, rt);
@@ -558,6 +664,7 @@ static int init_runtime(const struct ctx* c, struct runtime* rt) {
 }
 
 int runner_run(const struct TermState* term,
+    struct EventLoop* events,
     struct Session* session,
     struct Rng* rng,
     size_t* group_order,
@@ -566,6 +673,10 @@ int runner_run(const struct TermState* term,
     return -1;
   if (!assert_ok(term->active == 1))
     return -1;
+  if (!validate_ptr(events))
+    return -1;
+  if (!assert_ok(events->active == 1))
+    return -1;
   if (!validate_ptr(session))
     return -1;
   if (assert_session_bounds(session) != 0)
@@ -578,13 +689,15 @@ int runner_run(const struct TermState* term,
     return -1;
 
   struct ctx c = {
+    .events = events,
+    .tick_ms = 0,
     .session = session,
     .rng = rng,
     .group_order = group_order,
     .item_order = item_order,
   };
   struct runtime rt;
-  int rc = init_runtime(&c, &rt);
+  int rc = init_runtime(&c, &rt, STDOUT_FILENO);
 
   if (rc != 0)
     return -1;
@@ -593,3 +706,65 @@ int runner_run(const struct TermState* term,
     return -1;
   return 0;
 }
+
+int runner_script(struct Session* session,
+    struct Rng* rng,
+    size_t* group_order,
+    size_t* item_order,
+    const struct RunnerScript* script,
+    struct RunnerStats* out) {
+  if (!validate_ptr(session))
+    return -1;
+  if (assert_session_bounds(session) != 0)
+    return -1;
+  if (!validate_ptr(rng))
+    return -1;
+  if (!validate_ptr(group_order))
+    return -1;
+  if (!validate_ptr(item_order))
+    return -1;
+  if (!validate_ptr(script))
+    return -1;
+  if (!validate_ok(script->fd >= 0))
+    return -1;
+  if (!validate_ptr(out))
+    return -1;
+
+  struct ctx c = {
+    .events = NULL,
+    .tick_ms = script->tick_ms,
+    .session = session,
+    .rng = rng,
+    .group_order = group_order,
+    .item_order = item_order,
+  };
+  struct runtime rt;
+  int rc = init_runtime(&c, &rt, script->out_fd);
+
+  if (rc != 0)
+    return -1;
+
+  size_t shown = 1;
+
+  for (u64 i = 0; i < MAX_SCRIPT_READS; i++) {
+    if (shown >= MAX_PROMPTS_PER_RUN)
+      break;
+    rc = term_input_read(&rt.input, script->fd);
+    if (rc < 0)
+      return -1;
+    if (rc == 0)
+      break;
+
+    size_t advanced = 0;
+
+    rc = handle_keys(&c, &rt, MAX_PROMPTS_PER_RUN - shown, &advanced);
+    if (rc < 0)
+      return -1;
+    shown += advanced;
+    if (rc > 0)
+      break;
+  }
+  *out = rt.stats;
+  out->bytes = rt.frame.bytes_out;
+  return 0;
+}
@@ -0,0 +1,645 @@
+// SPDX-License-Identifier: MIT
+#include "scan.h"
+
+#include "config.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__SSE2__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#else
+#define SCAN_X86 0
+#endif
+
+enum scan_kernel {
+  SCAN_KERNEL_SCALAR = 0,
+  SCAN_KERNEL_SSE2 = 1,
+  SCAN_KERNEL_AVX2 = 2,
+};
+
+static int g_scan_kernel = SCAN_KERNEL_SCALAR;
+
+static int is_space_byte(unsigned char ch) {
+  return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+static size_t find_byte_scalar(const char* buf, size_t len, char ch) {
+  const char* hit = memchr(buf, ch, len);
+
+  if (!hit)
+    return len;
+  return (size_t)(hit - buf);
+}
+
+static size_t span_space_scalar(const char* buf, size_t start, size_t len) {
+  for (size_t i = start; i < MAX_DECK_BYTES; i++) {
+    if (i >= len)
+      break;
+    if (!is_space_byte((unsigned char)buf[i]))
+      return i;
+  }
+  return len;
+}
+
+static size_t rspan_space_scalar(const char* buf, size_t end, size_t start) {
+  for (size_t i = 0; i < MAX_DECK_BYTES; i++) {
+    if (end <= start)
+      break;
+    if (!is_space_byte((unsigned char)buf[end - 1]))
+      break;
+    end--;
+  }
+  return end;
+}
+
+static size_t split_line_scalar(const char* buf,
+    size_t start,
+    size_t len,
+    char sep,
+    size_t* cuts,
+    size_t max,
+    size_t* count) {
+  for (size_t i = start; i < MAX_DECK_BYTES; i++) {
+    if (i >= len)
+      break;
+    if (buf[i] == '\n')
+      return i;
+    if (buf[i] == sep && *count < max)
+      cuts[(*count)++] = i;
+  }
+  return len;
+}
+
+/* Validates the UTF-8 characters that start in [pos, stop) of s[0, len).
+ * Returns where the next one starts, or the offset of an invalid one
+ * (overlong, surrogate, above U+10FFFF, truncated or a stray continuation
+ * byte) with *bad set.
+ */
+static size_t utf8_scalar(const unsigned char* s,
+    size_t pos,
+    size_t stop,
+    size_t len,
+    int* bad) {
+  *bad = 0;
+  for (size_t i = 0; i < MAX_DECK_BYTES; i++) {
+    if (pos >= stop)
+      break;
+    unsigned char b0 = s[pos];
+
+    if (b0 < 0x80U) {
+      pos++;
+      continue;
+    }
+
+    size_t n = 0;
+    unsigned char lo = 0x80U;
+    unsigned char hi = 0xBFU;
+
+    if (b0 >= 0xC2U && b0 <= 0xDFU) {
+      n = 2;
+    } else if (b0 >= 0xE0U && b0 <= 0xEFU) {
+      n = 3;
+      lo = (b0 == 0xE0U) ? 0xA0U : lo;
+      hi = (b0 == 0xEDU) ? 0x9FU : hi;
+    } else if (b0 >= 0xF0U && b0 <= 0xF4U) {
+      n = 4;
+      lo = (b0 == 0xF0U) ? 0x90U : lo;
+      hi = (b0 == 0xF4U) ? 0x8FU : hi;
+    }
+
+    int ok = n > 0 && len - pos >= n && s[pos + 1] >= lo && s[pos + 1] <= hi;
+
+    for (size_t k = 2; k < 4U; k++) {
+      if (!ok || k >= n)
+        break;
+      ok = (s[pos + k] & 0xC0U) == 0x80U;
+    }
+    if (!ok) {
+      *bad = 1;
+      return pos;
+    }
+    pos += n;
+  }
+  return pos;
+}
+
+/* Where to check again from once a block at pos fails: the start of the
+ * character holding s[pos - 3], as a sequence that begins in the last 3
+ * bytes of the block before may be the one at fault.
+ */
+static size_t utf8_resume(const unsigned char* s, size_t pos) {
+  pos = (pos >= 3U) ? pos - 3U : 0;
+  for (size_t i = 0; i < 3U; i++) {
+    if (pos == 0 || (s[pos] & 0xC0U) != 0x80U)
+      break;
+    pos--;
+  }
+  return pos;
+}
+
+static size_t find_bad_utf8_scalar(
+    const unsigned char* s, size_t start, size_t len) {
+  int bad = 0;
+  size_t pos = utf8_scalar(s, start, len, len, &bad);
+
+  return bad ? pos : len;
+}
+
+/* Appends the offsets of the set bits of mask, lowest first. */
+static void take_cuts(
+    unsigned int mask, size_t base, size_t* cuts, size_t max, size_t* count) {
+  for (size_t k = 0; k < 32U; k++) {
+    if (!mask || *count >= max)
+      break;
+    cuts[(*count)++] = base + (size_t)__builtin_ctz(mask);
+    mask &= mask - 1U;
+  }
+}
+
+#if SCAN_X86
+/* Lane mask of bytes in " \t\n\v\f\r": equal to ' ', or (b - '\t') <= 4
+ * unsigned, tested as min(x, 4) == x.
+ */
+static unsigned int space_mask_sse2(__m128i v) {
+  __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+  __m128i x = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+  __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(4)), x);
+
+  return (unsigned int)_mm_movemask_epi8(_mm_or_si128(sp, ctl));
+}
+
+static size_t find_byte_sse2(const char* buf, size_t len, char ch) {
+  __m128i needle = _mm_set1_epi8(ch);
+  size_t i = 0;
+
+  for (size_t b = 0; b < MAX_DECK_BYTES / 16U; b++) {
+    if (len - i < 16U)
+      break;
+    __m128i v = _mm_loadu_si128((const __m128i*)(const void*)(buf + i));
+    unsigned int mask =
+        (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+
+    if (mask)
+      return i + (size_t)__builtin_ctz(mask);
+    i += 16U;
+  }
+  return i + find_byte_scalar(buf + i, len - i, ch);
+}
+
+static size_t span_space_sse2(const char* buf, size_t len) {
+  size_t i = 0;
+
+  for (size_t b = 0; b < MAX_DECK_BYTES / 16U; b++) {
+    if (len - i < 16U)
+      break;
+    __m128i v = _mm_loadu_si128((const __m128i*)(const void*)(buf + i));
+    unsigned int other = ~space_mask_sse2(v) & 0xFFFFU;
+
+    if (other)
+      return i + (size_t)__builtin_ctz(other);
+    i += 16U;
+  }
+  return span_space_scalar(buf, i, len);
+}
+
+static size_t rspan_space_sse2(const char* buf, size_t len, size_t start) {
+  size_t end = len;
+
+  for (size_t b = 0; b < MAX_DECK_BYTES / 16U; b++) {
+    if (end - start < 16U)
+      break;
+    __m128i v = _mm_loadu_si128((const __m128i*)(const void*)(buf + end - 16U));
+    unsigned int other = ~space_mask_sse2(v) & 0xFFFFU;
+
+    if (other)
+      return end - 16U + 32U - (size_t)__builtin_clz(other);
+    end -= 16U;
+  }
+  return rspan_space_scalar(buf, end, start);
+}
+
+/* One compare for the separators and one for the line end per block. */
+static size_t split_line_sse2(const char* buf,
+    size_t start,
+    size_t len,
+    char sep,
+    size_t* cuts,
+    size_t max,
+    size_t* count) {
+  __m128i sep_v = _mm_set1_epi8(sep);
+  __m128i nl_v = _mm_set1_epi8('\n');
+  size_t i = start;
+
+  for (size_t b = 0; b < MAX_DECK_BYTES / 16U; b++) {
+    if (len - i < 16U)
+      break;
+    __m128i v = _mm_loadu_si128((const __m128i*)(const void*)(buf + i));
+    unsigned int nl = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl_v));
+    unsigned int seps =
+        (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, sep_v));
+
+    if (nl) {
+      unsigned int end = (unsigned int)__builtin_ctz(nl);
+
+      take_cuts(seps & ((1U << end) - 1U), i, cuts, max, count);
+      return i + end;
+    }
+    take_cuts(seps, i, cuts, max, count);
+    i += 16U;
+  }
+  return split_line_scalar(buf, i, len, sep, cuts, max, count);
+}
+
+/* ASCII blocks are skipped 16 bytes at a time; SSE2 has no byte shuffle
+ * for the table lookups the AVX2 kernel does, so the rest goes through
+ * utf8_scalar().
+ */
+static size_t find_bad_utf8_sse2(const unsigned char* s, size_t len) {
+  size_t i = 0;
+
+  for (size_t b = 0; b < MAX_DECK_BYTES / 16U; b++) {
+    if (len - i < 16U)
+      break;
+    __m128i v = _mm_loadu_si128((const __m128i*)(const void*)(s + i));
+
+    if (_mm_movemask_epi8(v) == 0) {
+      i += 16U;
+      continue;
+    }
+
+    int bad = 0;
+
+    i = utf8_scalar(s, i, i + 16U, len, &bad);
+    if (bad)
+      return i;
+  }
+  return find_bad_utf8_scalar(s, i, len);
+}
+
+__attribute__((target("avx2"))) static unsigned int space_mask_avx2(
+    __m256i v) {
+  __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+  __m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+  __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(4)), x);
+
+  return (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(sp, ctl));
+}
+
+__attribute__((target("avx2"))) static size_t find_byte_avx2(
+    const char* buf, size_t len, char ch) {
+  __m256i needle = _mm256_set1_epi8(ch);
+  size_t i = 0;
+
+  for (size_t b = 0; b < MAX_DECK_BYTES / 32U; b++) {
+    if (len - i < 32U)
+      break;
+    __m256i v = _mm256_loadu_si256((const __m256i*)(const void*)(buf + i));
+    unsigned int mask =
+        (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+
+    if (mask)
+      return i + (size_t)__builtin_ctz(mask);
+    i += 32U;
+  }
+  return i + find_byte_sse2(buf + i, len - i, ch);
+}
+
+__attribute__((target("avx2"))) static size_t span_space_avx2(
+    const char* buf, size_t len) {
+  size_t i = 0;
+
+  for (size_t b = 0; b < MAX_DECK_BYTES / 32U; b++) {
+    if (len - i < 32U)
+      break;
+    __m256i v = _mm256_loadu_si256((const __m256i*)(const void*)(buf + i));
+    unsigned int other = ~space_mask_avx2(v);
+
+    if (other)
+      return i + (size_t)__builtin_ctz(other);
+    i += 32U;
+  }
+  return i + span_space_sse2(buf + i, len - i);
+}
+
+__attribute__((target("avx2"))) static size_t rspan_space_avx2(
+    const char* buf, size_t len, size_t start) {
+  size_t end = len;
+
+  for (size_t b = 0; b < MAX_DECK_BYTES / 32U; b++) {
+    if (end - start < 32U)
+      break;
+    __m256i v =
+        _mm256_loadu_si256((const __m256i*)(const void*)(buf + end - 32U));
+    unsigned int other = ~space_mask_avx2(v);
+
+    if (other)
+      return end - (size_t)__builtin_clz(other);
+    end -= 32U;
+  }
+  return rspan_space_sse2(buf, end, start);
+}
+
+__attribute__((target("avx2"))) static size_t split_line_avx2(
+    const char* buf,
+    size_t len,
+    char sep,
+    size_t* cuts,
+    size_t max,
+    size_t* count) {
+  __m256i sep_v = _mm256_set1_epi8(sep);
+  __m256i nl_v = _mm256_set1_epi8('\n');
+  size_t i = 0;
+
+  for (size_t b = 0; b < MAX_DECK_BYTES / 32U; b++) {
+    if (len - i < 32U)
+      break;
+    __m256i v = _mm256_loadu_si256((const __m256i*)(const void*)(buf + i));
+    unsigned int nl =
+        (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl_v));
+    unsigned int seps =
+        (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, sep_v));
+
+    if (nl) {
+      unsigned int end = (unsigned int)__builtin_ctz(nl);
+      unsigned int keep = (end == 0) ? 0 : (0xFFFFFFFFU >> (32U - end));
+
+      take_cuts(seps & keep, i, cuts, max, count);
+      return i + end;
+    }
+    take_cuts(seps, i, cuts, max, count);
+    i += 32U;
+  }
+  return split_line_sse2(buf, i, len, sep, cuts, max, count);
+}
+/* Error classes of the lookup tables below, after Keiser and Lemire,
+ * "Validating UTF-8 In Less Than One Instruction Per Byte" (2021). Each
+ * byte pair is classified by the high nibble of the first byte, its low
+ * nibble and the high nibble of the second; a pair is invalid when all
+ * three lookups share a bit. TWO_CONTS marks a continuation byte after a
+ * continuation byte, which is only valid where a 3 or 4 byte sequence
+ * calls for it.
+ */
+#define UTF8_TOO_SHORT 0x01U
+#define UTF8_TOO_LONG 0x02U
+#define UTF8_OVERLONG_3 0x04U
+#define UTF8_TOO_LARGE 0x08U
+#define UTF8_SURROGATE 0x10U
+#define UTF8_OVERLONG_2 0x20U
+#define UTF8_TOO_LARGE_1000 0x40U
+#define UTF8_OVERLONG_4 0x40U
+#define UTF8_TWO_CONTS 0x80U
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+#define UTF8_LARGE (UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000)
+#define UTF8_CONT (UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS)
+
+static const unsigned char utf8_byte_1_high[16] = {
+    UTF8_TOO_LONG,
+    UTF8_TOO_LONG,
+    UTF8_TOO_LONG,
+    UTF8_TOO_LONG,
+    UTF8_TOO_LONG,
+    UTF8_TOO_LONG,
+    UTF8_TOO_LONG,
+    UTF8_TOO_LONG,
+    UTF8_TWO_CONTS,
+    UTF8_TWO_CONTS,
+    UTF8_TWO_CONTS,
+    UTF8_TWO_CONTS,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    UTF8_TOO_SHORT | UTF8_LARGE | UTF8_OVERLONG_4,
+};
+
+static const unsigned char utf8_byte_1_low[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_LARGE,
+    UTF8_CARRY | UTF8_LARGE,
+    UTF8_CARRY | UTF8_LARGE,
+    UTF8_CARRY | UTF8_LARGE,
+    UTF8_CARRY | UTF8_LARGE,
+    UTF8_CARRY | UTF8_LARGE,
+    UTF8_CARRY | UTF8_LARGE,
+    UTF8_CARRY | UTF8_LARGE,
+    UTF8_CARRY | UTF8_LARGE | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_LARGE,
+    UTF8_CARRY | UTF8_LARGE,
+};
+
+static const unsigned char utf8_byte_2_high[16] = {
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT,
+    UTF8_CONT | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    UTF8_CONT | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+    UTF8_CONT | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_CONT | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT,
+};
+
+/* Largest byte that may end a block without starting a sequence that runs
+ * past it.
+ */
+static const unsigned char utf8_max_tail[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF,
+};
+
+__attribute__((target("avx2"))) static __m256i utf8_lookup_avx2(
+    const unsigned char* table, __m256i nibbles) {
+  __m128i t = _mm_loadu_si128((const __m128i*)(const void*)table);
+
+  return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(t), nibbles);
+}
+
+/* Nonzero lanes are errors in the sequences that end in v, given the
+ * block before it.
+ */
+__attribute__((target("avx2"))) static __m256i utf8_errors_avx2(
+    __m256i v, __m256i prev) {
+  __m256i low_nibble = _mm256_set1_epi8(0x0F);
+  __m256i shifted = _mm256_permute2x128_si256(prev, v, 0x21);
+  __m256i prev1 = _mm256_alignr_epi8(v, shifted, 15);
+  __m256i prev2 = _mm256_alignr_epi8(v, shifted, 14);
+  __m256i prev3 = _mm256_alignr_epi8(v, shifted, 13);
+  __m256i high1 = _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble);
+  __m256i low1 = _mm256_and_si256(prev1, low_nibble);
+  __m256i high2 = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble);
+  __m256i special =
+      _mm256_and_si256(_mm256_and_si256(utf8_lookup_avx2(utf8_byte_1_high,
+                                            high1),
+                           utf8_lookup_avx2(utf8_byte_1_low, low1)),
+          utf8_lookup_avx2(utf8_byte_2_high, high2));
+  /* Only the second byte after 111_____ and the third after 1111____
+   * reach 0x80 here: the continuations TWO_CONTS must allow.
+   */
+  __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(0x60));
+  __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(0x70));
+  __m256i must = _mm256_and_si256(
+      _mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+
+  return _mm256_xor_si256(must, special);
+}
+
+/* On an error, utf8_scalar() goes over the failing block again to find
+ * the offset; so it does over the tail.
+ */
+__attribute__((target("avx2"))) static size_t find_bad_utf8_avx2(
+    const unsigned char* s, size_t len) {
+  __m256i max_tail =
+      _mm256_loadu_si256((const __m256i*)(const void*)utf8_max_tail);
+  __m256i prev = _mm256_setzero_si256();
+  __m256i incomplete = _mm256_setzero_si256();
+  size_t i = 0;
+
+  for (size_t b = 0; b < MAX_DECK_BYTES / 32U; b++) {
+    if (len - i < 32U)
+      break;
+    __m256i v = _mm256_loadu_si256((const __m256i*)(const void*)(s + i));
+    __m256i errors = incomplete;
+
+    if (_mm256_movemask_epi8(v) != 0) {
+      errors = utf8_errors_avx2(v, prev);
+      incomplete = _mm256_subs_epu8(v, max_tail);
+    } else {
+      incomplete = _mm256_setzero_si256();
+    }
+    if (!_mm256_testz_si256(errors, errors))
+      return find_bad_utf8_scalar(s, utf8_resume(s, i), len);
+    prev = v;
+    i += 32U;
+  }
+  return find_bad_utf8_scalar(s, utf8_resume(s, i), len);
+}
+#endif
+
+int scan_init(void) {
+  g_scan_kernel = SCAN_KERNEL_SCALAR;
+#if SCAN_X86
+  g_scan_kernel = SCAN_KERNEL_SSE2;
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    g_scan_kernel = SCAN_KERNEL_AVX2;
+#endif
+  return 0;
+}
+
+const char* scan_kernel_name(void) {
+  switch (g_scan_kernel) {
+    case SCAN_KERNEL_AVX2:
+      return "avx2";
+    case SCAN_KERNEL_SSE2:
+      return "sse2";
+    default:
+      return "scalar";
+  }
+}
+
+size_t scan_find_byte(const char* buf, size_t len, char ch) {
+  if (!assert_ptr(buf))
+    return len;
+
+  switch (g_scan_kernel) {
+#if SCAN_X86
+    case SCAN_KERNEL_AVX2:
+      return find_byte_avx2(buf, len, ch);
+    case SCAN_KERNEL_SSE2:
+      return find_byte_sse2(buf, len, ch);
+#endif
+    default:
+      return find_byte_scalar(buf, len, ch);
+  }
+}
+
+size_t scan_span_space(const char* buf, size_t len) {
+  if (!assert_ptr(buf))
+    return len;
+
+  switch (g_scan_kernel) {
+#if SCAN_X86
+    case SCAN_KERNEL_AVX2:
+      return span_space_avx2(buf, len);
+    case SCAN_KERNEL_SSE2:
+      return span_space_sse2(buf, len);
+#endif
+    default:
+      return span_space_scalar(buf, 0, len);
+  }
+}
+
+size_t scan_rspan_space(const char* buf, size_t len, size_t start) {
+  if (!assert_ptr(buf))
+    return start;
+  if (!assert_ok(start <= len))
+    return start;
+
+  switch (g_scan_kernel) {
+#if SCAN_X86
+    case SCAN_KERNEL_AVX2:
+      return rspan_space_avx2(buf, len, start);
+    case SCAN_KERNEL_SSE2:
+      return rspan_space_sse2(buf, len, start);
+#endif
+    default:
+      return rspan_space_scalar(buf, len, start);
+  }
+}
+
+size_t scan_split_line(const char* buf,
+    size_t len,
+    char sep,
+    size_t* cuts,
+    size_t max,
+    size_t* count) {
+  if (!assert_ptr(count))
+    return len;
+  *count = 0;
+  if (!assert_ptr(buf))
+    return len;
+  if (!assert_ptr(cuts))
+    return len;
+
+  switch (g_scan_kernel) {
+#if SCAN_X86
+    case SCAN_KERNEL_AVX2:
+      return split_line_avx2(buf, len, sep, cuts, max, count);
+    case SCAN_KERNEL_SSE2:
+      return split_line_sse2(buf, 0, len, sep, cuts, max, count);
+#endif
+    default:
+      return split_line_scalar(buf, 0, len, sep, cuts, max, count);
+  }
+}
+
+size_t scan_find_bad_utf8(const char* buf, size_t len) {
+  if (!assert_ptr(buf))
+    return 0;
+
+  const unsigned char* s = (const unsigned char*)buf;
+
+  switch (g_scan_kernel) {
+#if SCAN_X86
+    case SCAN_KERNEL_AVX2:
+      return find_bad_utf8_avx2(s, len);
+    case SCAN_KERNEL_SSE2:
+      return find_bad_utf8_sse2(s, len);
+#endif
+    default:
+      return find_bad_utf8_scalar(s, 0, len);
+  }
+}
@@ -0,0 +1,657 @@
+// SPDX-License-Identifier: MIT
+#include "stats.h"
+#include "config.h"
+#include "hist.h"
+#include "logfmt.h"
+#include "scan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STATS_MAX_CUTS 16U
+#define STATS_TYPES (LOG_TYPE_SEGMENT + 1)
+
+/* Key-gap state for one session ID within one part of the file. */
+struct stats_sid {
+  u64 sid;
+  /* The first key, when no start or exit came before it in this part. */
+  u64 first_key;
+  u64 last_key;
+  int used;
+  int has_first;
+  /* last_key is valid: no start or exit came after it. */
+  int has_last;
+  int saw_reset;
+};
+
+/* A start or exit, kept in file order for pairing into sessions. */
+struct stats_mark {
+  u64 sid;
+  u64 time_ms;
+  u32 type;
+  u32 reserved;
+};
+
+struct stats_part {
+  const char* buf;
+  size_t len;
+  u64 lines;
+  u64 malformed;
+  u64 over_cap;
+  u64 untracked;
+  u64 marks_lost;
+  /* Events a session dropped from a full async ring, from its exit. */
+  u64 dropped;
+  u64 events[STATS_TYPES];
+  struct Hist gaps;
+  struct stats_sid sids[STATS_MAX_SIDS];
+  size_t mark_count;
+  struct stats_mark* marks;
+  u64* group_prompts;
+  u64* group_expired;
+  u64* group_shuffles;
+  u64* item_prompts;
+};
+
+static struct stats_part g_parts[MAX_PARSE_THREADS];
+static struct Hist g_sessions;
+/* strlen(logfmt_tag(type)), filled in before the scan. */
+static size_t g_tag_len[STATS_TYPES];
+
+static int set_error(char* err_buf, size_t err_len, const char* msg) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ptr(msg))
+    return -1;
+
+  int rc = snprintf(err_buf, err_len, "%s", msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+static int parse_dec(const char* p, size_t len, u64* out) {
+  if (len == 0 || len > 19)
+    return -1;
+
+  u64 value = 0;
+
+  for (size_t i = 0; i < 19; i++) {
+    if (i >= len)
+      break;
+    if (p[i] < '0' || p[i] > '9')
+      return -1;
+    value = value * 10U + (u64)(p[i] - '0');
+  }
+  *out = value;
+  return 0;
+}
+
+static int parse_sid(const char* p, size_t len, u64* out) {
+  if (len != 16)
+    return -1;
+
+  u64 value = 0;
+
+  for (size_t i = 0; i < 16; i++) {
+    char ch = p[i];
+    u64 digit = 0;
+
+    if (ch >= '0' && ch <= '9')
+      digit = (u64)(ch - '0');
+    else if (ch >= 'a' && ch <= 'f')
+      digit = (u64)(ch - 'a' + 10);
+    else
+      return -1;
+    value = value << 4 | digit;
+  }
+  *out = value;
+  return 0;
+}
+
+/* "<sec>.<ms>" to milliseconds. */
+static int parse_time(const char* p, size_t len, u64* out) {
+  u64 sec = 0;
+  u64 ms = 0;
+
+  if (len < 5 || p[len - 4] != '.')
+    return -1;
+  if (parse_dec(p, len - 4, &sec) != 0)
+    return -1;
+  if (parse_dec(p + len - 3, 3, &ms) != 0)
+    return -1;
+  *out = sec * 1000U + ms;
+  return 0;
+}
+
+/* "[tag]" to its LOG_TYPE_*, or 0. */
+static u32 parse_tag(const char* p, size_t len) {
+  if (len < 3 || p[0] != '[' || p[len - 1] != ']')
+    return 0;
+  for (u32 type = LOG_TYPE_START; type < STATS_TYPES; type++) {
+    if (g_tag_len[type] == len - 2 &&
+        memcmp(logfmt_tag(type), p + 1, len - 2) == 0)
+      return type;
+  }
+  return 0;
+}
+
+/* The number after '=' in "name=value". */
+static int parse_field(const char* p, size_t len, u64* out) {
+  const char* eq = memchr(p, '=', len);
+
+  if (!eq)
+    return -1;
+  return parse_dec(eq + 1, len - (size_t)(eq + 1 - p), out);
+}
+
+static struct stats_sid* find_sid(struct stats_sid* table, u64 sid) {
+  for (size_t i = 0; i < STATS_MAX_SIDS; i++) {
+    if (!table[i].used) {
+      memset(&table[i], 0, sizeof(table[i]));
+      table[i].used = 1;
+      table[i].sid = sid;
+      return &table[i];
+    }
+    if (table[i].sid == sid)
+      return &table[i];
+  }
+  return NULL;
+}
+
+static void count_index(struct stats_part* part, u64* counts, u64 cap, u64 i) {
+  if (i < cap)
+    counts[i]++;
+  else
+    part->over_cap++;
+}
+
+static void take_key(struct stats_part* part, struct stats_sid* s, u64 t) {
+  if (s->has_last) {
+    if (t >= s->last_key)
+      hist_add(&part->gaps, t - s->last_key);
+  } else if (!s->saw_reset && !s->has_first) {
+    s->first_key = t;
+    s->has_first = 1;
+  }
+  s->last_key = t;
+  s->has_last = 1;
+}
+
+static void take_mark(
+    struct stats_part* part, struct stats_sid* s, u64 sid, u64 t, u32 type) {
+  if (s) {
+    s->has_last = 0;
+    s->saw_reset = 1;
+  }
+  if (part->mark_count >= STATS_MAX_MARKS) {
+    part->marks_lost++;
+    return;
+  }
+
+  struct stats_mark* mark = &part->marks[part->mark_count++];
+
+  mark->sid = sid;
+  mark->time_ms = t;
+  mark->type = type;
+}
+
+static void take_line(struct stats_part* part,
+    const char* line,
+    size_t len,
+    const size_t* cuts,
+    size_t cut_count) {
+  /* Field k spans [starts[k], ends[k]). */
+  size_t starts[STATS_MAX_CUTS + 1];
+  size_t ends[STATS_MAX_CUTS + 1];
+  size_t fields = cut_count + 1;
+
+  for (size_t k = 0; k <= STATS_MAX_CUTS; k++) {
+    if (k >= fields)
+      break;
+    starts[k] = (k == 0) ? 0 : cuts[k - 1] + 1;
+    ends[k] = (k < cut_count) ? cuts[k] : len;
+  }
+
+  u64 t = 0;
+  u64 sid = 0;
+  size_t at = 1;
+
+  if (fields < 3 || parse_time(line, ends[0], &t) != 0) {
+    part->malformed++;
+    return;
+  }
+  if (ends[1] == starts[1]) {
+    part->malformed++;
+    return;
+  }
+  if (line[starts[1]] != '[') {
+    if (parse_sid(line + starts[1], ends[1] - starts[1], &sid) != 0) {
+      part->malformed++;
+      return;
+    }
+    at = 2;
+  }
+
+  u32 type = parse_tag(line + starts[at], ends[at] - starts[at]);
+  u64 a = 0;
+  u64 b = 0;
+  int have_a = (at + 1 < fields) &&
+      parse_field(line + starts[at + 1], ends[at + 1] - starts[at + 1], &a) ==
+          0;
+  int have_b = (at + 2 < fields) &&
+      parse_field(line + starts[at + 2], ends[at + 2] - starts[at + 2], &b) ==
+          0;
+
+  if (type == 0) {
+    part->malformed++;
+    return;
+  }
+  part->events[type]++;
+
+  struct stats_sid* s = NULL;
+
+  if (type == LOG_TYPE_KEY || type == LOG_TYPE_START ||
+      type == LOG_TYPE_EXIT) {
+    s = find_sid(part->sids, sid);
+    if (!s)
+      part->untracked++;
+  }
+  switch (type) {
+    case LOG_TYPE_PROMPT:
+      if (!have_a || !have_b) {
+        part->malformed++;
+        break;
+      }
+      count_index(part, part->group_prompts, MAX_GROUPS, a);
+      count_index(part, part->item_prompts, MAX_ITEMS_TOTAL, b);
+      break;
+    case LOG_TYPE_EXPIRED:
+      if (have_a)
+        count_index(part, part->group_expired, MAX_GROUPS, a);
+      break;
+    case LOG_TYPE_ITEMS:
+      if (have_a)
+        count_index(part, part->group_shuffles, MAX_GROUPS, a);
+      break;
+    case LOG_TYPE_KEY:
+      if (s)
+        take_key(part, s, t);
+      break;
+    case LOG_TYPE_START:
+    case LOG_TYPE_EXIT:
+      take_mark(part, s, sid, t, type);
+      /* "session end dropped=N" */
+      if (type == LOG_TYPE_EXIT && at + 3 < fields &&
+          parse_field(line + starts[at + 3],
+              ends[at + 3] - starts[at + 3],
+              &a) == 0)
+        part->dropped += a;
+      break;
+    default:
+      break;
+  }
+}
+
+static void* stats_worker(void* arg) {
+  struct stats_part* part = arg;
+  size_t pos = 0;
+
+  for (u64 i = 0; i < MAX_STATS_LINES; i++) {
+    if (pos >= part->len)
+      break;
+
+    size_t cuts[STATS_MAX_CUTS];
+    size_t cut_count = 0;
+    const char* line = part->buf + pos;
+    size_t len = scan_split_line(
+        line, part->len - pos, ' ', cuts, STATS_MAX_CUTS, &cut_count);
+
+    part->lines++;
+    take_line(part, line, len, cuts, cut_count);
+    pos += len + 1;
+  }
+  return NULL;
+}
+
+static size_t part_bytes(void) {
+  return (3U * (size_t)MAX_GROUPS + (size_t)MAX_ITEMS_TOTAL) * sizeof(u64) +
+      (size_t)STATS_MAX_MARKS * sizeof(struct stats_mark);
+}
+
+/* Newline-aligned parts, one per thread; memory for each part's tables is
+ * taken here, before the scan.
+ */
+static int setup_parts(const char* buf, size_t len, size_t count) {
+  size_t start = 0;
+
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+
+    struct stats_part* part = &g_parts[i];
+    size_t end = len;
+
+    if (i + 1 < count) {
+      end = len / count * (i + 1);
+      if (end < start)
+        end = start;
+      end += scan_find_byte(buf + end, len - end, '\n');
+      if (end < len)
+        end++;
+    }
+    memset(part, 0, sizeof(*part));
+    part->buf = buf + start;
+    part->len = end - start;
+    start = end;
+
+    u64* counts = calloc(1, part_bytes());
+
+    if (!counts)
+      return -1;
+    part->group_prompts = counts;
+    part->group_expired = counts + MAX_GROUPS;
+    part->group_shuffles = counts + 2U * MAX_GROUPS;
+    part->item_prompts = counts + 3U * MAX_GROUPS;
+    part->marks = (struct stats_mark*)(counts + 3U * MAX_GROUPS +
+        MAX_ITEMS_TOTAL);
+  }
+  return 0;
+}
+
+static void free_parts(size_t count) {
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    free(g_parts[i].group_prompts);
+    g_parts[i].group_prompts = NULL;
+  }
+}
+
+static void scan_parts(size_t count) {
+  pthread_t tids[MAX_PARSE_THREADS];
+  int started[MAX_PARSE_THREADS];
+
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    started[i] = 0;
+    if (i > 0)
+      started[i] =
+          (pthread_create(&tids[i], NULL, stats_worker, &g_parts[i]) == 0);
+  }
+  stats_worker(&g_parts[0]);
+  for (size_t i = 1; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+    if (!started[i] || pthread_join(tids[i], NULL) != 0)
+      stats_worker(&g_parts[i]);
+  }
+}
+
+/* Joins the key gaps that straddle two parts and pairs starts with exits,
+ * walking the parts in file order. Everything else is summed into part 0.
+ */
+static void merge_parts(size_t count, u64* unterminated) {
+  struct stats_part* total = &g_parts[0];
+  struct stats_sid carry[STATS_MAX_SIDS];
+  struct stats_mark open[STATS_MAX_SIDS];
+  size_t open_count = 0;
+
+  memset(carry, 0, sizeof(carry));
+  hist_reset(&g_sessions);
+  *unterminated = 0;
+  for (size_t i = 0; i < MAX_PARSE_THREADS; i++) {
+    if (i >= count)
+      break;
+
+    struct stats_part* part = &g_parts[i];
+
+    for (size_t k = 0; k < STATS_MAX_SIDS; k++) {
+      const struct stats_sid* e = &part->sids[k];
+
+      if (!e->used)
+        break;
+
+      struct stats_sid* c = find_sid(carry, e->sid);
+
+      if (!c) {
+        total->untracked++;
+        continue;
+      }
+      if (i > 0 && e->has_first && c->has_last && e->first_key >= c->last_key)
+        hist_add(&total->gaps, e->first_key - c->last_key);
+      if (e->has_last) {
+        c->last_key = e->last_key;
+        c->has_last = 1;
+      } else if (e->saw_reset) {
+        c->has_last = 0;
+      }
+    }
+    for (size_t m = 0; m < STATS_MAX_MARKS; m++) {
+      if (m >= part->mark_count)
+        break;
+
+      const struct stats_mark* mark = &part->marks[m];
+      size_t at = open_count;
+
+      for (size_t k = 0; k < STATS_MAX_SIDS; k++) {
+        if (k >= open_count)
+          break;
+        if (open[k].sid == mark->sid) {
+          at = k;
+          break;
+        }
+      }
+      if (at < open_count) {
+        if (mark->type == LOG_TYPE_START)
+          (*unterminated)++;
+        else if (mark->time_ms >= open[at].time_ms)
+          hist_add(&g_sessions, mark->time_ms - open[at].time_ms);
+        open[at] = open[--open_count];
+      }
+      if (mark->type == LOG_TYPE_START && open_count < STATS_MAX_SIDS)
+        open[open_count++] = *mark;
+    }
+    if (i == 0)
+      continue;
+    total->lines += part->lines;
+    total->malformed += part->malformed;
+    total->over_cap += part->over_cap;
+    total->untracked += part->untracked;
+    total->marks_lost += part->marks_lost;
+    total->dropped += part->dropped;
+    for (size_t t = 0; t < STATS_TYPES; t++)
+      total->events[t] += part->events[t];
+    hist_merge(&total->gaps, &part->gaps);
+    for (size_t g = 0; g < MAX_GROUPS; g++) {
+      total->group_prompts[g] += part->group_prompts[g];
+      total->group_expired[g] += part->group_expired[g];
+      total->group_shuffles[g] += part->group_shuffles[g];
+    }
+    for (size_t it = 0; it < MAX_ITEMS_TOTAL; it++)
+      total->item_prompts[it] += part->item_prompts[it];
+  }
+  *unterminated += open_count;
+}
+
+static int print_hist(const char* name, const struct Hist* h) {
+  u64 mean = (h->count > 0) ? h->sum / h->count : 0;
+  int rc = printf(
+      "%s: count=%llu min=%llu p50=%llu p90=%llu p99=%llu max=%llu "
+      "mean=%llu\n",
+      name,
+      (unsigned long long)h->count,
+      (unsigned long long)h->min,
+      (unsigned long long)hist_quantile(h, 50, 100),
+      (unsigned long long)hist_quantile(h, 90, 100),
+      (unsigned long long)hist_quantile(h, 99, 100),
+      (unsigned long long)h->max,
+      (unsigned long long)mean);
+
+  return (rc < 0) ? -1 : 0;
+}
+
+/* One line per non-empty power-of-two range: "  [low, high) count". */
+static int print_ranges(const struct Hist* h) {
+  for (size_t e = 0; e < 64; e++) {
+    u64 low = (e == 0) ? 0 : 1ULL << (e - 1);
+    u64 high = 1ULL << e;
+
+    if (low > h->max)
+      break;
+
+    u64 n = hist_count_range(h, low, high);
+
+    if (n == 0)
+      continue;
+    if (printf("  [%llu, %llu) %llu\n",
+            (unsigned long long)low,
+            (unsigned long long)high,
+            (unsigned long long)n) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int print_report(const char* path, size_t len, size_t count, u64 us) {
+  const struct stats_part* t = &g_parts[0];
+  u64 unterminated = 0;
+
+  merge_parts(count, &unterminated);
+  if (printf("file=%s bytes=%zu lines=%llu threads=%zu scan_us=%llu\n",
+          path,
+          len,
+          (unsigned long long)t->lines,
+          count,
+          (unsigned long long)us) < 0)
+    return -1;
+  if (printf("events:") < 0)
+    return -1;
+  for (u32 type = LOG_TYPE_START; type < STATS_TYPES; type++) {
+    if (printf(" %s=%llu",
+            logfmt_tag(type),
+            (unsigned long long)t->events[type]) < 0)
+      return -1;
+  }
+  if (printf(" malformed=%llu\n", (unsigned long long)t->malformed) < 0)
+    return -1;
+  if (printf("sessions: unterminated=%llu dropped_events=%llu\n",
+          (unsigned long long)unterminated,
+          (unsigned long long)t->dropped) < 0)
+    return -1;
+  if (print_hist("session_ms", &g_sessions) != 0)
+    return -1;
+  if (print_hist("inter_key_ms", &t->gaps) != 0)
+    return -1;
+  if (print_ranges(&t->gaps) != 0)
+    return -1;
+  for (size_t g = 0; g < MAX_GROUPS; g++) {
+    if (!t->group_prompts[g] && !t->group_expired[g] && !t->group_shuffles[g])
+      continue;
+    if (printf("group=%zu prompts=%llu expired=%llu reshuffles=%llu\n",
+            g,
+            (unsigned long long)t->group_prompts[g],
+            (unsigned long long)t->group_expired[g],
+            (unsigned long long)t->group_shuffles[g]) < 0)
+      return -1;
+  }
+  for (size_t it = 0; it < MAX_ITEMS_TOTAL; it++) {
+    if (!t->item_prompts[it])
+      continue;
+    if (printf("item=%zu prompts=%llu\n",
+            it,
+            (unsigned long long)t->item_prompts[it]) < 0)
+      return -1;
+  }
+  if (t->over_cap || t->untracked || t->marks_lost) {
+    if (fprintf(stderr,
+            "Warning: not counted: %llu indexes over the table size, %llu "
+            "events beyond %u concurrent sessions, %llu session marks\n",
+            (unsigned long long)t->over_cap,
+            (unsigned long long)t->untracked,
+            STATS_MAX_SIDS,
+            (unsigned long long)t->marks_lost) < 0)
+      return -1;
+  }
+  return (fflush(stdout) == 0) ? 0 : -1;
+}
+
+static u64 now_us(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return (u64)ts.tv_sec * 1000000ULL + (u64)(ts.tv_nsec / 1000L);
+}
+
+int stats_run(const char* path, size_t threads, char* err_buf, size_t err_len) {
+  if (!validate_ptr(path))
+    return -1;
+  if (!validate_ok(threads >= 1 && threads <= MAX_PARSE_THREADS))
+    return -1;
+
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0)
+    return set_error(err_buf, err_len, strerror(errno));
+
+  struct stat st;
+  const char* buf = "";
+  size_t len = 0;
+  int rc = fstat(fd, &st);
+
+  if (rc == 0 && !S_ISREG(st.st_mode))
+    rc = -1;
+  if (rc == 0 && st.st_size > 0) {
+    void* base =
+        mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (base == MAP_FAILED) {
+      rc = -1;
+    } else {
+      buf = base;
+      len = (size_t)st.st_size;
+      posix_madvise(base, len, POSIX_MADV_SEQUENTIAL);
+    }
+  }
+  if (close(fd) != 0 || rc != 0) {
+    if (len > 0)
+      munmap((void*)buf, len);
+    return set_error(err_buf, err_len, "cannot map log file");
+  }
+
+  for (u32 type = LOG_TYPE_START; type < STATS_TYPES; type++)
+    g_tag_len[type] = strlen(logfmt_tag(type));
+
+  size_t count = len / STATS_CHUNK_MIN_BYTES;
+
+  if (count > threads)
+    count = threads;
+  if (count < 1)
+    count = 1;
+  if (setup_parts(buf, len, count) != 0) {
+    rc = set_error(err_buf, err_len, "out of memory");
+  } else {
+    u64 start = now_us();
+
+    scan_parts(count);
+    if (print_report(path, len, count, now_us() - start) != 0)
+      rc = set_error(err_buf, err_len, "cannot write report");
+  }
+  free_parts(count);
+  if (len > 0 && munmap((void*)buf, len) != 0)
+    rc = set_error(err_buf, err_len, strerror(errno));
+  return rc;
+}
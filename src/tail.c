@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: MIT
+#include "tail.h"
+#include "config.h"
+#include "logfmt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TAIL_RING_BYTES \
+  (LOG_RING_HEADER_BYTES + (size_t)LOG_SHARED_SLOTS * LOG_RING_SLOT_BYTES)
+
+static int set_error(char* err_buf, size_t err_len, const char* msg) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ptr(msg))
+    return -1;
+
+  int rc = snprintf(err_buf, err_len, "%s", msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+static const struct LogRingHeader* map_ring(
+    const char* path, char* err_buf, size_t err_len) {
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) {
+    set_error(err_buf, err_len, strerror(errno));
+    return NULL;
+  }
+
+  struct stat st;
+  void* base = MAP_FAILED;
+
+  if (fstat(fd, &st) == 0 && st.st_size == (off_t)TAIL_RING_BYTES)
+    base = mmap(NULL, TAIL_RING_BYTES, PROT_READ, MAP_SHARED, fd, 0);
+  if (close(fd) != 0 || base == MAP_FAILED) {
+    if (base != MAP_FAILED)
+      munmap(base, TAIL_RING_BYTES);
+    set_error(err_buf, err_len, "not a cram ring log");
+    return NULL;
+  }
+
+  const struct LogRingHeader* header = base;
+
+  if (logfmt_ring_check(header) != 0) {
+    munmap(base, TAIL_RING_BYTES);
+    set_error(err_buf, err_len, "not a cram ring log");
+    return NULL;
+  }
+  return header;
+}
+
+/* Copies event seq out of its slot; 0 if it was overwritten meanwhile. */
+static int read_slot(const struct LogRingHeader* header,
+    u64 seq,
+    struct LogRecord* rec) {
+  const struct LogRingSlot* slots = (const struct LogRingSlot*)(
+      (const char*)header + LOG_RING_HEADER_BYTES);
+  const struct LogRingSlot* slot = &slots[seq % LOG_SHARED_SLOTS];
+  u64 want = 2U * seq + 2U;
+  u64 words[LOG_RING_RECORD_WORDS];
+
+  if (atomic_load_explicit(&slot->seq, memory_order_acquire) != want)
+    return 0;
+  for (size_t i = 0; i < LOG_RING_RECORD_WORDS; i++)
+    words[i] = atomic_load_explicit(&slot->rec[i], memory_order_relaxed);
+  memcpy(rec, words, sizeof(*rec));
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&slot->seq, memory_order_relaxed) == want;
+}
+
+static int print_skipped(u64 count) {
+  if (count == 0)
+    return 0;
+
+  int rc = fprintf(stderr,
+      "cram tail: skipped %llu overwritten events\n",
+      (unsigned long long)count);
+
+  return (rc < 0) ? -1 : 0;
+}
+
+/* Prints every event in [*next, head); returns how many were printed. */
+static long print_events(const struct LogRingHeader* header, u64* next) {
+  u64 head = atomic_load_explicit(&header->head, memory_order_acquire);
+  u64 skipped = 0;
+  long printed = 0;
+
+  if (head - *next > LOG_SHARED_SLOTS) {
+    skipped = head - LOG_SHARED_SLOTS - *next;
+    *next = head - LOG_SHARED_SLOTS;
+  }
+  for (size_t i = 0; i < LOG_SHARED_SLOTS; i++) {
+    if (*next >= head)
+      break;
+
+    struct LogRecord rec;
+    char line[512];
+    char path[LOG_PATH_BYTES];
+    size_t len = 0;
+
+    if (read_slot(header, *next, &rec)) {
+      memcpy(path, header->path, sizeof(path));
+      path[sizeof(path) - 1] = '\0';
+      len = logfmt_text(&rec, path, 0, line, sizeof(line));
+    }
+    (*next)++;
+    if (len == 0) {
+      skipped++;
+      continue;
+    }
+    if (fwrite(line, 1, len, stdout) != len)
+      return -1;
+    printed++;
+  }
+  if (fflush(stdout) != 0 || print_skipped(skipped) != 0)
+    return -1;
+  return printed;
+}
+
+int tail_run(const char* path, char* err_buf, size_t err_len) {
+  if (!validate_ptr(path))
+    return -1;
+
+  const struct LogRingHeader* header = map_ring(path, err_buf, err_len);
+
+  if (!header)
+    return -1;
+
+  u64 head = atomic_load_explicit(&header->head, memory_order_acquire);
+  u64 next = (head > LOG_TAIL_BACKLOG) ? head - LOG_TAIL_BACKLOG : 0;
+  pid_t pid = (pid_t)header->pid;
+  int rc = 0;
+
+  for (u64 poll = 0; poll < MAX_TAIL_POLLS; poll++) {
+    long printed = print_events(header, &next);
+
+    if (printed < 0) {
+      rc = set_error(err_buf, err_len, "cannot write to stdout");
+      break;
+    }
+    if (printed > 0)
+      continue;
+    if (atomic_load_explicit(&header->closed, memory_order_acquire))
+      break;
+    if (kill(pid, 0) != 0 && errno == ESRCH) {
+      rc = set_error(err_buf, err_len, "logging process exited");
+      break;
+    }
+
+    struct timespec pause = {0, (long)LOG_TAIL_POLL_MS * 1000000L};
+
+    if (nanosleep(&pause, NULL) != 0 && errno != EINTR) {
+      rc = set_error(err_buf, err_len, strerror(errno));
+      break;
+    }
+  }
+  /* Events published just before the close flag are not lost. */
+  if (rc == 0 && print_events(header, &next) < 0)
+    rc = set_error(err_buf, err_len, "cannot write to stdout");
+  if (munmap((void*)header, TAIL_RING_BYTES) != 0)
+    rc = -1;
+  return rc;
+}
@@ -4,11 +4,39 @@
 #include "config.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/select.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#define TERM_CLEAR "\033[2J\033[H"
+#define TERM_HOME "\033[H"
+/* Erases the rest of the last line, then everything below it. */
+#define TERM_FRAME_END "\033[K\r\n\033[J"
+/* The same after a row filled to the edge, which leaves nothing to erase. */
+#define TERM_FRAME_END_FULL "\r\n\033[J"
+/* Ends a word-wrapped row that is not the last of its page. */
+#define TERM_ROW_END "\033[K\r\n"
+#define TERM_ROW_END_FULL "\r\n"
+/* Start, text and end of each row, and the status line of a paged frame. */
+#define TERM_FRAME_IOVS (2U * MAX_FRAME_ROWS + 2U)
+/* Halvings to find the unit holding a byte; lines have at most 2^16. */
+#define TERM_UNIT_SEARCH_STEPS 18U
+/* Longest escape sequence held back for the rest of it to arrive. */
+#define TERM_ESCAPE_BYTES 16U
+#define TERM_ESCAPE_PARAM_MAX 1000U
+#define TERM_ESC 0x1B
+#define TERM_DEFAULT_ROWS 24U
+#define TERM_DEFAULT_COLS 80U
+
+enum {
+  static_assert_term_escape_bytes =
+      1 / ((TERM_ESCAPE_BYTES < TERM_INPUT_BYTES) ? 1 : 0),
+  static_assert_term_key_code = 1 / ((TERM_KEY_OTHER <= MAX_KEY_CODE) ? 1 : 0),
+};
+
 static int write_all(const char* buf, size_t len) {
   if (!assert_ptr(buf))
     return -1;
@@ -35,6 +63,67 @@ static int write_all(const char* buf, size_t len) {
   return 0;
 }
 
+static int writev_all(int fd, struct iovec* iov, size_t count) {
+  size_t first = 0;
+
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (first >= count)
+      break;
+    ssize_t n = writev(fd, &iov[first], (int)(count - first));
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      return -1;
+
+    size_t done = (size_t)n;
+
+    for (size_t j = 0; j < TERM_FRAME_IOVS; j++) {
+      if (first >= count || done < iov[first].iov_len)
+        break;
+      done -= iov[first].iov_len;
+      first++;
+    }
+    if (first < count) {
+      iov[first].iov_base = (char*)iov[first].iov_base + done;
+      iov[first].iov_len -= done;
+    }
+  }
+  if (first < count)
+    return -1;
+  return 0;
+}
+
+/* Points stdin at the controlling terminal once it has carried the deck. */
+int term_attach_tty(char* err_buf, size_t err_len) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+
+  int fd = open("/dev/tty", O_RDONLY);
+  int rc = (fd < 0) ? -1 : dup2(fd, STDIN_FILENO);
+
+  if (rc < 0) {
+    const char* err = strerror(errno);
+
+    if (!err)
+      err = "unknown error";
+    rc = snprintf(err_buf, err_len, "Failed to open terminal: %s", err);
+    if (fd >= 0 && close(fd) != 0)
+      return -1;
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
+  if (close(fd) != 0)
+    return -1;
+  return 0;
+}
+
 int term_enter_raw(struct TermState* state, char* err_buf, size_t err_len) {
   if (!validate_ptr(state))
     return -1;
@@ -110,6 +199,365 @@ int term_clear_screen(void) {
   return write_all(seq, strlen(seq));
 }
 
+/* One row of a page: text[start, end), full when it reaches the edge. */
+struct term_row {
+  size_t start;
+  size_t end;
+  int full;
+};
+
+/* Window size for a terminal that does not report one. */
+static void read_window_size(struct TermFrame* frame) {
+  struct winsize ws;
+
+  frame->rows = TERM_DEFAULT_ROWS;
+  frame->cols = TERM_DEFAULT_COLS;
+  if (ioctl(frame->fd, TIOCGWINSZ, &ws) != 0)
+    return;
+  if (ws.ws_row > 0)
+    frame->rows = ws.ws_row;
+  if (ws.ws_col > 0)
+    frame->cols = ws.ws_col;
+}
+
+int term_frame_init(struct TermFrame* frame, int fd) {
+  if (!validate_ptr(frame))
+    return -1;
+  if (!validate_ok(fd >= 0))
+    return -1;
+
+  memset(frame, 0, sizeof(*frame));
+  frame->fd = fd;
+  frame->text = "";
+  read_window_size(frame);
+  return 0;
+}
+
+/* Text without control bytes paints every cell between its first and last
+ * byte, so it fully covers whatever was there.
+ */
+static int paints_every_cell(const char* text, size_t len) {
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (i >= len)
+      return 1;
+
+    unsigned char ch = (unsigned char)text[i];
+
+    if (ch < 0x20 || ch == 0x7f)
+      return 0;
+  }
+  return 0;
+}
+
+/* Where a page starting at top ends: the first byte that would land below
+ * `rows` rows of `cols` cells with the terminal's own wrapping. *full is
+ * set when the last row is filled to the edge, where the cursor then waits
+ * to wrap and ESC[K would erase the last cell.
+ */
+static size_t raw_page_end(
+    const struct TermFrame* frame, size_t top, size_t rows, int* full) {
+  size_t cols = frame->cols;
+  size_t row = 0;
+  size_t col = 0;
+
+  *full = 0;
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (top + i >= frame->len)
+      break;
+
+    unsigned char ch = (unsigned char)frame->text[top + i];
+    size_t width = 1;
+
+    if (ch == '\r')
+      col = 0;
+    if (ch == '\t')
+      width = 8U - col % 8U;
+    else if (ch < 0x20 || ch == 0x7f)
+      width = 0;
+    if (col + width > cols) {
+      if (ch == '\t') {
+        width = cols - col;
+      } else {
+        if (row + 1 >= rows) {
+          *full = (col == cols);
+          return top + i;
+        }
+        row++;
+        col = 0;
+      }
+    }
+    col += width;
+  }
+  *full = (col == cols);
+  return frame->len;
+}
+
+static size_t unit_start(const struct TermFrame* frame, size_t unit) {
+  return frame->breaks[unit].offset;
+}
+
+static size_t unit_end(const struct TermFrame* frame, size_t unit) {
+  if (unit + 1 < frame->units)
+    return frame->breaks[unit + 1].offset;
+  return frame->len;
+}
+
+static size_t unit_width(const struct TermFrame* frame, size_t unit) {
+  size_t next = frame->width;
+
+  if (unit + 1 < frame->units)
+    next = frame->breaks[unit + 1].column;
+  if (next < frame->breaks[unit].column)
+    return 0;
+  return next - frame->breaks[unit].column;
+}
+
+/* The unit holding byte pos. */
+static size_t unit_at(const struct TermFrame* frame, size_t pos) {
+  size_t lo = 0;
+  size_t hi = frame->units;
+
+  for (size_t i = 0; i < TERM_UNIT_SEARCH_STEPS; i++) {
+    if (hi - lo <= 1)
+      break;
+    size_t mid = lo + (hi - lo) / 2U;
+
+    if (unit_start(frame, mid) <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Lays out up to `rows` word-wrapped rows from top, storing them in out
+ * when it is not NULL, and returns where the page ends. A row ends before
+ * the first unit that does not fit; a unit wider than the whole row is cut
+ * at a character. Spaces where a row wraps are not drawn. Only units cut
+ * this way are decoded.
+ */
+static size_t wrap_page_end(const struct TermFrame* frame,
+    size_t top,
+    size_t rows,
+    struct term_row* out,
+    size_t* count) {
+  size_t cols = frame->cols;
+  size_t pos = top;
+  size_t unit = unit_at(frame, top);
+
+  *count = 0;
+  for (size_t r = 0; r < MAX_FRAME_ROWS; r++) {
+    if (r >= rows || pos >= frame->len)
+      break;
+    if (pos > 0 && pos == unit_start(frame, unit) && frame->text[pos] == ' ') {
+      pos = unit_end(frame, unit);
+      unit++;
+      if (pos >= frame->len)
+        break;
+    }
+
+    size_t start = pos;
+    size_t col = 0;
+
+    for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+      if (pos >= frame->len)
+        break;
+      size_t end = unit_end(frame, unit);
+      size_t width = unit_width(frame, unit);
+
+      if (pos > unit_start(frame, unit))
+        utf8_cut(frame->text + pos, end - pos, SIZE_MAX, &width);
+      if (col + width <= cols) {
+        col += width;
+        pos = end;
+        unit++;
+        continue;
+      }
+      if (col == 0) {
+        size_t used = 0;
+        size_t cut = utf8_cut(frame->text + pos, end - pos, cols, &used);
+
+        /* A wide character in a one-column window. */
+        if (cut == 0) {
+          cut = end - pos;
+          used = width;
+        }
+        pos += cut;
+        col = used;
+        if (pos >= end)
+          unit++;
+      }
+      break;
+    }
+    if (pos == start)
+      break;
+    if (out) {
+      out[*count].start = start;
+      out[*count].end = pos;
+      out[*count].full = (col >= cols);
+    }
+    (*count)++;
+  }
+  return pos;
+}
+
+static size_t page_end(
+    const struct TermFrame* frame, size_t top, size_t rows, int* full) {
+  if (frame->units == 0)
+    return raw_page_end(frame, top, rows, full);
+
+  size_t count = 0;
+
+  *full = 0;
+  return wrap_page_end(frame, top, rows, NULL, &count);
+}
+
+/* The start of the page before the one at top. */
+static size_t page_before(const struct TermFrame* frame, size_t rows) {
+  size_t start = 0;
+  int full = 0;
+
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    size_t end = page_end(frame, start, rows, &full);
+
+    if (end >= frame->top || end <= start)
+      break;
+    start = end;
+  }
+  return start;
+}
+
+/* The last window row stays free for the status line, or for the cursor. */
+static size_t page_rows(const struct TermFrame* frame) {
+  size_t rows = (frame->rows > 1) ? frame->rows - 1 : 1;
+
+  if (rows > MAX_FRAME_ROWS)
+    rows = MAX_FRAME_ROWS;
+  return rows;
+}
+
+static int frame_paint(struct TermFrame* frame, int full_clear) {
+  struct term_row lines[MAX_FRAME_ROWS];
+  size_t count = 1;
+  size_t end = 0;
+
+  if (frame->units > 0) {
+    end = wrap_page_end(frame, frame->top, page_rows(frame), lines, &count);
+  } else {
+    end = page_end(frame, frame->top, page_rows(frame), &lines[0].full);
+    lines[0].start = frame->top;
+    lines[0].end = end;
+  }
+
+  int full = full_clear || !frame->drawn;
+
+  if (!full && frame->units == 0)
+    full = !paints_every_cell(frame->text + frame->top, end - frame->top);
+
+  const char* start = full ? TERM_CLEAR : TERM_HOME;
+  struct iovec iov[TERM_FRAME_IOVS];
+  size_t n = 0;
+
+  iov[n].iov_base = (void*)start;
+  iov[n++].iov_len = strlen(start);
+  for (size_t i = 0; i < MAX_FRAME_ROWS; i++) {
+    if (i >= count)
+      break;
+    const char* finish = lines[i].full ? TERM_ROW_END_FULL : TERM_ROW_END;
+
+    if (i + 1 == count)
+      finish = lines[i].full ? TERM_FRAME_END_FULL : TERM_FRAME_END;
+    iov[n].iov_base = (void*)(frame->text + lines[i].start);
+    iov[n++].iov_len = lines[i].end - lines[i].start;
+    iov[n].iov_base = (void*)finish;
+    iov[n++].iov_len = strlen(finish);
+  }
+  if (count == 0) {
+    iov[n].iov_base = (void*)TERM_FRAME_END;
+    iov[n++].iov_len = strlen(TERM_FRAME_END);
+  }
+  if (frame->top > 0 || end < frame->len) {
+    size_t shown = (size_t)((u64)end * 100U / frame->len);
+    int rc = snprintf(frame->status,
+        sizeof(frame->status),
+        "-- %zu%% -- < back, > more",
+        shown);
+
+    if (rc < 0)
+      return -1;
+
+    size_t status_len = strlen(frame->status);
+
+    /* A status line that wrapped would scroll the page off the top. */
+    if (status_len >= frame->cols)
+      status_len = frame->cols - 1;
+    iov[n].iov_base = frame->status;
+    iov[n++].iov_len = status_len;
+  }
+  frame->bottom = end;
+  /* After a failed write the screen state is unknown. */
+  frame->drawn = 0;
+  if (writev_all(frame->fd, iov, n) != 0)
+    return -1;
+  for (size_t i = 0; i < TERM_FRAME_IOVS; i++) {
+    if (i >= n)
+      break;
+    frame->bytes_out += iov[i].iov_len;
+  }
+  frame->drawn = 1;
+  return 0;
+}
+
+int term_frame_draw(struct TermFrame* frame,
+    const char* text,
+    size_t len,
+    const struct Utf8Break* breaks,
+    size_t units,
+    size_t width) {
+  if (!validate_ptr(frame))
+    return -1;
+  if (!validate_ptr(text))
+    return -1;
+  if (!validate_ok(len <= MAX_LINE_LEN))
+    return -1;
+  if (!validate_ok(units == 0 || breaks != NULL))
+    return -1;
+
+  frame->text = text;
+  frame->len = len;
+  frame->breaks = breaks;
+  frame->units = units;
+  frame->width = width;
+  frame->top = 0;
+  return frame_paint(frame, 0);
+}
+
+int term_frame_scroll(struct TermFrame* frame, int pages) {
+  if (!validate_ptr(frame))
+    return -1;
+
+  if (pages > 0) {
+    if (frame->bottom >= frame->len)
+      return 0;
+    frame->top = frame->bottom;
+  } else {
+    if (frame->top == 0)
+      return 0;
+    frame->top = page_before(frame, page_rows(frame));
+  }
+  return frame_paint(frame, 0);
+}
+
+int term_frame_redraw(struct TermFrame* frame) {
+  if (!validate_ptr(frame))
+    return -1;
+
+  read_window_size(frame);
+  if (frame->top > frame->len)
+    frame->top = 0;
+  return frame_paint(frame, 1);
+}
+
 int term_hide_cursor(void) {
   const char* seq = "\033[?25l";
 
@@ -122,48 +570,154 @@ int term_show_cursor(void) {
   return write_all(seq, strlen(seq));
 }
 
-int term_read_key_timeout(int timeout_ms, int* out_key) {
-  if (!validate_ptr(out_key))
-    return -1;
-  if (!validate_ok(timeout_ms >= -1))
+int term_input_init(struct TermInput* input) {
+  if (!validate_ptr(input))
     return -1;
 
-  fd_set readfds;
+  memset(input, 0, sizeof(*input));
+  return 0;
+}
 
-  FD_ZERO(&readfds);
-  FD_SET(STDIN_FILENO, &readfds);
+static int push_key(struct TermInput* input, int key) {
+  if (!assert_ok(input->count < TERM_INPUT_BYTES))
+    return -1;
+  input->keys[(input->head + input->count) % TERM_INPUT_BYTES] = key;
+  input->count++;
+  return 0;
+}
 
-  struct timeval tv;
-  struct timeval* tv_ptr = NULL;
+static int csi_key(unsigned char final, unsigned int param) {
+  if (final == 'A')
+    return TERM_KEY_UP;
+  if (final == 'B')
+    return TERM_KEY_DOWN;
+  if (final == 'C')
+    return TERM_KEY_RIGHT;
+  if (final == 'D')
+    return TERM_KEY_LEFT;
+  if (final == 'H')
+    return TERM_KEY_HOME;
+  if (final == 'F')
+    return TERM_KEY_END;
+  if (final != '~')
+    return TERM_KEY_OTHER;
+  if (param == 1 || param == 7)
+    return TERM_KEY_HOME;
+  if (param == 4 || param == 8)
+    return TERM_KEY_END;
+  if (param == 5)
+    return TERM_KEY_PAGE_UP;
+  if (param == 6)
+    return TERM_KEY_PAGE_DOWN;
+  return TERM_KEY_OTHER;
+}
 
-  if (timeout_ms >= 0) {
-    tv.tv_sec = timeout_ms / 1000;
-    tv.tv_usec = (timeout_ms % 1000) * 1000;
-    tv_ptr = &tv;
+/* Decodes the escape sequence at s[0] (ESC [ ... or ESC O x). Returns its
+ * length with *key set, or 0 when len ends before it does.
+ */
+static size_t decode_escape(const unsigned char* s, size_t len, int* key) {
+  if (s[1] == 'O') {
+    if (len < 3)
+      return 0;
+    *key = csi_key(s[2], 0);
+    return 3;
   }
 
-  int ready = select(STDIN_FILENO + 1, &readfds, NULL, NULL, tv_ptr);
+  unsigned int param = 0;
+  int first = 1;
 
-  if (ready < 0) {
-    if (errno == EINTR)
+  for (size_t i = 2; i < TERM_ESCAPE_BYTES; i++) {
+    if (i >= len)
       return 0;
-    return -1;
+    unsigned char ch = s[i];
+
+    if (ch >= '0' && ch <= '9') {
+      if (first && param < TERM_ESCAPE_PARAM_MAX)
+        param = param * 10U + (unsigned int)(ch - '0');
+      continue;
+    }
+    if (ch == ';') {
+      first = 0;
+      continue;
+    }
+    if (ch >= 0x20U && ch <= 0x3FU)
+      continue;
+    *key = (ch >= 0x40U && ch <= 0x7EU) ? csi_key(ch, param) : TERM_KEY_OTHER;
+    return i + 1;
   }
-  if (ready == 0)
-    return 0;
-  if (!assert_ok(ready == 1))
+  /* Too long for any key this program knows. */
+  *key = TERM_KEY_OTHER;
+  return TERM_ESCAPE_BYTES;
+}
+
+/* Queues the keys in bytes[0, len) and keeps an escape sequence cut off at
+ * the end for the next read. A lone ESC at the end is the Esc key: the
+ * terminal sends a whole sequence at once.
+ */
+static int decode_keys(struct TermInput* input, size_t len) {
+  const unsigned char* s = input->bytes;
+  size_t pos = 0;
+
+  for (size_t i = 0; i < TERM_INPUT_BYTES; i++) {
+    if (pos >= len)
+      break;
+
+    int key = s[pos];
+    size_t used = 1;
+
+    if (key == TERM_ESC && pos + 1 < len &&
+        (s[pos + 1] == '[' || s[pos + 1] == 'O')) {
+      used = decode_escape(&s[pos], len - pos, &key);
+      if (used == 0)
+        break;
+    }
+    if (push_key(input, key) != 0)
+      return -1;
+    pos += used;
+  }
+  input->pending = len - pos;
+  if (input->pending > 0)
+    memmove(input->bytes, &s[pos], input->pending);
+  return 0;
+}
+
+int term_input_read(struct TermInput* input, int fd) {
+  if (!validate_ptr(input))
     return -1;
-  if (!assert_ok(FD_ISSET(STDIN_FILENO, &readfds)))
+  if (!validate_ok(fd >= 0))
+    return -1;
+  if (!assert_ok(input->pending < TERM_ESCAPE_BYTES))
     return -1;
 
-  unsigned char ch = 0;
-  ssize_t n = read(STDIN_FILENO, &ch, 1);
+  /* Every byte makes at most one key, so the queue cannot overflow. */
+  size_t room = TERM_INPUT_BYTES - input->count;
 
-  if (n == 1) {
-    *out_key = (int)ch;
-    return 1;
-  }
-  if (n < 0 && errno == EINTR)
+  if (room <= input->pending)
+    return 0;
+  room -= input->pending;
+
+  ssize_t n = read(fd, &input->bytes[input->pending], room);
+
+  /* Raw mode has VMIN and VTIME at 0, so a drained input reads 0. */
+  if (n < 0)
+    return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+  if (n == 0)
+    return 0;
+  if (decode_keys(input, input->pending + (size_t)n) != 0)
+    return -1;
+  return (int)n;
+}
+
+int term_input_next(struct TermInput* input, int* out_key) {
+  if (!validate_ptr(input))
+    return -1;
+  if (!validate_ptr(out_key))
+    return -1;
+
+  if (input->count == 0)
     return 0;
-  return -1;
+  *out_key = input->keys[input->head];
+  input->head = (input->head + 1U) % TERM_INPUT_BYTES;
+  input->count--;
+  return 1;
 }
@@ -0,0 +1,356 @@
+// SPDX-License-Identifier: MIT
+#include "utf8.h"
+
+#define UTF8_ZWJ 0x200DU
+/* Enough halvings for either table. */
+#define UTF8_SEARCH_STEPS 16U
+
+enum utf8_unit {
+  UTF8_UNIT_WORD,
+  UTF8_UNIT_SPACE,
+  UTF8_UNIT_WIDE,
+};
+
+struct utf8_range {
+  u32 first;
+  u32 last;
+};
+
+/* Combining marks and other characters that take no cell. */
+static const struct utf8_range zero_width[] = {
+    {0x0300, 0x036F},
+    {0x0483, 0x0489},
+    {0x0591, 0x05BD},
+    {0x05BF, 0x05BF},
+    {0x05C1, 0x05C2},
+    {0x05C4, 0x05C5},
+    {0x05C7, 0x05C7},
+    {0x0610, 0x061A},
+    {0x064B, 0x065F},
+    {0x0670, 0x0670},
+    {0x06D6, 0x06DC},
+    {0x06DF, 0x06E4},
+    {0x06E7, 0x06E8},
+    {0x06EA, 0x06ED},
+    {0x0900, 0x0902},
+    {0x093A, 0x093A},
+    {0x093C, 0x093C},
+    {0x0941, 0x0948},
+    {0x094D, 0x094D},
+    {0x0951, 0x0957},
+    {0x0E31, 0x0E31},
+    {0x0E34, 0x0E3A},
+    {0x0E47, 0x0E4E},
+    {0x1160, 0x11FF},
+    {0x1AB0, 0x1AFF},
+    {0x1DC0, 0x1DFF},
+    {0x200B, 0x200F},
+    {0x202A, 0x202E},
+    {0x2060, 0x2064},
+    {0x20D0, 0x20FF},
+    {0x302A, 0x302D},
+    {0x3099, 0x309A},
+    {0xFE00, 0xFE0F},
+    {0xFE20, 0xFE2F},
+    {0xFEFF, 0xFEFF},
+    {0x1F3FB, 0x1F3FF},
+    {0xE0000, 0xE0FFF},
+};
+
+/* East Asian wide and fullwidth characters, and emoji shown as such. */
+static const struct utf8_range wide[] = {
+    {0x1100, 0x115F},
+    {0x231A, 0x231B},
+    {0x2329, 0x232A},
+    {0x23E9, 0x23EC},
+    {0x23F0, 0x23F0},
+    {0x23F3, 0x23F3},
+    {0x25FD, 0x25FE},
+    {0x2614, 0x2615},
+    {0x2648, 0x2653},
+    {0x267F, 0x267F},
+    {0x2693, 0x2693},
+    {0x26A1, 0x26A1},
+    {0x26AA, 0x26AB},
+    {0x26BD, 0x26BE},
+    {0x26C4, 0x26C5},
+    {0x26CE, 0x26CE},
+    {0x26D4, 0x26D4},
+    {0x26EA, 0x26EA},
+    {0x26F2, 0x26F3},
+    {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA},
+    {0x26FD, 0x26FD},
+    {0x2705, 0x2705},
+    {0x270A, 0x270B},
+    {0x2728, 0x2728},
+    {0x274C, 0x274C},
+    {0x274E, 0x274E},
+    {0x2753, 0x2755},
+    {0x2757, 0x2757},
+    {0x2795, 0x2797},
+    {0x27B0, 0x27B0},
+    {0x27BF, 0x27BF},
+    {0x2B1B, 0x2B1C},
+    {0x2B50, 0x2B50},
+    {0x2B55, 0x2B55},
+    {0x2E80, 0x303E},
+    {0x3041, 0x33FF},
+    {0x3400, 0x4DBF},
+    {0x4E00, 0x9FFF},
+    {0xA000, 0xA4CF},
+    {0xA960, 0xA97F},
+    {0xAC00, 0xD7A3},
+    {0xF900, 0xFAFF},
+    {0xFE10, 0xFE19},
+    {0xFE30, 0xFE6F},
+    {0xFF00, 0xFF60},
+    {0xFFE0, 0xFFE6},
+    {0x16FE0, 0x16FE4},
+    {0x17000, 0x18CFF},
+    {0x1B000, 0x1B2FF},
+    {0x1F004, 0x1F004},
+    {0x1F0CF, 0x1F0CF},
+    {0x1F18E, 0x1F18E},
+    {0x1F191, 0x1F19A},
+    {0x1F200, 0x1F251},
+    {0x1F260, 0x1F265},
+    {0x1F300, 0x1F320},
+    {0x1F32D, 0x1F335},
+    {0x1F337, 0x1F37C},
+    {0x1F37E, 0x1F393},
+    {0x1F3A0, 0x1F3CA},
+    {0x1F3CF, 0x1F3D3},
+    {0x1F3E0, 0x1F3F0},
+    {0x1F3F4, 0x1F3F4},
+    {0x1F3F8, 0x1F43E},
+    {0x1F440, 0x1F440},
+    {0x1F442, 0x1F4FC},
+    {0x1F4FF, 0x1F53D},
+    {0x1F54B, 0x1F54E},
+    {0x1F550, 0x1F567},
+    {0x1F57A, 0x1F57A},
+    {0x1F595, 0x1F596},
+    {0x1F5A4, 0x1F5A4},
+    {0x1F5FB, 0x1F64F},
+    {0x1F680, 0x1F6C5},
+    {0x1F6CC, 0x1F6CC},
+    {0x1F6D0, 0x1F6D2},
+    {0x1F6D5, 0x1F6D7},
+    {0x1F6DC, 0x1F6DF},
+    {0x1F6EB, 0x1F6EC},
+    {0x1F6F4, 0x1F6FC},
+    {0x1F7E0, 0x1F7EB},
+    {0x1F7F0, 0x1F7F0},
+    {0x1F90C, 0x1F93A},
+    {0x1F93C, 0x1F945},
+    {0x1F947, 0x1F9FF},
+    {0x1FA70, 0x1FAFF},
+    {0x20000, 0x2FFFD},
+    {0x30000, 0x3FFFD},
+};
+
+#define UTF8_ZERO_WIDTH_COUNT (sizeof(zero_width) / sizeof(zero_width[0]))
+#define UTF8_WIDE_COUNT (sizeof(wide) / sizeof(wide[0]))
+
+enum {
+  static_assert_zero_width_steps =
+      1 / ((UTF8_ZERO_WIDTH_COUNT < (1U << UTF8_SEARCH_STEPS)) ? 1 : 0),
+  static_assert_wide_steps =
+      1 / ((UTF8_WIDE_COUNT < (1U << UTF8_SEARCH_STEPS)) ? 1 : 0),
+};
+
+static int in_table(const struct utf8_range* table, size_t count, u32 cp) {
+  size_t lo = 0;
+  size_t hi = count;
+
+  if (cp < table[0].first || cp > table[count - 1].last)
+    return 0;
+  for (size_t i = 0; i < UTF8_SEARCH_STEPS; i++) {
+    if (lo >= hi)
+      break;
+    size_t mid = lo + (hi - lo) / 2U;
+
+    if (cp < table[mid].first)
+      hi = mid;
+    else if (cp > table[mid].last)
+      lo = mid + 1U;
+    else
+      return 1;
+  }
+  return 0;
+}
+
+/* Display width of cp, or -1 for a control character. */
+static int char_width(u32 cp) {
+  if (cp < 0x20U || (cp >= 0x7FU && cp < 0xA0U))
+    return -1;
+  if (cp < 0x300U)
+    return 1;
+  if (in_table(zero_width, UTF8_ZERO_WIDTH_COUNT, cp))
+    return 0;
+  if (in_table(wide, UTF8_WIDE_COUNT, cp))
+    return 2;
+  return 1;
+}
+
+static int is_cont(unsigned char ch) {
+  return (ch & 0xC0U) == 0x80U;
+}
+
+/* Decodes the character at the start of s. Returns its length, or 0 for an
+ * overlong, surrogate, out of range or truncated sequence.
+ */
+static size_t decode(const unsigned char* s, size_t len, u32* cp) {
+  unsigned char b0 = s[0];
+
+  if (b0 < 0x80U) {
+    *cp = b0;
+    return 1;
+  }
+  if (b0 >= 0xC2U && b0 <= 0xDFU) {
+    if (len < 2 || !is_cont(s[1]))
+      return 0;
+    *cp = ((u32)(b0 & 0x1FU) << 6) | (u32)(s[1] & 0x3FU);
+    return 2;
+  }
+  if (b0 >= 0xE0U && b0 <= 0xEFU) {
+    if (len < 3 || !is_cont(s[1]) || !is_cont(s[2]))
+      return 0;
+    if ((b0 == 0xE0U && s[1] < 0xA0U) || (b0 == 0xEDU && s[1] > 0x9FU))
+      return 0;
+    *cp = ((u32)(b0 & 0x0FU) << 12) | ((u32)(s[1] & 0x3FU) << 6) |
+        (u32)(s[2] & 0x3FU);
+    return 3;
+  }
+  if (b0 >= 0xF0U && b0 <= 0xF4U) {
+    if (len < 4 || !is_cont(s[1]) || !is_cont(s[2]) || !is_cont(s[3]))
+      return 0;
+    if ((b0 == 0xF0U && s[1] < 0x90U) || (b0 == 0xF4U && s[1] > 0x8FU))
+      return 0;
+    *cp = ((u32)(b0 & 0x07U) << 18) | ((u32)(s[1] & 0x3FU) << 12) |
+        ((u32)(s[2] & 0x3FU) << 6) | (u32)(s[3] & 0x3FU);
+    return 4;
+  }
+  return 0;
+}
+
+/* 1 if text is valid UTF-8 without control characters. Checked before
+ * any unit is stored, so text laid out byte by byte leaves the break table
+ * untouched for the lines after it.
+ */
+static int is_printable(const unsigned char* s, size_t len) {
+  size_t pos = 0;
+
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (pos >= len)
+      break;
+    if (s[pos] >= 0x20U && s[pos] < 0x7FU) {
+      pos++;
+      continue;
+    }
+
+    u32 cp = 0;
+    size_t n = decode(s + pos, len - pos, &cp);
+
+    if (n == 0 || cp < 0x20U || (cp >= 0x7FU && cp < 0xA0U))
+      return 0;
+    pos += n;
+  }
+  return 1;
+}
+
+size_t utf8_breaks(const char* text,
+    size_t len,
+    struct Utf8Break* out,
+    size_t cap,
+    u32* width) {
+  if (!validate_ptr(text))
+    return 0;
+  if (!validate_ptr(width))
+    return 0;
+  if (!validate_ok(len <= MAX_LINE_LEN))
+    return 0;
+
+  const unsigned char* s = (const unsigned char*)text;
+  size_t pos = 0;
+  size_t count = 0;
+  u32 cols = 0;
+  int prev = UTF8_UNIT_WORD;
+  int joined = 0;
+
+  *width = 0;
+  if (out && !is_printable(s, len))
+    return 0;
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (pos >= len)
+      break;
+    u32 cp = 0;
+    size_t n = decode(s + pos, len - pos, &cp);
+
+    if (n == 0)
+      return 0;
+
+    int w = char_width(cp);
+
+    if (w < 0)
+      return 0;
+
+    int kind = UTF8_UNIT_WORD;
+
+    if (cp == ' ')
+      kind = UTF8_UNIT_SPACE;
+    else if (w == 2)
+      kind = UTF8_UNIT_WIDE;
+
+    int starts = (count == 0);
+
+    if (count > 0 && w > 0 && !joined)
+      starts = (kind == UTF8_UNIT_WIDE || kind != prev);
+    if (starts) {
+      if (out) {
+        if (!assert_ok(count < cap))
+          return 0;
+        out[count].offset = (u16)pos;
+        out[count].column = (u16)cols;
+      }
+      count++;
+      prev = kind;
+    }
+    joined = (cp == UTF8_ZWJ);
+    cols += (u32)w;
+    pos += n;
+  }
+  *width = cols;
+  return count;
+}
+
+size_t utf8_cut(const char* text, size_t len, size_t cols, size_t* width) {
+  if (!validate_ptr(text))
+    return 0;
+  if (!validate_ptr(width))
+    return 0;
+
+  const unsigned char* s = (const unsigned char*)text;
+  size_t pos = 0;
+  size_t used = 0;
+
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (pos >= len)
+      break;
+    u32 cp = 0;
+    size_t n = decode(s + pos, len - pos, &cp);
+    int w = (n == 0) ? 1 : char_width(cp);
+
+    if (n == 0)
+      n = 1;
+    if (w < 0)
+      w = 0;
+    if (w > 0 && used + (size_t)w > cols)
+      break;
+    used += (size_t)w;
+    pos += n;
+  }
+  *width = used;
+  return pos;
+}